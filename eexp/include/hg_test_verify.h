@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_VERIFY_H
+#define HG_TEST_VERIFY_H
+
+#include <stddef.h>
+
+/* The test pattern: byte i of a transfer is (char) i, so a chunk starting
+ * at offset holds (char) (offset + i) at index i. The kernels below are
+ * vectorized (AVX2, SSE2 or NEON, picked at runtime) with a scalar
+ * fallback. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Fill buf with n bytes of the pattern, starting at offset
+ */
+void
+hg_test_pattern_fill(void *buf, size_t offset, size_t n);
+
+/**
+ * Index of the first of the n bytes of buf that does not match the pattern
+ * starting at offset, n if they all match
+ */
+size_t
+hg_test_pattern_check(const void *buf, size_t offset, size_t n);
+
+/**
+ * Name of the kernel in use
+ */
+const char *
+hg_test_pattern_impl(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_VERIFY_H */
@@ -21,6 +21,7 @@
 #include "mercury_atomic.h"
 
 #include "test_bulk.h"
+#include "hg_test_verify.h"
 
 /*************************************/
 /* Public Type and Struct Definition */
@@ -71,8 +71,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 
 	/* Prepare bulk_buf */
 	bulk_buf = malloc(nbytes);
-	for (i = 0; i < nbytes; i++)
-		bulk_buf[i] = (char) i;
+	hg_test_pattern_fill(bulk_buf, 0, nbytes);
 	buf_ptrs = (void **) &bulk_buf;
 	buf_sizes = &nbytes;
 
@@ -224,13 +224,10 @@ hg_test_perf_bulk_transfer_cb(const struct hg_cb_info *hg_cb_info)
     hg_time_t t1, t2;
     hg_time_get_current(&t1);
     buf_ptr = (const char*) buf;
-    for (i = 0; i < size; i++) {
-        if (buf_ptr[i] != (char) i) {
-            printf("Error detected in bulk transfer, buf[%d] = %d, "
-                "was expecting %d!\n", (int) i, (char) buf_ptr[i], (char) i);
-            break;
-        }
-    }
+    i = hg_test_pattern_check(buf_ptr, 0, size);
+    if (i < size)
+        printf("Error detected in bulk transfer, buf[%d] = %d, "
+            "was expecting %d!\n", (int) i, (char) buf_ptr[i], (char) i);
     hg_time_get_current(&t2);
     comp_time += hg_time_to_double(hg_time_subtract(t2, t1)); 
     comp_num++;
@@ -163,7 +163,6 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
         || hg_test_info->na_test_info.self_send) {
         size_t bulk_size = 1024 * 1024 * MERCURY_TESTING_BUFFER_SIZE;
         char *buf_ptr;
-        size_t i;
 
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
         /* Create thread pool */
@@ -182,8 +181,7 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
             &hg_test_info->bulk_handle);
         HG_Bulk_access(hg_test_info->bulk_handle, 0, bulk_size,
             HG_BULK_READWRITE, 1, (void **) &buf_ptr, NULL, NULL);
-        for (i = 0; i < bulk_size; i++)
-            buf_ptr[i] = (char) i;
+        hg_test_pattern_fill(buf_ptr, 0, bulk_size);
     }
 
     if (hg_test_info->na_test_info.listen) {
@@ -0,0 +1,96 @@
+
+#ifndef BULK_POOL_H
+#define BULK_POOL_H
+
+#include <stdint.h>
+#include <mercury_config.h>
+#include <mercury_bulk.h>
+#include <mercury.h>
+
+/* Pool of pre-registered bulk regions, grouped in power-of-two size classes
+ * between min_size and max_size. Requests larger than max_size are served
+ * by a one-off registration that is released on return. */
+struct bulk_pool;
+
+struct bulk_pool_buf {
+	void *buffer;
+	hg_size_t size;			// capacity of the region
+	hg_bulk_t bulk_handle;		// registration covering the whole region
+	int size_class;			// -1 if not pooled
+	int backing;			// BULK_MEM_* obtained
+	struct bulk_pool_buf *next;
+};
+
+struct bulk_pool_stats {
+	uint64_t hits;			// checkouts served from a free list
+	uint64_t misses;		// checkouts that had to register memory
+	uint64_t in_use;		// regions currently checked out
+	uint64_t high_water;		// max regions checked out at once
+	uint64_t registered_bytes;	// bytes currently registered
+	uint64_t register_ns;		// spent allocating and registering
+};
+
+/* Backing of bulk memory. Huge pages cut the TLB misses and page faults of
+ * touching and registering large regions. hugetlb pages come from the
+ * reserved pool (vm.nr_hugepages), a request it cannot serve falls back
+ * from 1 GB to 2 MB pages, then to transparent huge pages, then to the
+ * heap. */
+#define BULK_MEM_DEFAULT 0	// page aligned heap memory
+#define BULK_MEM_THP 1		// anonymous mapping advised MADV_HUGEPAGE
+#define BULK_MEM_HUGE_2M 2	// MAP_HUGETLB, 2 MB pages
+#define BULK_MEM_HUGE_1G 3	// MAP_HUGETLB, 1 GB pages
+
+/* *backing is what to try first on entry, what was obtained on return.
+ * With prefault every page is touched before returning, so neither the
+ * registration nor the first transfer takes the faults. */
+void *bulk_mem_alloc(hg_size_t size, int *backing, int prefault);
+
+/* Same, with the pages placed on NUMA node if it has room, node -1 is
+ * bulk_mem_alloc() */
+#define BULK_MEM_MAX_NODES 64
+void *bulk_mem_alloc_node(hg_size_t size, int *backing, int prefault,
+	int node);
+
+/* backing as obtained from bulk_mem_alloc() */
+void bulk_mem_free(void *buf, hg_size_t size, int backing);
+
+/* "none", "thp", "2m" or "1g", bulk_mem_parse() returns -1 for others */
+const char *bulk_mem_name(int backing);
+int bulk_mem_parse(const char *name);
+
+struct bulk_pool *bulk_pool_create(hg_class_t *hg_class, hg_size_t min_size,
+	hg_size_t max_size, unsigned int max_cached);
+
+/* Back the regions registered from now on with bulk_mem_alloc(), call it
+ * before bulk_pool_reserve(). Regions smaller than a page of backing fall
+ * back to the next smaller one. */
+void bulk_pool_set_backing(struct bulk_pool *pool, int backing,
+	int prefault);
+
+/* Place the regions registered from now on on a NUMA node, -1 (default)
+ * leaves them where the thread registering them first touches them */
+void bulk_pool_set_node(struct bulk_pool *pool, int node);
+
+void bulk_pool_destroy(struct bulk_pool *pool);
+
+/* Register count regions of the size class holding size ahead of time */
+int bulk_pool_reserve(struct bulk_pool *pool, hg_size_t size,
+	unsigned int count);
+
+struct bulk_pool_buf *bulk_pool_checkout(struct bulk_pool *pool,
+	hg_size_t size);
+
+void bulk_pool_return(struct bulk_pool *pool, struct bulk_pool_buf *buf);
+
+void bulk_pool_get_stats(struct bulk_pool *pool,
+	struct bulk_pool_stats *stats);
+
+/* Called right before a region is unregistered and freed, for users that
+ * keep other registrations (e.g. with the kernel) aliasing it */
+typedef void (*bulk_pool_release_cb_t)(struct bulk_pool_buf *buf, void *arg);
+
+void bulk_pool_set_release_cb(struct bulk_pool *pool,
+	bulk_pool_release_cb_t cb, void *arg);
+
+#endif
+
@@ -0,0 +1,40 @@
+
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include <stddef.h>
+
+/* Intrusive lock-free multi-producer single-consumer queue. Producers
+ * (progress threads) push from callbacks; one consumer pops or blocks on
+ * an eventfd that producers only signal when the consumer is asleep. */
+
+struct cq_node {
+	struct cq_node *next;
+};
+
+struct completion_queue {
+	struct cq_node *head;		// producers push here
+	char pad[64 - sizeof(struct cq_node *)];
+	struct cq_node *tail;		// consumer pops here
+	struct cq_node stub;
+	int waiting;			// consumer is (about to be) blocked
+	int efd;
+};
+
+#define cq_entry(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+int cq_init(struct completion_queue *cq);
+
+void cq_destroy(struct completion_queue *cq);
+
+void cq_push(struct completion_queue *cq, struct cq_node *node);
+
+/* Non-blocking, returns NULL if empty */
+struct cq_node *cq_pop(struct completion_queue *cq);
+
+/* Block up to timeout_ms (-1 for ever) until a node is available */
+struct cq_node *cq_wait(struct completion_queue *cq, int timeout_ms);
+
+#endif
+
@@ -0,0 +1,40 @@
+
+#ifndef HANDLE_POOL_H
+#define HANDLE_POOL_H
+
+#include <mercury_config.h>
+#include <mercury.h>
+
+/* Free-lists of RPC handles, one per target address. Completed handles are
+ * put back instead of destroyed and recycled with HG_Reset, which skips
+ * the allocation and NA setup HG_Create goes through on every forward. */
+struct handle_pool;
+
+struct handle_pool_stats {
+	uint64_t created;	// handles made by HG_Create
+	uint64_t reused;	// handles recycled through HG_Reset
+	uint64_t destroyed;
+	unsigned int cached;	// idle handles across all targets
+};
+
+struct handle_pool *handle_pool_create(hg_context_t *context, hg_id_t id,
+	unsigned int max_cached);
+
+void handle_pool_destroy(struct handle_pool *pool);
+
+/* Idle handle to addr if there is one, else a new one */
+hg_return_t handle_pool_get(struct handle_pool *pool, hg_addr_t addr,
+	hg_handle_t *handle);
+
+/* Only put back handles whose forward completed successfully */
+void handle_pool_put(struct handle_pool *pool, hg_addr_t addr,
+	hg_handle_t handle);
+
+/* Destroy the idle handles to addr, e.g. before it is freed */
+void handle_pool_evict(struct handle_pool *pool, hg_addr_t addr);
+
+void handle_pool_get_stats(struct handle_pool *pool,
+	struct handle_pool_stats *stats);
+
+#endif
+
@@ -0,0 +1,60 @@
+
+#ifndef PROGRESS_DRIVER_H
+#define PROGRESS_DRIVER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <mercury_config.h>
+#include <mercury.h>
+
+/* Drives HG_Progress() on one context from one thread. An idle driver does
+ * not go to sleep in the NA layer right away: it first polls with a zero
+ * timeout (spin), then keeps polling but gives the core away between polls
+ * (yield) for as long again, and only then blocks. Whatever completes during
+ * the first two phases is picked up without waking a blocked thread.
+ *
+ * The spin window follows the traffic. It is twice the average gap between
+ * events, at most spin_us, and zero while the gaps are longer than spin_us,
+ * so an idle or sparse stream still blocks right away. */
+struct progress_driver_stats {
+	uint64_t events;	// progress calls that found work
+	uint64_t spin_hits;	// ... while spinning
+	uint64_t yield_hits;	// ... while yielding
+	uint64_t block_hits;	// ... after blocking
+	uint64_t blocks;	// blocking HG_Progress() calls
+	uint64_t triggered;	// callbacks run by progress_driver_step()
+};
+
+struct progress_driver {
+	hg_context_t *context;
+	uint64_t spin_ns;	// 0 always blocks, like plain HG_Progress()
+	unsigned int block_ms;	// timeout of progress_driver_step()
+	int (*busy)(void);	// nonzero while work is pending elsewhere
+	uint64_t last_event_ns;
+	uint64_t gap_ns;	// moving average of the gaps between events
+	struct progress_driver_stats stats;
+};
+
+void progress_driver_init(struct progress_driver *driver,
+	hg_context_t *context, unsigned int spin_us, unsigned int block_ms);
+
+/* Polled before blocking, the driver only polls while it returns nonzero */
+void progress_driver_set_busy(struct progress_driver *driver,
+	int (*busy)(void));
+
+/* Spin, yield, then block for what is left of timeout_ms. Returns like
+ * HG_Progress(): HG_SUCCESS once something completed, HG_TIMEOUT or an
+ * error. */
+hg_return_t progress_driver_progress(struct progress_driver *driver,
+	unsigned int timeout_ms);
+
+/* One round of a trigger/progress loop: run the completed callbacks, then
+ * progress for up to block_ms */
+hg_return_t progress_driver_step(struct progress_driver *driver);
+
+/* One line, prefixed with "# name" */
+void progress_driver_print_stats(const struct progress_driver *driver,
+	FILE *out, const char *name);
+
+#endif
+
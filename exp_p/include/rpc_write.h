@@ -7,16 +7,277 @@
 #include <mercury.h>
 #include <mercury_macros.h>
 
+#include <sys/uio.h>
+
+#include "bulk_pool.h"
+#include "completion_queue.h"
+#include "addr_cache.h"
+#include "handle_pool.h"
+#include "crc32c.h"
+
+/* write_in_t checksum_type, the checksum covers the whole buffer */
+#define WRITE_CHECKSUM_NONE 0
+#define WRITE_CHECKSUM_CRC32C 1
+
 MERCURY_GEN_PROC(write_out_t, ((int32_t)(ret)))
+/* Where the bytes of a write go in the server's target file. With ndims 0
+ * they are stored back to back. Otherwise they are the row-major elements
+ * of a count[0] x ... x count[ndims - 1] block, the last dimension
+ * fastest, and element (i_0, ..., i_ndims-1) is stored at
+ *   origin + sum over d of (offset[d] + i_d) * stride[d]
+ * stride[] is in bytes and each dimension must clear the extent of those
+ * inside it, e.g. a 2D tile of a global row-major array of elem_size
+ * elements has stride { row bytes, elem_size }. Dimensions that are back
+ * to back in the file are merged, every remaining run is one segment of
+ * the bulk handle the server pulls into, so the transfer scatters the
+ * data to its final place. Unless WRITE_LAYOUT_PLACED is set, the block
+ * is appended and origin is where the append starts, which also holds for
+ * the contiguous case. Only ndims dimensions go on the wire. */
+#define WRITE_LAYOUT_MAX_DIMS 4
+#define WRITE_LAYOUT_PLACED 1	// origin is an offset in the target file
+
+typedef struct {
+	uint32_t ndims;
+	uint32_t flags;
+	uint64_t origin;
+	uint64_t elem_size;
+	uint64_t offset[WRITE_LAYOUT_MAX_DIMS];
+	uint64_t count[WRITE_LAYOUT_MAX_DIMS];
+	uint64_t stride[WRITE_LAYOUT_MAX_DIMS];
+} write_layout_t;
+
+static HG_INLINE hg_return_t hg_proc_write_layout_t(hg_proc_t proc,
+		void *data) {
+	write_layout_t *layout = data;
+	hg_return_t ret;
+	uint32_t d;
+	
+	ret = hg_proc_uint32_t(proc, &layout->ndims);
+	if (ret != HG_SUCCESS)
+		return ret;
+	if (layout->ndims > WRITE_LAYOUT_MAX_DIMS)
+		return HG_PROTOCOL_ERROR;
+	ret = hg_proc_uint32_t(proc, &layout->flags);
+	if (ret == HG_SUCCESS)
+		ret = hg_proc_uint64_t(proc, &layout->origin);
+	if (ret != HG_SUCCESS || layout->ndims == 0)
+		return ret;
+	ret = hg_proc_uint64_t(proc, &layout->elem_size);
+	for (d = 0; d < layout->ndims && ret == HG_SUCCESS; ++d) {
+		ret = hg_proc_uint64_t(proc, &layout->offset[d]);
+		if (ret == HG_SUCCESS)
+			ret = hg_proc_uint64_t(proc, &layout->count[d]);
+		if (ret == HG_SUCCESS)
+			ret = hg_proc_uint64_t(proc, &layout->stride[d]);
+	}
+	return ret;
+}
+
+/* size bytes are pulled from bulk_offset of bulk_handle and stored as
+ * layout says */
 MERCURY_GEN_PROC(write_in_t,
 	((int32_t)(size))\
+	((uint32_t)(checksum_type))\
+	((uint32_t)(checksum))\
+	((uint64_t)(bulk_offset))\
+	((write_layout_t)(layout))\
 	((hg_bulk_t)(bulk_handle)))
 
+/* count records, see struct write_batch_state for the bulk layout. The
+ * answer counts the records stored, ret is for the one after them. */
+MERCURY_GEN_PROC(write_batch_out_t,
+	((int32_t)(ret))\
+	((uint32_t)(count)))
+MERCURY_GEN_PROC(write_batch_in_t,
+	((uint32_t)(count))\
+	((hg_bulk_t)(bulk_handle)))
+
+/* Streams, records are applied in seq order. acked counts the records of
+ * the stream applied so far, ret is the first error on the stream. */
+MERCURY_GEN_PROC(stream_append_in_t,
+	((uint64_t)(stream_id))\
+	((uint64_t)(seq))\
+	((int32_t)(size))\
+	((hg_bulk_t)(bulk_handle)))
+MERCURY_GEN_PROC(stream_sync_in_t,
+	((uint64_t)(stream_id))\
+	((uint64_t)(count))\
+	((uint32_t)(close)))
+MERCURY_GEN_PROC(stream_ack_t,
+	((int32_t)(ret))\
+	((uint64_t)(acked)))
+
+/* Register the RPCs on the class remote servers are reached through, call
+ * before any other function */
 hg_id_t write_register(hg_class_t *hg_c, hg_context_t *context);
 
-uint32_t rpc_write(int32_t size, void *buffer, char *host);
+/* Shared memory: servers also listen on an na+sm class and publish its
+ * address under the port of their tcp address (write_publish_local()).
+ * Clients that register an na+sm class too send everything meant for a
+ * host of this node (localhost, 127.*, gethostname()) whose server
+ * published an address through it instead of loopback tcp. Bulk pulls
+ * then go through cross-memory attach, a single copy from the client
+ * buffer to the server one, which needs ptrace rights on the client
+ * (same user, yama ptrace_scope 0). */
+hg_id_t write_register_local(hg_class_t *hg_c, hg_context_t *context);
+
+/* Server side, after write_register_local(). host is the tcp address the
+ * server listens on. Returns -1 if the address could not be published. */
+int write_publish_local(const char *host);
+
+/* Server side, at shutdown, so that clients go back to tcp for host */
+void write_unpublish_local(const char *host);
+
+/* Client side, 0 sends everything over tcp again (on by default). Hosts
+ * are resolved once per batcher, stream and stripe layout, when they are
+ * created, and per write otherwise. A host is resolved again after na+sm
+ * failed to reach it, writes and batches that could not be sent through
+ * it go over tcp instead. */
+void write_set_local(int enable);
+
+/* Client side, the number of contexts servers listen on (1 by default,
+ * at most 256). Writes and stripes over tcp go round robin over them,
+ * each batcher and stream sticks to one, picked when it is created. */
+void write_set_target_contexts(unsigned int count);
+
+/* Whether writes to host take the shared memory path right now */
+int write_host_is_local(const char *host);
+
+/* write_set_target() sync policies, applied to every write before its ack */
+#define WRITE_SYNC_NONE 0	// left in the page cache
+#define WRITE_SYNC_ASYNC 1	// writeback started, not waited for
+#define WRITE_SYNC_DATA 2	// on disk
+
+/* Server side: append the received writes to path, which is truncated,
+ * instead of dropping them. Writes of 64 KB and more are pulled straight
+ * into a shared mapping of the file, smaller ones and batches land in a
+ * pooled buffer and are copied in with pwrite(). Returns -1 with errno set
+ * if path cannot be opened. */
+int write_set_target(const char *path, int sync);
+
+/* Client side: writes are submitted against a completion queue and
+ * identified by a ticket, unique per queue. Each queue has a single
+ * consumer, use one queue per writer thread. */
+typedef uint64_t write_ticket_t;
+
+struct write_cq;
+
+struct write_completion {
+	write_ticket_t ticket;
+	int32_t ret;		// ret of the server response, -1 if unreachable
+	void *arg;		// as passed to rpc_write_submit()
+};
+
+struct write_cq *write_cq_create(void);
+
+void write_cq_destroy(struct write_cq *cq);
+
+/* Checksum the buffers of later rpc_write_submit() calls, the server fails
+ * writes that do not match with ret -1. WRITE_CHECKSUM_NONE by default. */
+void write_set_checksum(uint32_t type);
+
+/* buffer must stay untouched until the ticket completes */
+write_ticket_t rpc_write_submit(struct write_cq *cq, int32_t size,
+	void *buffer, char *host, void *arg);
+
+/* Scatter-gather: the iovcnt segments of iov go out as one write whose
+ * bulk handle has a segment for each, nothing is packed on the client and
+ * the server pulls them in a single transfer. With stride 0 they are
+ * stored back to back. Otherwise segment k lands stride bytes after
+ * segment k - 1, which needs segments of equal length, at most stride.
+ * Writes that break this, or exceed INT32_MAX bytes in total, complete
+ * with -1 without being sent. The segments must stay untouched until the
+ * ticket completes. */
+write_ticket_t rpc_writev(struct write_cq *cq, const struct iovec *iov,
+	int iovcnt, hg_size_t stride, char *host, void *arg);
+
+/* The general form: the bytes of iov, taken in order, are stored as layout
+ * says. A layout that does not match the size of iov completes with -1
+ * without being sent, one the server rejects (e.g. placed past INT64_MAX)
+ * with -1 from the server. */
+write_ticket_t rpc_write_layout(struct write_cq *cq, const struct iovec *iov,
+	int iovcnt, const write_layout_t *layout, char *host, void *arg);
+
+/* Striping: a large write is cut into stripe_size pieces, piece k goes to
+ * hosts[k % nhosts] as a write RPC of its own. All pieces are forwarded at
+ * once and every server pulls its piece straight from one bulk handle over
+ * the whole buffer. The write completes on cq once every piece is acked,
+ * with the ret of the first piece that failed, 0 otherwise. */
+struct write_stripe_layout;
+
+struct write_stripe_layout *write_stripe_layout_create(
+	const char *const *hosts, unsigned int nhosts, hg_size_t stripe_size);
+
+void write_stripe_layout_destroy(struct write_stripe_layout *layout);
+
+/* buffer must stay untouched until the ticket completes */
+write_ticket_t rpc_write_striped(struct write_cq *cq,
+	const struct write_stripe_layout *layout, hg_size_t size, void *buffer,
+	void *arg);
+
+/* Streams: an ordered sequence of records to one host, applied in order
+ * to a log of its own on the server (<target>.stream-<id> if the server
+ * has a target file). Appends are not answered one by one, every
+ * (window / 2)-th record asks for a cumulative ack instead, which
+ * completes all records up to it on cq at once. A stream belongs to the
+ * thread consuming its queue. */
+struct write_stream;
+
+/* Nothing is sent until the first append */
+struct write_stream *write_stream_open(struct write_cq *cq, const char *host,
+	uint32_t window);
+
+/* Returns 0 without sending anything while window records are waiting
+ * for their ack, collect completions from cq first. buffer must stay
+ * untouched until the ticket completes. */
+write_ticket_t write_stream_append(struct write_stream *s, int32_t size,
+	void *buffer, void *arg);
+
+/* Completes once every record appended so far is applied */
+write_ticket_t write_stream_flush(struct write_stream *s, void *arg);
+
+/* Flush, then the server closes the log. s is freed once every ticket of
+ * the stream completed and must not be used after this call. */
+write_ticket_t write_stream_close(struct write_stream *s, void *arg);
+
+/* Batching: small writes to one host are gathered and sent as a single
+ * RPC with one segmented bulk handle. A batch goes out once it holds
+ * max_count records or max_bytes, or when its oldest record is flush_us
+ * old at the next rpc_write_batched() or write_batch_tick(). Records
+ * complete individually on the batcher's queue. A batcher belongs to the
+ * thread consuming that queue. */
+struct write_batcher;
+
+struct write_batcher *write_batcher_create(struct write_cq *cq,
+	const char *host, hg_size_t max_bytes, uint32_t max_count,
+	long flush_us);
+
+/* Flushes whatever is pending */
+void write_batcher_destroy(struct write_batcher *b);
+
+/* buffer must stay untouched until the ticket completes */
+write_ticket_t rpc_write_batched(struct write_batcher *b, int32_t size,
+	void *buffer, void *arg);
+
+/* Send the pending batch now, e.g. before blocking on the queue */
+void write_batch_flush(struct write_batcher *b);
+
+/* Flush if the time threshold passed, returns 1 if it did */
+int write_batch_tick(struct write_batcher *b);
+
+/* Collect up to max completions without blocking, returns how many */
+int write_cq_poll(struct write_cq *cq, struct write_completion *comp,
+	int max);
+
+/* Block up to timeout_ms (-1 for ever) for at least one completion */
+int write_cq_wait(struct write_cq *cq, struct write_completion *comp,
+	int max, int timeout_ms);
+
+/* Counters of the server-side registered buffer pool */
+void write_pool_stats(struct bulk_pool_stats *stats);
 
-uint32_t check_write(const uint32_t id);
+/* Counters of the client-side handle free-lists */
+void write_handle_stats(struct handle_pool_stats *stats);
 
 #endif
 
@@ -0,0 +1,239 @@
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "addr_cache.h"
+
+struct addr_waiter {
+	addr_cache_cb_t cb;
+	void *arg;
+	struct addr_waiter *next;
+};
+
+struct addr_entry {
+	char *host;
+	hg_addr_t addr;			// HG_ADDR_NULL while pending
+	struct addr_waiter *waiters;	// queued while pending, FIFO
+	struct addr_waiter *waiters_tail;
+	unsigned int refs;		// lent out, plus one while cached
+	struct addr_cache *cache;
+	struct addr_entry *next;
+};
+
+struct addr_cache {
+	hg_class_t *hg_class;
+	hg_context_t *context;
+	struct addr_entry *entries;
+	struct addr_entry *stale;	// invalidated, still lent out
+	addr_cache_release_cb_t release_cb;
+	void *release_arg;
+	pthread_mutex_t lock;
+};
+
+static hg_return_t addr_cache_lookup_cb(const struct hg_cb_info *info);
+
+struct addr_cache *addr_cache_create(hg_class_t *hg_class,
+		hg_context_t *context) {
+	struct addr_cache *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	cache->hg_class = hg_class;
+	cache->context = context;
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+void addr_cache_destroy(struct addr_cache *cache) {
+	struct addr_entry *entry;
+
+	if (!cache)
+		return;
+	while ((entry = cache->entries)) {
+		cache->entries = entry->next;
+		/* pending lookups still reference their entry */
+		assert(entry->addr != HG_ADDR_NULL && entry->refs == 1);
+		if (cache->release_cb)
+			cache->release_cb(entry->addr, cache->release_arg);
+		HG_Addr_free(cache->hg_class, entry->addr);
+		free(entry->host);
+		free(entry);
+	}
+	/* every lent address must have been given back */
+	assert(!cache->stale);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+static void unlink_entry(struct addr_entry **list, struct addr_entry *entry) {
+	struct addr_entry **p;
+
+	for (p = list; *p; p = &(*p)->next) {
+		if (*p == entry) {
+			*p = entry->next;
+			return;
+		}
+	}
+}
+
+void addr_cache_lookup(struct addr_cache *cache, const char *host,
+		addr_cache_cb_t cb, void *arg) {
+	struct addr_entry *entry;
+	struct addr_waiter *waiter;
+	hg_addr_t addr = HG_ADDR_NULL;
+	hg_return_t ret;
+
+	pthread_mutex_lock(&cache->lock);
+	for (entry = cache->entries; entry; entry = entry->next)
+		if (strcmp(entry->host, host) == 0)
+			break;
+
+	if (entry && entry->addr != HG_ADDR_NULL) {
+		/* hit */
+		addr = entry->addr;
+		entry->refs++;
+		pthread_mutex_unlock(&cache->lock);
+		cb(addr, HG_SUCCESS, arg);
+		return;
+	}
+
+	waiter = malloc(sizeof(*waiter));
+	assert(waiter);
+	waiter->cb = cb;
+	waiter->arg = arg;
+	waiter->next = NULL;
+	if (entry) {
+		/* lookup already in flight */
+		entry->waiters_tail->next = waiter;
+		entry->waiters_tail = waiter;
+		pthread_mutex_unlock(&cache->lock);
+		return;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	assert(entry);
+	entry->host = strdup(host);
+	entry->addr = HG_ADDR_NULL;
+	entry->cache = cache;
+	entry->waiters = waiter;
+	entry->waiters_tail = waiter;
+	entry->next = cache->entries;
+	cache->entries = entry;
+	pthread_mutex_unlock(&cache->lock);
+
+	ret = HG_Addr_lookup(cache->context, addr_cache_lookup_cb, entry, host,
+		HG_OP_ID_IGNORE);
+	if (ret != HG_SUCCESS) {
+		struct hg_cb_info info;
+
+		/* fail the waiters the same way a failed lookup would */
+		memset(&info, 0, sizeof(info));
+		info.arg = entry;
+		info.ret = ret;
+		addr_cache_lookup_cb(&info);
+	}
+}
+
+static hg_return_t addr_cache_lookup_cb(const struct hg_cb_info *info) {
+	struct addr_entry *entry = info->arg;
+	struct addr_cache *cache = entry->cache;
+	struct addr_waiter *waiters, *waiter, *next;
+	hg_addr_t addr = info->ret == HG_SUCCESS ? info->info.lookup.addr :
+		HG_ADDR_NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	waiters = entry->waiters;
+	entry->waiters = NULL;
+	entry->waiters_tail = NULL;
+	if (addr != HG_ADDR_NULL) {
+		entry->addr = addr;
+		/* one for the cache, one lent to each waiter */
+		entry->refs = 1;
+		for (waiter = waiters; waiter; waiter = waiter->next)
+			entry->refs++;
+	} else
+		unlink_entry(&cache->entries, entry);
+	pthread_mutex_unlock(&cache->lock);
+
+	for (; waiters; waiters = next) {
+		next = waiters->next;
+		waiters->cb(addr, info->ret, waiters->arg);
+		free(waiters);
+	}
+
+	if (addr == HG_ADDR_NULL) {
+		free(entry->host);
+		free(entry);
+	}
+	return HG_SUCCESS;
+}
+
+/* Drop a reference taken on entry, called with the lock held. Returns the
+ * entry if that was the last one, it is then unlinked and must be freed. */
+static struct addr_entry *entry_put(struct addr_cache *cache,
+		struct addr_entry *entry) {
+	if (--entry->refs)
+		return NULL;
+	/* the cache holds one as long as the entry is not stale */
+	unlink_entry(&cache->stale, entry);
+	return entry;
+}
+
+static void entry_free(struct addr_cache *cache, struct addr_entry *entry) {
+	/* handles created on addr keep their own reference */
+	if (cache->release_cb)
+		cache->release_cb(entry->addr, cache->release_arg);
+	HG_Addr_free(cache->hg_class, entry->addr);
+	free(entry->host);
+	free(entry);
+}
+
+static struct addr_entry *find_addr(struct addr_entry *list, hg_addr_t addr) {
+	for (; list; list = list->next)
+		if (list->addr == addr)
+			return list;
+	return NULL;
+}
+
+void addr_cache_release(struct addr_cache *cache, hg_addr_t addr) {
+	struct addr_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_addr(cache->entries, addr);
+	if (!entry)
+		entry = find_addr(cache->stale, addr);
+	assert(entry);
+	entry = entry_put(cache, entry);
+	pthread_mutex_unlock(&cache->lock);
+
+	if (entry)
+		entry_free(cache, entry);
+}
+
+void addr_cache_invalidate(struct addr_cache *cache, hg_addr_t addr) {
+	struct addr_entry *entry;
+
+	pthread_mutex_lock(&cache->lock);
+	entry = find_addr(cache->entries, addr);
+	if (entry) {
+		/* borrowers may still use it, keep it until they give it back */
+		unlink_entry(&cache->entries, entry);
+		entry->next = cache->stale;
+		cache->stale = entry;
+		entry = entry_put(cache, entry);
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	if (entry)
+		entry_free(cache, entry);
+}
+
+void addr_cache_set_release_cb(struct addr_cache *cache,
+		addr_cache_release_cb_t cb, void *arg) {
+	cache->release_cb = cb;
+	cache->release_arg = arg;
+}
+
@@ -1,4 +1,7 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <assert.h>
 #include <unistd.h>
 #include <aio.h>
@@ -10,38 +13,294 @@
 #include <mercury_macros.h>
 
 #include "rpc_write.h"
+#include "progress_driver.h"
 
 #define SIZE 256
 #define NUM_WRITE 100
+#define WRITE_WINDOW 64
+
+/* flush a batch at 64 records, 64 KB or after 1 ms */
+#define BATCH_MAX_COUNT 64
+#define BATCH_MAX_BYTES (1 << 16)
+#define BATCH_FLUSH_US 1000
+
+/* poll up to 50 us before blocking 100 ms in HG_Progress, 0 always blocks */
+#define PROGRESS_SPIN_US 50
+#define PROGRESS_BLOCK_MS 100
+
+/* striped writes of 64 MB in 1 MB pieces */
+#define STRIPE_SIZE (1 << 20)
+#define STRIPED_SIZE (64 << 20)
+#define NUM_STRIPED 16
+
+/* the interior of a padded BULK_NX x BULK_NY array, one segment per row */
+#define BULK_NX 16
+#define BULK_NY 1024
+#define BULK_PAD 8
+
+/* a GLOBAL_N x GLOBAL_N array of doubles in the server file, written as
+ * TILE_N x TILE_N tiles, placed past anything the benchmarks append */
+#define GLOBAL_N 1024
+#define TILE_N 256
+#define GLOBAL_ORIGIN (1ULL << 32)
+
+/* shared memory against tcp to the local server, LOCAL_WINDOW writes of
+ * each size in flight */
+#define LOCAL_HOST "tcp://localhost:1234"
+#define LOCAL_NUM_SMALL 10000
+#define LOCAL_NUM_LARGE 256
+#define LOCAL_LARGE_SIZE (4 << 20)
+#define LOCAL_WINDOW 16
 
 na_class_t *network_class;
 hg_class_t *hg_class;
 hg_context_t *hg_context;
+
+/* NULL if na+sm is not available */
+na_class_t *sm_network_class;
+hg_class_t *sm_hg_class;
+hg_context_t *sm_hg_context;
 	
 hg_progress_shutdown_flag = 0;
 
-static void* hg_progress_fn(void * foo) {
-	hg_return_t ret;
-	unsigned int actual_count;
-	(void)foo;
+static struct progress_driver hg_progress_driver;
+static struct progress_driver sm_progress_driver;
+
+static void* hg_progress_fn(void * arg) {
+	struct progress_driver *driver = arg;
 	
 	while(!hg_progress_shutdown_flag) {
-		do {
-			ret = HG_Trigger(hg_context, 0, 1, &actual_count);
-		}while ((ret) == HG_SUCCESS && actual_count && !hg_progress_shutdown_flag);
-		
-		if (!hg_progress_shutdown_flag) {
-			HG_Progress(hg_context, 100);
-		}
+		progress_driver_step(driver);
 	}
 	
 	return NULL;
 }
 
-int main(void) {
+/* NUM_WRITE records on one stream, WRITE_WINDOW of them unacked at most */
+static void stream_bench(struct write_cq *cq, void *buffer, int32_t size) {
+	struct write_stream *stream;
+	struct write_completion comp[WRITE_WINDOW];
+	struct timespec start, end;
+	int pending = 0;
+	int sent = 0;
+	int n, i;
+	
+	stream = write_stream_open(cq, "tcp://localhost:1234", WRITE_WINDOW);
+	assert(stream);
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (sent < NUM_WRITE) {
+		if (write_stream_append(stream, size, buffer, NULL)) {
+			sent++;
+			pending++;
+			continue;
+		}
+		/* window full */
+		n = write_cq_wait(cq, comp, WRITE_WINDOW, -1);
+		for (i = 0; i < n; ++i)
+			assert(comp[i].ret == 0);
+		pending -= n;
+	}
+	write_stream_close(stream, NULL);
+	pending++;
+	while (pending > 0) {
+		n = write_cq_wait(cq, comp, WRITE_WINDOW, -1);
+		for (i = 0; i < n; ++i)
+			assert(comp[i].ret == 0);
+		pending -= n;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("stream: %d records in %.3f ms\n", NUM_WRITE,
+		(end.tv_sec - start.tv_sec) * 1e3 +
+		(end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+/* the rows go out without packing, once stored back to back and once
+ * keeping their in-memory layout on the server */
+static void writev_demo(struct write_cq *cq) {
+	static int buf[BULK_NX][BULK_NY + BULK_PAD];
+	struct iovec iov[BULK_NX];
+	struct write_completion comp;
+	int i, j;
+	
+	for (i = 0; i < BULK_NX; ++i) {
+		for (j = 0; j < BULK_NY; ++j)
+			buf[i][j] = i * BULK_NY + j;
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = BULK_NY * sizeof(int);
+	}
+	rpc_writev(cq, iov, BULK_NX, 0, "tcp://localhost:1234", NULL);
+	rpc_writev(cq, iov, BULK_NX, sizeof(buf[0]), "tcp://localhost:1234",
+		NULL);
+	for (i = 0; i < 2; ++i) {
+		while (write_cq_wait(cq, &comp, 1, -1) == 0)
+			;
+		assert(comp.ret == 0);
+	}
+	printf("writev: %d rows packed and strided\n", BULK_NX);
+}
+
+/* every tile is one write the server scatters straight into its rows of
+ * the global array */
+static void tile_demo(struct write_cq *cq) {
+	write_layout_t layout;
+	struct write_completion comp;
+	struct iovec iov;
+	double *tile;
+	int tiles = (GLOBAL_N / TILE_N) * (GLOBAL_N / TILE_N);
+	int i, j;
+	
+	tile = malloc(TILE_N * TILE_N * sizeof(*tile));
+	assert(tile);
+	iov.iov_base = tile;
+	iov.iov_len = TILE_N * TILE_N * sizeof(*tile);
+	
+	memset(&layout, 0, sizeof(layout));
+	layout.ndims = 2;
+	layout.flags = WRITE_LAYOUT_PLACED;
+	layout.origin = GLOBAL_ORIGIN;
+	layout.elem_size = sizeof(*tile);
+	layout.count[0] = TILE_N;
+	layout.count[1] = TILE_N;
+	layout.stride[0] = GLOBAL_N * sizeof(*tile);
+	layout.stride[1] = sizeof(*tile);
+	for (i = 0; i < tiles; ++i) {
+		layout.offset[0] = (i / (GLOBAL_N / TILE_N)) * TILE_N;
+		layout.offset[1] = (i % (GLOBAL_N / TILE_N)) * TILE_N;
+		for (j = 0; j < TILE_N * TILE_N; ++j)
+			tile[j] = (layout.offset[0] + j / TILE_N) * GLOBAL_N +
+				layout.offset[1] + j % TILE_N;
+		rpc_write_layout(cq, &iov, 1, &layout, "tcp://localhost:1234",
+			NULL);
+		/* the tile buffer is reused */
+		while (write_cq_wait(cq, &comp, 1, -1) == 0)
+			;
+		assert(comp.ret == 0);
+	}
+	printf("tiles: %d x %dx%d into a %dx%d array\n", tiles, TILE_N, TILE_N,
+		GLOBAL_N, GLOBAL_N);
+	free(tile);
+}
+
+/* one striped write at a time, reports the aggregate bandwidth */
+static void striped_bench(struct write_cq *cq, const char *const *hosts,
+		int nhosts) {
+	struct write_stripe_layout *layout;
+	struct write_completion comp;
+	struct timespec start, end;
+	double secs;
+	void *buffer;
+	int i;
+	
+	layout = write_stripe_layout_create(hosts, nhosts, STRIPE_SIZE);
+	assert(layout);
+	buffer = malloc(STRIPED_SIZE);
+	assert(buffer);
+	memset(buffer, 0xab, STRIPED_SIZE);
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NUM_STRIPED; ++i) {
+		rpc_write_striped(cq, layout, STRIPED_SIZE, buffer, NULL);
+		while (write_cq_wait(cq, &comp, 1, -1) == 0)
+			;
+		assert(comp.ret == 0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("striped: %d x %d MB over %d servers, %.1f MB/s\n", NUM_STRIPED,
+		STRIPED_SIZE >> 20, nhosts,
+		(double)NUM_STRIPED * (STRIPED_SIZE >> 20) / secs);
+	
+	free(buffer);
+	write_stripe_layout_destroy(layout);
+}
+
+/* count writes of size to LOCAL_HOST, returns the elapsed seconds */
+static double local_run(struct write_cq *cq, void *buffer, int32_t size,
+		int count) {
+	struct write_completion comp[LOCAL_WINDOW];
+	struct timespec start, end;
+	int inflight = 0;
+	int sent = 0;
+	int n, i;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (sent < count || inflight > 0) {
+		if (sent < count && inflight < LOCAL_WINDOW) {
+			rpc_write_submit(cq, size, buffer, LOCAL_HOST, NULL);
+			sent++;
+			inflight++;
+			continue;
+		}
+		n = write_cq_wait(cq, comp, LOCAL_WINDOW, -1);
+		for (i = 0; i < n; ++i)
+			assert(comp[i].ret == 0);
+		inflight -= n;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* the same writes to the local server over shared memory, then tcp */
+static void local_bench(struct write_cq *cq) {
+	static const char *names[] = { "tcp", "sm" };
+	void *buffer;
+	double secs;
+	int local;
+	
+	buffer = malloc(LOCAL_LARGE_SIZE);
+	assert(buffer);
+	memset(buffer, 0xab, LOCAL_LARGE_SIZE);
+	
+	for (local = 1; local >= 0; --local) {
+		write_set_local(local);
+		if (write_host_is_local(LOCAL_HOST) != local) {
+			printf("local %s: unavailable\n", names[local]);
+			continue;
+		}
+		secs = local_run(cq, buffer, SIZE, LOCAL_NUM_SMALL);
+		printf("local %s: %d x %d B, %.1f us per write\n", names[local],
+			LOCAL_NUM_SMALL, SIZE, secs * 1e6 / LOCAL_NUM_SMALL);
+		secs = local_run(cq, buffer, LOCAL_LARGE_SIZE, LOCAL_NUM_LARGE);
+		printf("local %s: %d x %d MB, %.1f MB/s\n", names[local],
+			LOCAL_NUM_LARGE, LOCAL_LARGE_SIZE >> 20,
+			(double)LOCAL_NUM_LARGE * (LOCAL_LARGE_SIZE >> 20) / secs);
+	}
+	write_set_local(1);
+	free(buffer);
+}
+
+/* usage: client [-t | -c] [-I contexts] [host...], with hosts also runs
+ * striped writes over them. -t keeps local servers on tcp, -c only compares
+ * shared memory and tcp to the local server. -I spreads the RPCs over that
+ * many contexts of each server, as many as it was started with. */
+int main(int argc, char *argv[]) {
 	int ret;
 	int i;
+	int tcp_only = 0;
+	int compare = 0;
+	int contexts = 1;
 	pthread_t hg_progress_tid;
+	pthread_t sm_progress_tid;
+	
+	if (argc > 1 && strcmp(argv[1], "-t") == 0) {
+		tcp_only = 1;
+		argc--;
+		argv++;
+	} else if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+		compare = 1;
+		argc--;
+		argv++;
+	}
+	if (argc > 2 && strcmp(argv[1], "-I") == 0) {
+		contexts = atoi(argv[2]);
+		argc -= 2;
+		argv += 2;
+	}
+	if (contexts < 1 || contexts > 256) {
+		fprintf(stderr, "contexts must be between 1 and 256\n");
+		return 1;
+	}
 	
 	network_class = NA_Initialize("tcp", NA_FALSE);
 	assert(network_class);
@@ -52,36 +311,99 @@ int main(void) {
 	hg_context = HG_Context_create(hg_class);
 	assert(hg_context);
 	
-	ret = pthread_create(&hg_progress_tid, NULL, hg_progress_fn, NULL);
+	progress_driver_init(&hg_progress_driver, hg_context, PROGRESS_SPIN_US,
+		PROGRESS_BLOCK_MS);
+	ret = pthread_create(&hg_progress_tid, NULL, hg_progress_fn,
+		&hg_progress_driver);
 	assert(ret == 0);
 	
 	write_register(hg_class, hg_context);
+	write_set_target_contexts(contexts);
+	
+	/* servers on this node are reached over shared memory when they
+	 * published an na+sm address */
+	sm_network_class = tcp_only ? NULL : NA_Initialize("na+sm", NA_FALSE);
+	if (sm_network_class) {
+		sm_hg_class = HG_Init_na(sm_network_class);
+		assert(sm_hg_class);
+		sm_hg_context = HG_Context_create(sm_hg_class);
+		assert(sm_hg_context);
+		progress_driver_init(&sm_progress_driver, sm_hg_context,
+			PROGRESS_SPIN_US, PROGRESS_BLOCK_MS);
+		ret = pthread_create(&sm_progress_tid, NULL, hg_progress_fn,
+			&sm_progress_driver);
+		assert(ret == 0);
+		write_register_local(sm_hg_class, sm_hg_context);
+	}
+	printf("%s: %s\n", LOCAL_HOST, write_host_is_local(LOCAL_HOST) ?
+		"shared memory" : "tcp");
 	
 	uint32_t size = SIZE;
 	void * buffer = malloc(size);
 	//sprintf(buffer, "Hello world!");
 	assert(buffer);
 	
+	struct write_cq *cq = write_cq_create();
+	assert(cq);
+	if (compare) {
+		local_bench(cq);
+		goto done;
+	}
+	struct write_batcher *batcher = write_batcher_create(cq,
+		"tcp://localhost:1234", BATCH_MAX_BYTES, BATCH_MAX_COUNT,
+		BATCH_FLUSH_US);
+	assert(batcher);
+	struct write_completion comp[WRITE_WINDOW];
+	int inflight = 0;
+	int n;
+	
 	//printf("send request to server\n");
 	for (i = 0; i < NUM_WRITE; ++i) {
-	
-		uint32_t id = rpc_write(size, buffer, "tcp://localhost:1234");	
 		
-		//printf("waiting for response from server\n");
-		
-		while (1) {
-			if (check_write(id)) {
-				break;
-			}
-			usleep(1);
+		/* keep at most WRITE_WINDOW writes in flight */
+		while (inflight == WRITE_WINDOW) {
+			write_batch_flush(batcher);
+			n = write_cq_wait(cq, comp, WRITE_WINDOW, -1);
+			inflight -= n;
 		}
-		//printf("received response\n");
+		rpc_write_batched(batcher, size, buffer, NULL);
+		inflight++;
 	}
+	
+	//printf("waiting for response from server\n");
+	write_batch_flush(batcher);
+	while (inflight > 0) {
+		n = write_cq_wait(cq, comp, WRITE_WINDOW, -1);
+		inflight -= n;
+	}
+	write_batcher_destroy(batcher);
+	stream_bench(cq, buffer, size);
+	writev_demo(cq);
+	tile_demo(cq);
+	if (argc > 1)
+		striped_bench(cq, (const char *const *)argv + 1, argc - 1);
+done:
+	write_cq_destroy(cq);
 	printf("write done\n");
 	
+	struct handle_pool_stats hstats;
+	uint64_t forwards;
+	write_handle_stats(&hstats);
+	forwards = hstats.created + hstats.reused;
+	printf("handles: %lu created, %lu reused (%.1f%%)\n",
+		(unsigned long)hstats.created, (unsigned long)hstats.reused,
+		forwards ? 100.0 * hstats.reused / forwards : 0.0);
+	
 	hg_progress_shutdown_flag = 1;
 	ret = pthread_join(hg_progress_tid, NULL);
 	assert(ret == 0);
+	progress_driver_print_stats(&hg_progress_driver, stdout, "progress");
+	if (sm_network_class) {
+		ret = pthread_join(sm_progress_tid, NULL);
+		assert(ret == 0);
+		progress_driver_print_stats(&sm_progress_driver, stdout,
+			"progress (sm)");
+	}
 	
 	return 0;
 }
@@ -0,0 +1,99 @@
+
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "completion_queue.h"
+
+int cq_init(struct completion_queue *cq) {
+	cq->stub.next = NULL;
+	cq->head = &cq->stub;
+	cq->tail = &cq->stub;
+	cq->waiting = 0;
+	cq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return cq->efd < 0 ? -1 : 0;
+}
+
+void cq_destroy(struct completion_queue *cq) {
+	if (cq->efd >= 0)
+		close(cq->efd);
+	cq->efd = -1;
+}
+
+static void cq_enqueue(struct completion_queue *cq, struct cq_node *node) {
+	struct cq_node *prev;
+
+	__atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&cq->head, node, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+void cq_push(struct completion_queue *cq, struct cq_node *node) {
+	cq_enqueue(cq, node);
+
+	/* pairs with the store of waiting in cq_wait() */
+	if (__atomic_load_n(&cq->waiting, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+		ssize_t ret = write(cq->efd, &one, sizeof(one));
+		(void)ret;
+	}
+}
+
+struct cq_node *cq_pop(struct completion_queue *cq) {
+	struct cq_node *tail = cq->tail;
+	struct cq_node *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &cq->stub) {
+		if (!next)
+			return NULL;
+		cq->tail = next;
+		tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		cq->tail = next;
+		return tail;
+	}
+	/* a producer swapped head but has not linked its node yet */
+	if (tail != __atomic_load_n(&cq->head, __ATOMIC_ACQUIRE))
+		return NULL;
+	cq_enqueue(cq, &cq->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		cq->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+struct cq_node *cq_wait(struct completion_queue *cq, int timeout_ms) {
+	struct cq_node *node;
+	struct pollfd pfd;
+	uint64_t count;
+	ssize_t ret;
+
+	while (!(node = cq_pop(cq))) {
+		__atomic_store_n(&cq->waiting, 1, __ATOMIC_SEQ_CST);
+		/* re-check after announcing ourselves so no push is missed */
+		node = cq_pop(cq);
+		if (!node) {
+			pfd.fd = cq->efd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, timeout_ms) == 0) {
+				__atomic_store_n(&cq->waiting, 0, __ATOMIC_RELAXED);
+				return cq_pop(cq);
+			}
+			ret = read(cq->efd, &count, sizeof(count));
+			assert(ret == sizeof(count) || errno == EAGAIN);
+			(void)ret;
+		}
+		__atomic_store_n(&cq->waiting, 0, __ATOMIC_RELAXED);
+		if (node)
+			break;
+	}
+	return node;
+}
+
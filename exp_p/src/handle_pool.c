@@ -0,0 +1,180 @@
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "handle_pool.h"
+
+struct handle_entry {
+	hg_handle_t handle;
+	struct handle_entry *next;
+};
+
+struct handle_target {
+	hg_addr_t addr;
+	struct handle_entry *free_list;
+	unsigned int num_free;
+	struct handle_target *next;
+};
+
+struct handle_pool {
+	hg_context_t *context;
+	hg_id_t id;
+	unsigned int max_cached;	// idle handles kept per target
+	struct handle_target *targets;
+	struct handle_pool_stats stats;
+	pthread_mutex_t lock;
+};
+
+struct handle_pool *handle_pool_create(hg_context_t *context, hg_id_t id,
+		unsigned int max_cached) {
+	struct handle_pool *pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->context = context;
+	pool->id = id;
+	pool->max_cached = max_cached;
+	pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+static void target_drain(struct handle_pool *pool,
+		struct handle_target *target) {
+	struct handle_entry *entry;
+
+	while ((entry = target->free_list)) {
+		target->free_list = entry->next;
+		HG_Destroy(entry->handle);
+		free(entry);
+		pool->stats.destroyed++;
+		pool->stats.cached--;
+	}
+	target->num_free = 0;
+}
+
+void handle_pool_destroy(struct handle_pool *pool) {
+	struct handle_target *target;
+
+	if (!pool)
+		return;
+	while ((target = pool->targets)) {
+		pool->targets = target->next;
+		target_drain(pool, target);
+		free(target);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+static struct handle_target *find_target(struct handle_pool *pool,
+		hg_addr_t addr) {
+	struct handle_target *target;
+
+	for (target = pool->targets; target; target = target->next)
+		if (target->addr == addr)
+			return target;
+	return NULL;
+}
+
+hg_return_t handle_pool_get(struct handle_pool *pool, hg_addr_t addr,
+		hg_handle_t *handle) {
+	struct handle_target *target;
+	struct handle_entry *entry = NULL;
+	hg_return_t ret;
+
+	pthread_mutex_lock(&pool->lock);
+	target = find_target(pool, addr);
+	if (target && target->free_list) {
+		entry = target->free_list;
+		target->free_list = entry->next;
+		target->num_free--;
+		pool->stats.cached--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (entry) {
+		*handle = entry->handle;
+		free(entry);
+		ret = HG_Reset(*handle, addr, pool->id);
+		if (ret == HG_SUCCESS) {
+			pthread_mutex_lock(&pool->lock);
+			pool->stats.reused++;
+			pthread_mutex_unlock(&pool->lock);
+			return ret;
+		}
+		/* fall back to a fresh handle */
+		HG_Destroy(*handle);
+		pthread_mutex_lock(&pool->lock);
+		pool->stats.destroyed++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	ret = HG_Create(pool->context, addr, pool->id, handle);
+	if (ret == HG_SUCCESS) {
+		pthread_mutex_lock(&pool->lock);
+		pool->stats.created++;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return ret;
+}
+
+void handle_pool_put(struct handle_pool *pool, hg_addr_t addr,
+		hg_handle_t handle) {
+	struct handle_target *target;
+	struct handle_entry *entry;
+
+	entry = malloc(sizeof(*entry));
+	pthread_mutex_lock(&pool->lock);
+	target = find_target(pool, addr);
+	if (!target && entry) {
+		target = calloc(1, sizeof(*target));
+		if (target) {
+			target->addr = addr;
+			target->next = pool->targets;
+			pool->targets = target;
+		}
+	}
+	if (target && entry && target->num_free < pool->max_cached) {
+		entry->handle = handle;
+		entry->next = target->free_list;
+		target->free_list = entry;
+		target->num_free++;
+		pool->stats.cached++;
+		entry = NULL;
+		handle = HG_HANDLE_NULL;
+	} else {
+		pool->stats.destroyed++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	free(entry);
+	if (handle != HG_HANDLE_NULL)
+		HG_Destroy(handle);
+}
+
+void handle_pool_evict(struct handle_pool *pool, hg_addr_t addr) {
+	struct handle_target **p, *target = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	for (p = &pool->targets; *p; p = &(*p)->next) {
+		if ((*p)->addr == addr) {
+			target = *p;
+			*p = target->next;
+			break;
+		}
+	}
+	if (target)
+		target_drain(pool, target);
+	pthread_mutex_unlock(&pool->lock);
+	free(target);
+}
+
+void handle_pool_get_stats(struct handle_pool *pool,
+		struct handle_pool_stats *stats) {
+	pthread_mutex_lock(&pool->lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+}
+
@@ -0,0 +1,121 @@
+
+#include <sched.h>
+#include <time.h>
+
+#include "progress_driver.h"
+
+/* weight of a new gap in the moving average is 1 / 2^GAP_SHIFT */
+#define GAP_SHIFT 3
+
+/* a gap after an idle period counts as at most this many spin windows */
+#define GAP_CAP 4
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void progress_driver_init(struct progress_driver *driver,
+		hg_context_t *context, unsigned int spin_us, unsigned int block_ms) {
+	driver->context = context;
+	driver->spin_ns = (uint64_t) spin_us * 1000;
+	driver->block_ms = block_ms;
+	driver->busy = NULL;
+	driver->last_event_ns = 0;
+	/* start with a full window until the first gaps are known */
+	driver->gap_ns = driver->spin_ns / 2;
+	driver->stats = (struct progress_driver_stats) { 0 };
+}
+
+void progress_driver_set_busy(struct progress_driver *driver,
+		int (*busy)(void)) {
+	driver->busy = busy;
+}
+
+static uint64_t spin_budget(const struct progress_driver *driver) {
+	if (!driver->spin_ns || driver->gap_ns > driver->spin_ns)
+		return 0;
+	if (2 * driver->gap_ns < driver->spin_ns)
+		return 2 * driver->gap_ns;
+	return driver->spin_ns;
+}
+
+static void note_event(struct progress_driver *driver, uint64_t now,
+		uint64_t *hits) {
+	uint64_t gap;
+	
+	(*hits)++;
+	driver->stats.events++;
+	if (driver->last_event_ns) {
+		gap = now - driver->last_event_ns;
+		if (gap > GAP_CAP * driver->spin_ns)
+			gap = GAP_CAP * driver->spin_ns;
+		driver->gap_ns += (gap >> GAP_SHIFT) - (driver->gap_ns >> GAP_SHIFT);
+	}
+	driver->last_event_ns = now;
+}
+
+hg_return_t progress_driver_progress(struct progress_driver *driver,
+		unsigned int timeout_ms) {
+	uint64_t limit = (uint64_t) timeout_ms * 1000000;
+	uint64_t budget = spin_budget(driver);
+	uint64_t start, elapsed = 0;
+	unsigned int block_ms = 0;
+	hg_return_t ret;
+	
+	if (budget > limit / 2)
+		budget = limit / 2;
+	
+	start = now_ns();
+	while (elapsed < 2 * budget) {
+		ret = HG_Progress(driver->context, 0);
+		if (ret != HG_TIMEOUT) {
+			if (ret == HG_SUCCESS)
+				note_event(driver, start + elapsed, elapsed < budget ?
+					&driver->stats.spin_hits : &driver->stats.yield_hits);
+			return ret;
+		}
+		if (elapsed >= budget)
+			sched_yield();
+		elapsed = now_ns() - start;
+	}
+	
+	if (elapsed < limit) {
+		/* round up, an early return only costs another round */
+		block_ms = (unsigned int) ((limit - elapsed + 999999) / 1000000);
+		driver->stats.blocks++;
+	}
+	ret = HG_Progress(driver->context, block_ms);
+	if (ret == HG_SUCCESS)
+		note_event(driver, now_ns(), block_ms ? &driver->stats.block_hits :
+			&driver->stats.spin_hits);
+	return ret;
+}
+
+hg_return_t progress_driver_step(struct progress_driver *driver) {
+	unsigned int count;
+	hg_return_t ret;
+	
+	do {
+		count = 0;
+		ret = HG_Trigger(driver->context, 0, 1, &count);
+		driver->stats.triggered += count;
+	} while (ret == HG_SUCCESS && count);
+	
+	return progress_driver_progress(driver,
+		driver->busy && driver->busy() ? 0 : driver->block_ms);
+}
+
+void progress_driver_print_stats(const struct progress_driver *driver,
+		FILE *out, const char *name) {
+	const struct progress_driver_stats *stats = &driver->stats;
+	
+	fprintf(out, "# %s: %lu events, %lu caught spinning, %lu yielding, "
+		"%lu after blocking (%lu blocks), %lu callbacks\n", name,
+		(unsigned long) stats->events, (unsigned long) stats->spin_hits,
+		(unsigned long) stats->yield_hits, (unsigned long) stats->block_hits,
+		(unsigned long) stats->blocks, (unsigned long) stats->triggered);
+}
+
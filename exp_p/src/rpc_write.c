@@ -1,50 +1,624 @@
 
+#define _GNU_SOURCE
 #include <assert.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <aio.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
 
 #include "rpc_write.h"
 
+/* Server-side bulk targets come from a pool of pre-registered regions */
+#define WRITE_POOL_MIN_SIZE (1 << 12)
+#define WRITE_POOL_MAX_SIZE (1 << 26)
+#define WRITE_POOL_MAX_CACHED 64
+#define WRITE_POOL_RESERVE 16
+
+/* Idle client handles kept per server */
+#define WRITE_HANDLES_MAX_CACHED 64
+
+/* Upper bound on records per batch, each is one bulk segment */
+#define WRITE_BATCH_LIMIT 1024
+
+/* Writes from this size on are pulled straight into the target file */
+#define WRITE_MAP_MIN (1 << 16)
+
+/* Upper bound on the runs of a laid out write, each is a bulk segment */
+#define WRITE_LAYOUT_MAX_PIECES (1 << 20)
+
+/* tcp, plus na+sm for servers on the same node */
+#define WRITE_MAX_TRANSPORTS 2
+
+/* Servers publish their na+sm address there, keyed by tcp port */
+#define WRITE_LOCAL_DIR "/tmp"
+#define WRITE_LOCAL_ADDR_MAX 256
+
+/* RPCs the client keeps idle handles of */
+enum {
+	WRITE_RPC_WRITE,
+	WRITE_RPC_BATCH,
+	WRITE_RPC_STREAM,
+	WRITE_RPC_STREAM_ACK,
+	WRITE_RPC_STREAM_SYNC,
+	WRITE_RPC_COUNT
+};
+
+/* Everything tied to one Mercury class: addresses and handles on the
+ * client side, registered buffers on the server side */
+struct write_transport {
+	hg_class_t *hg_class;
+	hg_context_t *context;
+	struct addr_cache *addr_cache;
+	struct handle_pool *handles[WRITE_RPC_COUNT];
+	struct bulk_pool *pool; // server side, see write_pool_get()
+};
+
 struct write_state {
 	hg_size_t size;
 	void* buffer; // size of buffer
+	/* client side, rpc_writev() segments, NULL for a single buffer */
+	void **segments;
+	hg_size_t *segment_sizes;
+	uint32_t count;
+	/* server side, where the runs go in the target file, see write_plan() */
+	uint64_t *pieces;
+	uint64_t piece; // pieces of a single run
+	uint32_t npieces;
+	uint64_t lead; // from the origin to the first run
+	hg_size_t span; // from the first run to the end of the last one
 	hg_bulk_t bulk_handle;
+	struct bulk_pool *pool; // server side
+	struct bulk_pool_buf *pool_buf; // server side, NULL if mapped
+	void *map; // server side, mapping of the target file holding buffer
+	size_t map_len;
+	uint64_t file_offset; // server side, in the target file
 	hg_handle_t handle;
+	struct write_transport *t; // client side
+	char *host; // client side, tcp name while t is write_local
+	hg_addr_t addr; // client side, owned by the address cache
 	write_in_t in;
-	int value;
+	/* client side completion */
+	struct write_cq *cq;
+	write_ticket_t ticket;
+	void *arg;
+	int32_t ret;
+	struct cq_node node;
+};
+
+struct write_cq {
+	struct completion_queue queue;
+	write_ticket_t next_ticket;
+};
+
+/* A batch on the wire is a single bulk region: the int32_t size of every
+ * record, followed by the records themselves. The client exposes it as
+ * count + 1 segments so nothing is copied. */
+struct write_batch_state {
+	hg_size_t size;
+	void *buffer; // server side, pulled batch
+	hg_bulk_t bulk_handle;
+	struct bulk_pool *pool; // server side
+	struct bulk_pool_buf *pool_buf; // server side only
+	hg_handle_t handle;
+	struct write_transport *t; // client side
+	char *host; // client side, tcp name while t is write_local
+	hg_uint8_t target; // client side, server context, as its batcher's
+	hg_addr_t addr; // client side, owned by the address cache
+	write_batch_in_t in;
+	/* client side, one segment per record after the size header */
+	uint32_t count;
+	int32_t *sizes;
+	void **segments;
+	hg_size_t *segment_sizes;
+	struct write_state **records;
+};
+
+struct write_batcher {
+	struct write_cq *cq;
+	struct write_transport *t;
+	char *host; // as looked up on t
+	char *tcp_host; // as given, NULL unless t is write_local
+	hg_uint8_t target; // server context all its batches go to
+	hg_size_t max_bytes;
+	uint32_t max_count;
+	long flush_us;
+	struct write_batch_state *batch; // being filled, NULL if none
+	hg_size_t bytes;
+	struct timespec first; // when the oldest pending record was added
+};
+
+struct write_stripe_layout {
+	char **hosts; // as looked up on transports[i]
+	struct write_transport **transports;
+	unsigned int nhosts;
+	hg_size_t stripe_size;
+};
+
+/* One piece of a striped write, sent as a plain write RPC */
+struct write_stripe {
+	struct write_striped_state *parent;
+	struct write_transport *t;
+	hg_handle_t handle;
+	hg_addr_t addr; // owned by the address cache
+	write_in_t in;
+};
+
+struct write_striped_state {
+	/* whole buffer, shared by the pieces going through each transport */
+	hg_bulk_t bulk_handles[WRITE_MAX_TRANSPORTS];
+	uint32_t pending; // pieces not acked yet
+	int32_t ret; // of the first piece that failed
+	struct write_state *record; // completion, only cq fields are used
+	uint32_t count;
+	struct write_stripe stripes[];
 };
 
 static hg_return_t write_handler(hg_handle_t handle);
 static hg_return_t write_handler_bulk_cb(const struct hg_cb_info *info);
-static hg_return_t lookup_cb(const struct hg_cb_info *callback_info);
+static void lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg);
 static hg_return_t write_cb(const struct hg_cb_info *info);
+static hg_return_t write_batch_handler(hg_handle_t handle);
+static hg_return_t write_batch_handler_bulk_cb(const struct hg_cb_info *info);
+static void write_batch_respond(struct write_batch_state *state,
+	int32_t ret, uint32_t count);
+static void batch_lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg);
+static hg_return_t write_batch_cb(const struct hg_cb_info *info);
+static hg_return_t stream_append_handler(hg_handle_t handle);
+static hg_return_t stream_append_bulk_cb(const struct hg_cb_info *info);
+static hg_return_t stream_sync_handler(hg_handle_t handle);
+static void stripe_lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg);
+static hg_return_t stripe_write_cb(const struct hg_cb_info *info);
 
-static hg_class_t *hg_class = NULL;
 static hg_id_t hg_id;
-static hg_context_t *hg_context;
+static hg_id_t hg_batch_id;
+static hg_id_t hg_stream_id;
+static hg_id_t hg_stream_ack_id;
+static hg_id_t hg_stream_sync_id;
 
-#define READLINE_LIMIT 1024
-static uint32_t write_value = 0;
-static uint32_t write_comp [READLINE_LIMIT];
+/* the first one registered carries everything that is not local */
+static struct write_transport write_transports[WRITE_MAX_TRANSPORTS];
+static unsigned int write_ntransports = 0;
+static struct write_transport *write_local = NULL;
+static int write_local_enabled = 1;
 
-/* Register the RPC */
-hg_id_t write_register(hg_class_t *hg_c, hg_context_t *context) {
-	hg_class = hg_c;
-	hg_context = context;
-	hg_id = MERCURY_REGISTER(hg_class, "write", write_in_t,
+/* Server contexts RPCs over tcp are spread over, see write_target_pick() */
+static unsigned int write_target_contexts = 1;
+static unsigned int write_target_next = 0;
+
+/* Client side, what a host resolves to, see write_route(). Dropped when
+ * na+sm fails to reach it, see write_route_drop(). */
+struct write_route {
+	char *host;
+	char *local; // published na+sm address, NULL if not local
+	struct write_route *next;
+};
+
+static struct write_route *write_routes = NULL;
+static pthread_mutex_t write_route_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t write_checksum_type = WRITE_CHECKSUM_NONE;
+
+/* Server side target file, see write_set_target() */
+static int write_fd = -1;
+static char *write_target_path = NULL; // stream logs are named after it
+static int write_sync = WRITE_SYNC_NONE;
+static uint64_t write_end; // next free offset
+static uint64_t write_file_size; // under write_size_lock
+static pthread_mutex_t write_size_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The addr cache frees an address, idle handles to it go first as they are
+ * keyed by it */
+static void write_addr_released(hg_addr_t addr, void *arg) {
+	struct write_transport *t = arg;
+	int i;
+	
+	for (i = 0; i < WRITE_RPC_COUNT; ++i)
+		handle_pool_evict(t->handles[i], addr);
+}
+
+/* Register the RPCs on hg_c, ids are the same on every class */
+static struct write_transport *write_transport_add(hg_class_t *hg_c,
+		hg_context_t *context) {
+	struct write_transport *t;
+	hg_id_t ids[WRITE_RPC_COUNT];
+	int i;
+	
+	assert(write_ntransports < WRITE_MAX_TRANSPORTS);
+	t = &write_transports[write_ntransports++];
+	t->hg_class = hg_c;
+	t->context = context;
+	hg_id = MERCURY_REGISTER(hg_c, "write", write_in_t,
 		write_out_t, write_handler);
+	hg_batch_id = MERCURY_REGISTER(hg_c, "write_batch",
+		write_batch_in_t, write_batch_out_t, write_batch_handler);
+	/* appends are answered by the cumulative ack of a later record */
+	hg_stream_id = MERCURY_REGISTER(hg_c, "stream_append",
+		stream_append_in_t, void, stream_append_handler);
+	HG_Registered_disable_response(hg_c, hg_stream_id, HG_TRUE);
+	hg_stream_ack_id = MERCURY_REGISTER(hg_c, "stream_append_ack",
+		stream_append_in_t, stream_ack_t, stream_append_handler);
+	hg_stream_sync_id = MERCURY_REGISTER(hg_c, "stream_sync",
+		stream_sync_in_t, stream_ack_t, stream_sync_handler);
+	t->addr_cache = addr_cache_create(hg_c, context);
+	assert(t->addr_cache);
+	ids[WRITE_RPC_WRITE] = hg_id;
+	ids[WRITE_RPC_BATCH] = hg_batch_id;
+	ids[WRITE_RPC_STREAM] = hg_stream_id;
+	ids[WRITE_RPC_STREAM_ACK] = hg_stream_ack_id;
+	ids[WRITE_RPC_STREAM_SYNC] = hg_stream_sync_id;
+	for (i = 0; i < WRITE_RPC_COUNT; ++i) {
+		t->handles[i] = handle_pool_create(context, ids[i],
+			WRITE_HANDLES_MAX_CACHED);
+		assert(t->handles[i]);
+	}
+	addr_cache_set_release_cb(t->addr_cache, write_addr_released, t);
+	return t;
+}
+
+hg_id_t write_register(hg_class_t *hg_c, hg_context_t *context) {
+	write_transport_add(hg_c, context);
+	return hg_id;
+}
+
+hg_id_t write_register_local(hg_class_t *hg_c, hg_context_t *context) {
+	write_local = write_transport_add(hg_c, context);
 	return hg_id;
 }
 
 
+/* Server side, the pool of the class a request came in on, created lazily
+ * as only the server needs it */
+static struct bulk_pool *write_pool_get(hg_class_t *hg_c) {
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	struct write_transport *t = NULL;
+	struct bulk_pool *pool;
+	unsigned int i;
+	
+	for (i = 0; i < write_ntransports; ++i)
+		if (write_transports[i].hg_class == hg_c)
+			t = &write_transports[i];
+	assert(t);
+	
+	/* handlers of several contexts may get here at once */
+	pool = __atomic_load_n(&t->pool, __ATOMIC_ACQUIRE);
+	if (pool)
+		return pool;
+	pthread_mutex_lock(&lock);
+	if (!t->pool) {
+		pool = bulk_pool_create(hg_c, WRITE_POOL_MIN_SIZE,
+			WRITE_POOL_MAX_SIZE, WRITE_POOL_MAX_CACHED);
+		assert(pool);
+		bulk_pool_reserve(pool, WRITE_POOL_MIN_SIZE, WRITE_POOL_RESERVE);
+		__atomic_store_n(&t->pool, pool, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&lock);
+	return t->pool;
+}
+
+int write_set_target(const char *path, int sync) {
+	int fd;
+	
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	write_fd = fd;
+	write_target_path = strdup(path);
+	write_sync = sync;
+	write_end = 0;
+	write_file_size = 0;
+	return 0;
+}
+
+/* The file a server on this node publishes its na+sm address in, named
+ * after the tcp port of host. Returns -1 if host has no port. */
+static int write_local_path(const char *host, char *path, size_t len) {
+	const char *port = strrchr(host, ':');
+	const char *c;
+	
+	if (!port || port[1] == '\0' || port[1] == '/')
+		return -1;
+	for (c = port + 1; *c; ++c)
+		if (!isdigit((unsigned char)*c))
+			return -1;
+	snprintf(path, len, WRITE_LOCAL_DIR "/rpc_write-%s.sm", port + 1);
+	return 0;
+}
+
+int write_publish_local(const char *host) {
+	char path[4096], tmp[4096];
+	char addr[256];
+	hg_size_t len = sizeof(addr);
+	hg_addr_t self;
+	FILE *f;
+	int ret;
+	
+	if (!write_local || write_local_path(host, path, sizeof(path)) != 0)
+		return -1;
+	if (HG_Addr_self(write_local->hg_class, &self) != HG_SUCCESS)
+		return -1;
+	ret = HG_Addr_to_string(write_local->hg_class, addr, &len, self);
+	HG_Addr_free(write_local->hg_class, self);
+	if (ret != HG_SUCCESS)
+		return -1;
+	
+	/* clients never see a partial address */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	f = fopen(tmp, "w");
+	if (!f)
+		return -1;
+	ret = fprintf(f, "%s\n", addr) < 0;
+	ret |= fclose(f) != 0;
+	if (ret || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+void write_unpublish_local(const char *host) {
+	char path[4096];
+	
+	if (write_local_path(host, path, sizeof(path)) == 0)
+		unlink(path);
+}
+
+/* Room for size bytes at the end of the target file */
+static uint64_t write_reserve(hg_size_t size) {
+	return __atomic_fetch_add(&write_end, size, __ATOMIC_RELAXED);
+}
+
+/* Check layout against a write of size bytes. first is where the first
+ * element goes relative to the origin, span the bytes from there to the end
+ * of the last one, inner the number of outer dimensions, each index of
+ * which is a separate run in the file. */
+static int write_layout_check(const write_layout_t *layout, hg_size_t size,
+		uint64_t *first, uint64_t *span, uint32_t *inner) {
+	uint64_t extent = layout->elem_size;
+	uint64_t elems = 1;
+	uint64_t pos = 0;
+	uint64_t n;
+	uint32_t d;
+	
+	if (layout->ndims == 0) {
+		*first = 0;
+		*span = size;
+		*inner = 0;
+		return 0;
+	}
+	if (layout->ndims > WRITE_LAYOUT_MAX_DIMS || layout->elem_size == 0)
+		return -1;
+	
+	/* row-major, every dimension clears the extent of those inside it */
+	*inner = layout->ndims;
+	for (d = layout->ndims; d-- > 0; ) {
+		if (layout->count[d] == 0 || layout->stride[d] < extent)
+			return -1;
+		/* runs merge as long as dimensions are back to back */
+		if (*inner == d + 1 && layout->stride[d] == extent)
+			*inner = d;
+		if (__builtin_mul_overflow(layout->count[d] - 1, layout->stride[d],
+				&n) || __builtin_add_overflow(n, extent, &extent) ||
+				__builtin_mul_overflow(layout->offset[d],
+				layout->stride[d], &n) ||
+				__builtin_add_overflow(pos, n, &pos) ||
+				__builtin_mul_overflow(elems, layout->count[d], &elems))
+			return -1;
+	}
+	if (__builtin_mul_overflow(elems, layout->elem_size, &n) || n != size ||
+			__builtin_add_overflow(pos, extent, &n))
+		return -1;
+	*first = pos;
+	*span = extent;
+	return 0;
+}
+
+/* Server side, file offsets of the runs of a write relative to the first,
+ * each size / npieces bytes long */
+static int write_plan(struct write_state *state) {
+	const write_layout_t *layout = &state->in.layout;
+	uint64_t idx[WRITE_LAYOUT_MAX_DIMS] = { 0 };
+	uint64_t count = 1;
+	uint64_t first, span, pos;
+	uint32_t inner, d, i;
+	
+	state->pieces = &state->piece;
+	state->piece = 0;
+	state->npieces = 1;
+	if (state->in.size < 0 || write_layout_check(layout, state->size, &first,
+			&span, &inner) != 0)
+		return -1;
+	state->span = span;
+	state->lead = first;
+	for (d = 0; d < inner; ++d)
+		count *= layout->count[d];
+	if (count == 1)
+		return 0;
+	if (count > WRITE_LAYOUT_MAX_PIECES)
+		return -1;
+	
+	state->pieces = malloc(count * sizeof(*state->pieces));
+	assert(state->pieces);
+	state->npieces = count;
+	for (i = 0; i < count; ++i) {
+		pos = 0;
+		for (d = 0; d < inner; ++d)
+			pos += idx[d] * layout->stride[d];
+		state->pieces[i] = pos;
+		/* next index, last dimension fastest */
+		for (d = inner; d-- > 0 && ++idx[d] == layout->count[d]; )
+			idx[d] = 0;
+	}
+	return 0;
+}
+
+/* Bulk target over the mapping, one segment per run */
+static hg_return_t write_map_bulk(struct write_state *state,
+		hg_class_t *hg_c) {
+	hg_size_t run = state->size / state->npieces;
+	void **segments;
+	hg_size_t *sizes;
+	hg_return_t ret;
+	uint32_t i;
+	
+	if (state->npieces == 1)
+		return HG_Bulk_create(hg_c, 1, &state->buffer, &state->size,
+			HG_BULK_WRITE_ONLY, &state->bulk_handle);
+	
+	segments = malloc(state->npieces * sizeof(*segments));
+	sizes = malloc(state->npieces * sizeof(*sizes));
+	assert(segments && sizes);
+	for (i = 0; i < state->npieces; ++i) {
+		segments[i] = (char *)state->buffer + state->pieces[i];
+		sizes[i] = run;
+	}
+	ret = HG_Bulk_create(hg_c, state->npieces, segments, sizes,
+		HG_BULK_WRITE_ONLY, &state->bulk_handle);
+	free(segments);
+	free(sizes);
+	return ret;
+}
+
+/* Map [file_offset, file_offset + span) of the target file and expose it
+ * as the bulk target, the pull then lands in the page cache directly */
+static int write_map(struct write_state *state, hg_class_t *hg_c) {
+	uint64_t start = state->file_offset &
+		~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+	uint64_t end = state->file_offset + state->span;
+	struct stat st;
+	int ret = 0;
+	
+	/* the mapping must not reach past the end of the file, which pwrite()
+	 * and placed writes may have grown meanwhile, so it is only grown */
+	pthread_mutex_lock(&write_size_lock);
+	if (end > write_file_size) {
+		ret = fstat(write_fd, &st);
+		if (ret == 0 && (uint64_t)st.st_size < end)
+			ret = ftruncate(write_fd, end);
+		if (ret == 0)
+			write_file_size = (uint64_t)st.st_size > end ?
+				(uint64_t)st.st_size : (uint64_t)end;
+	}
+	pthread_mutex_unlock(&write_size_lock);
+	if (ret != 0)
+		return -1;
+	
+	state->map_len = end - start;
+	state->map = mmap(NULL, state->map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED, write_fd, start);
+	if (state->map == MAP_FAILED) {
+		state->map = NULL;
+		return -1;
+	}
+	state->buffer = (char *)state->map + (state->file_offset - start);
+	if (write_map_bulk(state, hg_c) != HG_SUCCESS) {
+		munmap(state->map, state->map_len);
+		state->map = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/* Apply the sync policy to [offset, offset + size) of the target file,
+ * map is the mapping holding it if the bytes came in through one */
+static int32_t write_flush(uint64_t offset, hg_size_t size, void *map,
+		size_t map_len) {
+	if (write_fd < 0)
+		return 0;
+	switch (write_sync) {
+	case WRITE_SYNC_ASYNC:
+		return sync_file_range(write_fd, offset, size,
+			SYNC_FILE_RANGE_WRITE) == 0 ? 0 : -1;
+	case WRITE_SYNC_DATA:
+		if (map)
+			return msync(map, map_len, MS_SYNC) == 0 ? 0 : -1;
+		return fdatasync(write_fd) == 0 ? 0 : -1;
+	}
+	return 0;
+}
+
+/* Store one record once it is in local memory, at offset of the target
+ * file if there is one */
+static int32_t write_consume(void *buffer, hg_size_t size, uint64_t offset) {
+	ssize_t n;
+	
+	//printf("Received data: %s\n", (char*)buffer);
+	if (write_fd < 0)
+		return 0;
+	while (size > 0) {
+		n = pwrite(write_fd, buffer, size, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buffer = (char *)buffer + n;
+		size -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+/* Checksum of the bytes received, wherever the runs landed */
+static uint32_t write_received_crc(const struct write_state *state) {
+	hg_size_t run = state->size / state->npieces;
+	uint32_t crc = 0;
+	uint32_t i;
+	
+	if (!state->map)
+		return crc32c(0, state->buffer, state->size);
+	for (i = 0; i < state->npieces; ++i)
+		crc = crc32c(crc, (char *)state->buffer + state->pieces[i], run);
+	return crc;
+}
+
+/* Store a write received in a pooled buffer, run by run */
+static int32_t write_store(const struct write_state *state) {
+	hg_size_t run = state->size / state->npieces;
+	uint32_t i;
+	
+	for (i = 0; i < state->npieces; ++i)
+		if (write_consume((char *)state->buffer + i * run, run,
+				state->file_offset + state->pieces[i]) != 0)
+			return -1;
+	return 0;
+}
+
+/* Where a write goes: placed ones at their origin, the others appended */
+static int write_place(struct write_state *state) {
+	uint64_t end, cur;
+	
+	if (!(state->in.layout.flags & WRITE_LAYOUT_PLACED)) {
+		state->file_offset = write_reserve(state->lead + state->span) +
+			state->lead;
+		return 0;
+	}
+	if (__builtin_add_overflow(state->in.layout.origin, state->lead,
+			&state->file_offset) ||
+			__builtin_add_overflow(state->file_offset, state->span, &end) ||
+			end > (uint64_t)INT64_MAX)
+		return -1;
+	/* later appends go past it */
+	cur = __atomic_load_n(&write_end, __ATOMIC_RELAXED);
+	while (cur < end && !__atomic_compare_exchange_n(&write_end, &cur, end,
+			0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return 0;
+}
+
 /* callback/handler triggered upon receipt of RPC request */
 static hg_return_t write_handler(hg_handle_t handle) {
 	int ret;
 	struct write_state *state;
 	struct hg_info *hgi;
+	write_out_t out;
 	
 	/* setup state struct */
 	state = malloc(sizeof(*state));
@@ -56,23 +630,44 @@ static hg_return_t write_handler(hg_handle_t handle) {
 
 	state->size = state->in.size;
 	state->handle = handle;
-	/* allocating a target buffer for bulk transfer */
-	state->buffer = malloc(state->size);
-	assert(state->buffer);
+	hgi = HG_Get_info(handle);
+	assert(hgi);
 	
 	//printf("Write %d bytes to local memory\n", state->size);
 	
-	/* register local target buffer for bulk access */
-	hgi = HG_Get_info(handle);
-	assert(hgi);
-	ret = HG_Bulk_create(hgi->hg_class, 1, &state->buffer,
-		&state->size, HG_BULK_READWRITE, &state->bulk_handle);
-	assert(ret == 0);
+	state->map = NULL;
+	state->pool_buf = NULL;
+	state->file_offset = 0;
+	if (write_plan(state) != 0 ||
+			(write_fd >= 0 && write_place(state) != 0)) {
+		if (state->pieces != &state->piece)
+			free(state->pieces);
+		out.ret = -1;
+		ret = HG_Respond(handle, NULL, NULL, &out);
+		assert(ret == HG_SUCCESS);
+		HG_Free_input(handle, &state->in);
+		HG_Destroy(handle);
+		free(state);
+		return 0;
+	}
+	
+	
+	/* large writes go straight to the file, others to a registered
+	 * buffer checked out of the pool */
+	if (write_fd < 0 || state->size < WRITE_MAP_MIN ||
+			write_map(state, hgi->hg_class) != 0) {
+		state->pool = write_pool_get(hgi->hg_class);
+		state->pool_buf = bulk_pool_checkout(state->pool, state->size);
+		assert(state->pool_buf);
+		state->buffer = state->pool_buf->buffer;
+		state->bulk_handle = state->pool_buf->bulk_handle;
+	}
 	
 	/* initial bulk transfer from client to server */
 	ret = HG_Bulk_transfer(hgi->context, write_handler_bulk_cb,
-		state, HG_BULK_PULL, hgi->addr, state->in.bulk_handle, 0,
-		state->bulk_handle, 0, state->size, HG_OP_ID_IGNORE);
+		state, HG_BULK_PULL, hgi->addr, state->in.bulk_handle,
+		state->in.bulk_offset, state->bulk_handle, 0, state->size,
+		HG_OP_ID_IGNORE);
 	assert(ret == 0);
 	
 	return 0;
@@ -87,8 +682,16 @@ static hg_return_t write_handler_bulk_cb(const struct hg_cb_info *info) {
 	
 	assert(info->ret == 0);
 	
-	//printf("Received data: %s\n", state->buffer);
-	out.ret = 0;
+	if (state->in.checksum_type == WRITE_CHECKSUM_CRC32C &&
+			write_received_crc(state) != state->in.checksum) {
+		fprintf(stderr, "write: checksum mismatch on %lu bytes\n",
+			(unsigned long)state->size);
+		out.ret = -1;
+	} else if (state->map)
+		out.ret = write_flush(state->file_offset, state->span, state->map,
+			state->map_len);
+	else if ((out.ret = write_store(state)) == 0)
+		out.ret = write_flush(state->file_offset, state->span, NULL, 0);
 	
 	/* Send ack to client */
 	ret = HG_Respond(state->handle, NULL, NULL, &out);
@@ -96,63 +699,450 @@ static hg_return_t write_handler_bulk_cb(const struct hg_cb_info *info) {
 	(void)ret;
 	//printf("Sent response to client\n");
 	
-	HG_Bulk_free(state->bulk_handle);
+	HG_Free_input(state->handle, &state->in);
 	HG_Destroy(state->handle);
-	free(state->buffer);
+	if (state->map) {
+		HG_Bulk_free(state->bulk_handle);
+		munmap(state->map, state->map_len);
+	} else
+		bulk_pool_return(state->pool, state->pool_buf);
+	if (state->pieces != &state->piece)
+		free(state->pieces);
 	free(state);
 	
 	return 0;
 }
 
-uint32_t rpc_write(int32_t size, void *buffer, char *host) {
+/* batch handler, pulls the whole batch at once */
+static hg_return_t write_batch_handler(hg_handle_t handle) {
+	int ret;
+	struct write_batch_state *state;
+	struct hg_info *hgi;
+	
+	state = malloc(sizeof(*state));
+	assert(state);
+	
+	ret = HG_Get_input(handle, &state->in);
+	assert(ret == HG_SUCCESS);
+	
+	state->size = HG_Bulk_get_size(state->in.bulk_handle);
+	state->handle = handle;
+	hgi = HG_Get_info(handle);
+	assert(hgi);
+	
+	state->pool = write_pool_get(hgi->hg_class);
+	state->pool_buf = bulk_pool_checkout(state->pool, state->size);
+	assert(state->pool_buf);
+	state->buffer = state->pool_buf->buffer;
+	state->bulk_handle = state->pool_buf->bulk_handle;
+	
+	ret = HG_Bulk_transfer(hgi->context, write_batch_handler_bulk_cb,
+		state, HG_BULK_PULL, hgi->addr, state->in.bulk_handle, 0,
+		state->bulk_handle, 0, state->size, HG_OP_ID_IGNORE);
+	if (ret != HG_SUCCESS)
+		write_batch_respond(state, -1, 0);
+	
+	return 0;
+}
+
+/* answer a batch of which the first count records were stored, then
+ * drop it */
+static void write_batch_respond(struct write_batch_state *state,
+		int32_t ret, uint32_t count) {
+	write_batch_out_t out;
+	int r;
+	
+	out.ret = ret;
+	out.count = count;
+	r = HG_Respond(state->handle, NULL, NULL, &out);
+	assert(r == HG_SUCCESS);
+	(void)r;
+	
+	HG_Free_input(state->handle, &state->in);
+	HG_Destroy(state->handle);
+	bulk_pool_return(state->pool, state->pool_buf);
+	free(state);
+}
+
+/* split the batch back into records */
+static hg_return_t write_batch_handler_bulk_cb(const struct hg_cb_info *info) {
+	struct write_batch_state *state = info->arg;
+	int32_t *sizes = state->buffer;
+	char *record;
+	hg_size_t offset, header;
+	uint64_t base = 0;
+	uint32_t count = 0;
+	uint32_t i;
+	int32_t ret = 0;
+	
+	/* the client went away mid-pull */
+	if (info->ret != HG_SUCCESS) {
+		write_batch_respond(state, -1, 0);
+		return 0;
+	}
+	
+	header = (hg_size_t)state->in.count * sizeof(int32_t);
+	/* records are stored back to back, up to the first that is malformed
+	 * or cannot be stored */
+	if (write_fd >= 0 && header <= state->size)
+		base = write_reserve(state->size - header);
+	offset = header;
+	for (i = 0; i < state->in.count && offset <= state->size; ++i) {
+		if (sizes[i] < 0 || offset + sizes[i] > state->size)
+			break;
+		record = (char *)state->buffer + offset;
+		ret = write_consume(record, sizes[i], base + offset - header);
+		if (ret != 0)
+			break;
+		offset += sizes[i];
+		count++;
+	}
+	/* truncated or malformed batch */
+	if (count != state->in.count && ret == 0)
+		ret = -1;
+	/* none of the stored records is safe if they cannot be synced */
+	if (count > 0 && write_flush(base, offset - header, NULL, 0) != 0) {
+		ret = -1;
+		count = 0;
+	}
+	
+	write_batch_respond(state, ret, count);
+	return 0;
+}
+
+void write_pool_stats(struct bulk_pool_stats *stats) {
+	struct bulk_pool_stats pool;
+	struct bulk_pool *p;
+	unsigned int i;
+	
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < write_ntransports; ++i) {
+		p = __atomic_load_n(&write_transports[i].pool, __ATOMIC_ACQUIRE);
+		if (!p)
+			continue;
+		bulk_pool_get_stats(p, &pool);
+		stats->hits += pool.hits;
+		stats->misses += pool.misses;
+		stats->in_use += pool.in_use;
+		stats->high_water += pool.high_water;
+		stats->registered_bytes += pool.registered_bytes;
+	}
+}
+
+void write_handle_stats(struct handle_pool_stats *stats) {
+	struct handle_pool_stats pool;
+	unsigned int i, j;
+	
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < write_ntransports; ++i) {
+		for (j = 0; j < WRITE_RPC_COUNT; ++j) {
+			handle_pool_get_stats(write_transports[i].handles[j], &pool);
+			stats->created += pool.created;
+			stats->reused += pool.reused;
+			stats->destroyed += pool.destroyed;
+			stats->cached += pool.cached;
+		}
+	}
+}
+
+struct write_cq *write_cq_create(void) {
+	struct write_cq *cq;
+	
+	cq = malloc(sizeof(*cq));
+	if (!cq)
+		return NULL;
+	if (cq_init(&cq->queue) != 0) {
+		free(cq);
+		return NULL;
+	}
+	cq->next_ticket = 1;
+	return cq;
+}
+
+void write_cq_destroy(struct write_cq *cq) {
+	struct cq_node *node;
+	
+	/* drop completions nobody collected */
+	while ((node = cq_pop(&cq->queue)))
+		free(cq_entry(node, struct write_state, node));
+	cq_destroy(&cq->queue);
+	free(cq);
+}
+
+void write_set_checksum(uint32_t type) {
+	write_checksum_type = type;
+}
+
+void write_set_local(int enable) {
+	__atomic_store_n(&write_local_enabled, enable, __ATOMIC_RELAXED);
+}
+
+void write_set_target_contexts(unsigned int count) {
+	if (count < 1)
+		count = 1;
+	if (count > 256)
+		count = 256;
+	__atomic_store_n(&write_target_contexts, count, __ATOMIC_RELAXED);
+}
+
+/* The server context the next RPC over t goes to, round robin. A server
+ * has a single na+sm context. */
+static hg_uint8_t write_target_pick(struct write_transport *t) {
+	unsigned int count = __atomic_load_n(&write_target_contexts,
+		__ATOMIC_RELAXED);
+	
+	if (t != &write_transports[0] || count == 1)
+		return 0;
+	return __atomic_fetch_add(&write_target_next, 1, __ATOMIC_RELAXED) %
+		count;
+}
+
+/* Whether the name part of host, between "proto://" and ":port", is this
+ * node */
+static int write_host_local(const char *host) {
+	char self[256];
+	const char *name = strstr(host, "://");
+	const char *port = strrchr(host, ':');
+	size_t len;
+	
+	name = name ? name + 3 : host;
+	len = port && port >= name ? (size_t)(port - name) : strlen(name);
+	if ((len == 9 && strncmp(name, "localhost", len) == 0) ||
+			strncmp(name, "127.", 4) == 0)
+		return 1;
+	if (gethostname(self, sizeof(self)) != 0)
+		return 0;
+	self[sizeof(self) - 1] = '\0';
+	return strlen(self) == len && strncmp(name, self, len) == 0;
+}
+
+/* The na+sm address a server on this node published for host, NULL if
+ * host is remote or its server did not publish one */
+static char *write_local_addr(const char *host) {
+	char path[4096];
+	char addr[WRITE_LOCAL_ADDR_MAX];
+	FILE *f;
+	char *end;
+	
+	if (!write_host_local(host) ||
+			write_local_path(host, path, sizeof(path)) != 0)
+		return NULL;
+	f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	end = fgets(addr, sizeof(addr), f);
+	fclose(f);
+	if (!end)
+		return NULL;
+	addr[strcspn(addr, "\r\n")] = '\0';
+	return addr[0] ? strdup(addr) : NULL;
+}
+
+/* Client side, the transport writes to host go through and the name to
+ * look up on it, host itself or its na+sm address copied to local. Resolved
+ * once per host, until write_route_drop(). */
+static struct write_transport *write_route(const char *host,
+		const char **name, char local[WRITE_LOCAL_ADDR_MAX]) {
+	struct write_route *r;
+	
+	*name = host;
+	if (!write_local || !__atomic_load_n(&write_local_enabled,
+			__ATOMIC_RELAXED))
+		return &write_transports[0];
+	
+	pthread_mutex_lock(&write_route_lock);
+	for (r = write_routes; r; r = r->next)
+		if (strcmp(r->host, host) == 0)
+			break;
+	if (!r) {
+		r = malloc(sizeof(*r));
+		assert(r);
+		r->host = strdup(host);
+		assert(r->host);
+		r->local = write_local_addr(host);
+		r->next = write_routes;
+		write_routes = r;
+	}
+	if (!r->local) {
+		pthread_mutex_unlock(&write_route_lock);
+		return &write_transports[0];
+	}
+	/* r goes away once dropped */
+	snprintf(local, WRITE_LOCAL_ADDR_MAX, "%s", r->local);
+	pthread_mutex_unlock(&write_route_lock);
+	*name = local;
+	return write_local;
+}
+
+/* na+sm failed to reach the server of a route, name being its host or the
+ * address it resolved to. The next write to the host resolves it again,
+ * over tcp if the server is gone from this node or no longer publishes an
+ * address. */
+static void write_route_drop(const char *name) {
+	struct write_route **p, *r;
+	
+	pthread_mutex_lock(&write_route_lock);
+	for (p = &write_routes; (r = *p); ) {
+		if (strcmp(r->host, name) != 0 &&
+				(!r->local || strcmp(r->local, name) != 0)) {
+			p = &r->next;
+			continue;
+		}
+		*p = r->next;
+		free(r->host);
+		free(r->local);
+		free(r);
+	}
+	pthread_mutex_unlock(&write_route_lock);
+}
+
+int write_host_is_local(const char *host) {
+	char local[WRITE_LOCAL_ADDR_MAX];
+	const char *name;
+	
+	return write_route(host, &name, local) == write_local;
+}
+
+write_ticket_t rpc_write_submit(struct write_cq *cq, int32_t size,
+		void *buffer, char *host, void *arg) {
+	char local[WRITE_LOCAL_ADDR_MAX];
 	struct write_state *state;
-	na_return_t ret;
-	int len;
+	write_ticket_t ticket;
+	const char *name;
 	
 	state = malloc(sizeof(*state));
+	assert(state);
+	state->t = write_route(host, &name, local);
+	state->host = state->t == write_local ? strdup(host) : NULL;
 	state->in.size = size;
+	state->in.checksum_type = write_checksum_type;
+	state->in.checksum = write_checksum_type == WRITE_CHECKSUM_CRC32C ?
+		crc32c(0, buffer, size) : 0;
+	state->in.bulk_offset = 0;
+	memset(&state->in.layout, 0, sizeof(state->in.layout));
 	state->size = size;
 	state->buffer = buffer;
-	state->value = write_value;
-	write_comp[write_value] = 0;
-	write_value = (write_value + 1) % READLINE_LIMIT;
-	ret  = HG_Addr_lookup(hg_context, lookup_cb, state, host, HG_OP_ID_IGNORE);
-	assert(ret == NA_SUCCESS);
-	(void)ret;
+	state->segments = NULL;
+	state->cq = cq;
+	state->arg = arg;
+	state->ticket = __atomic_fetch_add(&cq->next_ticket, 1, __ATOMIC_RELAXED);
+	ticket = state->ticket;
+	/* state may already be completed when this returns */
+	addr_cache_lookup(state->t->addr_cache, name, lookup_cb, state);
 	
-	return write_value-1;
+	return ticket;
 }
 
-uint32_t check_write(const uint32_t id) {
-	return write_comp[id];
+static void write_cq_collect(struct cq_node *node,
+		struct write_completion *comp) {
+	struct write_state *state = cq_entry(node, struct write_state, node);
+	
+	comp->ticket = state->ticket;
+	comp->ret = state->ret;
+	comp->arg = state->arg;
+	free(state);
 }
 
-static hg_return_t lookup_cb(const struct hg_cb_info *callback_info) {
-	na_addr_t svr_addr = callback_info->info.lookup.addr;
-	struct hg_info *hgi;
-	hg_return_t ret;
-	struct write_state *state;
+int write_cq_poll(struct write_cq *cq, struct write_completion *comp,
+		int max) {
+	struct cq_node *node;
+	int n = 0;
+	
+	while (n < max && (node = cq_pop(&cq->queue)))
+		write_cq_collect(node, &comp[n++]);
+	return n;
+}
+
+int write_cq_wait(struct write_cq *cq, struct write_completion *comp,
+		int max, int timeout_ms) {
+	struct cq_node *node;
+	
+	if (max <= 0)
+		return 0;
+	node = cq_wait(&cq->queue, timeout_ms);
+	if (!node)
+		return 0;
+	write_cq_collect(node, comp);
+	/* grab whatever else completed meanwhile */
+	return 1 + write_cq_poll(cq, comp + 1, max - 1);
+}
+
+/* drop a server after a transport error, its idle handles right away. The
+ * address itself stays valid until every borrower released it. */
+static void write_invalidate(struct write_transport *t, hg_addr_t addr) {
+	char name[WRITE_LOCAL_ADDR_MAX];
+	hg_size_t len = sizeof(name);
+	int i;
 	
-	assert(callback_info->ret == 0);
+	for (i = 0; i < WRITE_RPC_COUNT; ++i)
+		handle_pool_evict(t->handles[i], addr);
+	/* the route through na+sm goes too, tcp may still work */
+	if (t == write_local &&
+			HG_Addr_to_string(t->hg_class, name, &len, addr) == HG_SUCCESS)
+		write_route_drop(name);
+	addr_cache_invalidate(t->addr_cache, addr);
+}
+
+/* complete a write that never reached the server */
+static void write_fail(struct write_state *state) {
+	free(state->host);
+	state->ret = -1;
+	cq_push(&state->cq->queue, &state->node);
+}
+
+/* A write through na+sm could not be sent, send it over tcp instead.
+ * Returns 0 if it was not going through na+sm. */
+static int write_retry(struct write_state *state) {
+	char *host = state->host;
+	
+	if (!host)
+		return 0;
+	state->host = NULL;
+	write_route_drop(host);
+	state->t = &write_transports[0];
+	addr_cache_lookup(state->t->addr_cache, host, lookup_cb, state);
+	free(host);
+	return 1;
+}
+
+static void lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg) {
+	const struct hg_info *hgi;
+	struct write_state *state = arg;
 	
-	state = callback_info->arg;
-	ret = HG_Create(hg_context, svr_addr, hg_id, &state->handle);
+	if (ret != HG_SUCCESS) {
+		if (!write_retry(state))
+			write_fail(state);
+		return;
+	}
+	
+	state->addr = svr_addr;
+	ret = handle_pool_get(state->t->handles[WRITE_RPC_WRITE], svr_addr,
+		&state->handle);
 	assert(ret == HG_SUCCESS);
 	(void)ret;
+	HG_Set_target_id(state->handle, write_target_pick(state->t));
 	
 	hgi = HG_Get_info(state->handle);
 	assert(hgi);
-	ret = HG_Bulk_create(hgi->hg_class, 1, &state->buffer, &state->size,
-		HG_BULK_READWRITE, &state->in.bulk_handle);
+	if (state->segments)
+		ret = HG_Bulk_create(hgi->hg_class, state->count, state->segments,
+			state->segment_sizes, HG_BULK_READ_ONLY,
+			&state->in.bulk_handle);
+	else
+		ret = HG_Bulk_create(hgi->hg_class, 1, &state->buffer,
+			&state->size, HG_BULK_READWRITE, &state->in.bulk_handle);
 	state->bulk_handle = state->in.bulk_handle;
 	assert(ret == 0);
 	
 	ret = HG_Forward(state->handle, write_cb, state, &state->in);
-	assert(ret == 0);
-	(void)ret;
-	
-	return NA_SUCCESS;
-	
+	if (ret != HG_SUCCESS) {
+		write_invalidate(state->t, svr_addr);
+		HG_Bulk_free(state->bulk_handle);
+		HG_Destroy(state->handle);
+		addr_cache_release(state->t->addr_cache, svr_addr);
+		if (!write_retry(state))
+			write_fail(state);
+	}
 }
 
 static hg_return_t write_cb(const struct hg_cb_info *info) {
@@ -160,7 +1150,16 @@ static hg_return_t write_cb(const struct hg_cb_info *info) {
 	int ret;
 	struct write_state *state = info->arg;
 	
-	assert(info->ret == HG_SUCCESS);
+	if (info->ret != HG_SUCCESS) {
+		/* transport error, look the server up again next time. Not
+		 * retried, the server may have stored it already. */
+		write_invalidate(state->t, state->addr);
+		HG_Bulk_free(state->bulk_handle);
+		HG_Destroy(info->info.forward.handle);
+		addr_cache_release(state->t->addr_cache, state->addr);
+		write_fail(state);
+		return HG_SUCCESS;
+	}
 	
 	/* decode response */
 	ret = HG_Get_output(info->info.forward.handle, &out);
@@ -169,15 +1168,1130 @@ static hg_return_t write_cb(const struct hg_cb_info *info) {
 	//printf("Got response ret: %d\n", out.ret);
 	//printf("Data transferred: %s\n", (char*)(state->buffer));
 	
-	write_comp[state->value] = 1;
+	state->ret = out.ret;
 	
 	HG_Bulk_free(state->bulk_handle);
 	HG_Free_output(info->info.forward.handle, &out);
-	HG_Destroy(info->info.forward.handle);
+	handle_pool_put(state->t->handles[WRITE_RPC_WRITE], state->addr,
+		info->info.forward.handle);
+	addr_cache_release(state->t->addr_cache, state->addr);
+	free(state->host);
+	
+	/* hand over to the consumer, which frees state */
+	cq_push(&state->cq->queue, &state->node);
+	
+	return HG_SUCCESS;
+}
+
+write_ticket_t rpc_write_layout(struct write_cq *cq, const struct iovec *iov,
+		int iovcnt, const write_layout_t *layout, char *host, void *arg) {
+	char local[WRITE_LOCAL_ADDR_MAX];
+	struct write_state *state;
+	write_ticket_t ticket;
+	const char *name;
+	hg_size_t size = 0;
+	uint64_t first, span;
+	uint32_t inner;
+	uint32_t crc = 0;
+	int i;
+	
+	/* the segment arrays live right behind state */
+	state = malloc(sizeof(*state) + (iovcnt > 0 ? iovcnt : 0) *
+		(sizeof(*state->segments) + sizeof(*state->segment_sizes)));
+	assert(state);
+	state->segments = (void **)(state + 1);
+	state->segment_sizes = (hg_size_t *)(state->segments + iovcnt);
+	state->count = iovcnt;
+	for (i = 0; i < iovcnt; ++i) {
+		state->segments[i] = iov[i].iov_base;
+		state->segment_sizes[i] = iov[i].iov_len;
+		if (write_checksum_type == WRITE_CHECKSUM_CRC32C)
+			crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+		size += iov[i].iov_len;
+	}
+	
+	state->cq = cq;
+	state->arg = arg;
+	state->host = NULL;
+	state->ticket = __atomic_fetch_add(&cq->next_ticket, 1, __ATOMIC_RELAXED);
+	ticket = state->ticket;
+	if (iovcnt <= 0 || size > INT32_MAX ||
+			write_layout_check(layout, size, &first, &span, &inner) != 0) {
+		write_fail(state);
+		return ticket;
+	}
+	
+	state->t = write_route(host, &name, local);
+	state->host = state->t == write_local ? strdup(host) : NULL;
+	state->in.size = size;
+	state->in.checksum_type = write_checksum_type;
+	state->in.checksum = crc;
+	state->in.bulk_offset = 0;
+	state->in.layout = *layout;
+	state->size = size;
+	state->buffer = NULL;
+	/* state may already be completed when this returns */
+	addr_cache_lookup(state->t->addr_cache, name, lookup_cb, state);
+	
+	return ticket;
+}
+
+write_ticket_t rpc_writev(struct write_cq *cq, const struct iovec *iov,
+		int iovcnt, hg_size_t stride, char *host, void *arg) {
+	write_layout_t layout;
+	int i;
+	
+	memset(&layout, 0, sizeof(layout));
+	/* iovcnt rows of bytes, stride apart */
+	if (stride && iovcnt > 0) {
+		layout.ndims = 2;
+		layout.elem_size = 1;
+		layout.count[0] = iovcnt;
+		layout.count[1] = iov[0].iov_len;
+		layout.stride[0] = stride;
+		layout.stride[1] = 1;
+		for (i = 1; i < iovcnt; ++i)
+			if (iov[i].iov_len != iov[0].iov_len)
+				layout.count[1] = 0;
+	}
+	return rpc_write_layout(cq, iov, iovcnt, &layout, host, arg);
+}
+
+
+/* Client side striping */
+
+struct write_stripe_layout *write_stripe_layout_create(
+		const char *const *hosts, unsigned int nhosts,
+		hg_size_t stripe_size) {
+	char local[WRITE_LOCAL_ADDR_MAX];
+	struct write_stripe_layout *layout;
+	const char *name;
+	unsigned int i;
+	
+	/* a piece has to fit the int32_t size of a write RPC */
+	if (nhosts == 0 || stripe_size == 0 || stripe_size > INT32_MAX)
+		return NULL;
+	layout = malloc(sizeof(*layout));
+	if (!layout)
+		return NULL;
+	layout->hosts = malloc(nhosts * sizeof(*layout->hosts));
+	layout->transports = malloc(nhosts * sizeof(*layout->transports));
+	if (!layout->hosts || !layout->transports) {
+		free(layout->hosts);
+		free(layout->transports);
+		free(layout);
+		return NULL;
+	}
+	for (i = 0; i < nhosts; ++i) {
+		layout->transports[i] = write_route(hosts[i], &name, local);
+		layout->hosts[i] = strdup(name);
+		assert(layout->hosts[i]);
+	}
+	layout->nhosts = nhosts;
+	layout->stripe_size = stripe_size;
+	return layout;
+}
+
+void write_stripe_layout_destroy(struct write_stripe_layout *layout) {
+	unsigned int i;
+	
+	for (i = 0; i < layout->nhosts; ++i)
+		free(layout->hosts[i]);
+	free(layout->hosts);
+	free(layout->transports);
+	free(layout);
+}
+
+write_ticket_t rpc_write_striped(struct write_cq *cq,
+		const struct write_stripe_layout *layout, hg_size_t size,
+		void *buffer, void *arg) {
+	struct write_striped_state *striped;
+	struct write_stripe *stripe;
+	struct write_state *record;
+	struct write_transport *t;
+	write_ticket_t ticket;
+	hg_size_t offset, len;
+	uint32_t count, i;
+	unsigned int k;
+	int ret;
+	
+	record = malloc(sizeof(*record));
+	assert(record);
+	record->cq = cq;
+	record->arg = arg;
+	record->ticket = __atomic_fetch_add(&cq->next_ticket, 1,
+		__ATOMIC_RELAXED);
+	ticket = record->ticket;
+	if (size == 0) {
+		record->ret = 0;
+		cq_push(&cq->queue, &record->node);
+		return ticket;
+	}
+	
+	count = (size + layout->stripe_size - 1) / layout->stripe_size;
+	striped = malloc(sizeof(*striped) + count * sizeof(*striped->stripes));
+	assert(striped);
+	striped->pending = count;
+	striped->ret = 0;
+	striped->record = record;
+	striped->count = count;
+	for (i = 0; i < WRITE_MAX_TRANSPORTS; ++i)
+		striped->bulk_handles[i] = HG_BULK_NULL;
+	
+	for (i = 0, offset = 0; i < count; ++i, offset += len) {
+		len = size - offset < layout->stripe_size ? size - offset :
+			layout->stripe_size;
+		t = layout->transports[i % layout->nhosts];
+		k = t - write_transports;
+		/* the buffer is registered once with every class it goes out on */
+		if (striped->bulk_handles[k] == HG_BULK_NULL) {
+			ret = HG_Bulk_create(t->hg_class, 1, &buffer, &size,
+				HG_BULK_READ_ONLY, &striped->bulk_handles[k]);
+			assert(ret == 0);
+			(void)ret;
+		}
+		stripe = &striped->stripes[i];
+		stripe->parent = striped;
+		stripe->t = t;
+		stripe->in.size = len;
+		stripe->in.checksum_type = write_checksum_type;
+		stripe->in.checksum = write_checksum_type == WRITE_CHECKSUM_CRC32C ?
+			crc32c(0, (char *)buffer + offset, len) : 0;
+		stripe->in.bulk_offset = offset;
+		memset(&stripe->in.layout, 0, sizeof(stripe->in.layout));
+		stripe->in.bulk_handle = striped->bulk_handles[k];
+	}
+	
+	/* striped lives until its last piece completes, which may happen
+	 * before this loop is done */
+	for (i = 0; i < count; ++i)
+		addr_cache_lookup(layout->transports[i % layout->nhosts]->addr_cache,
+			layout->hosts[i % layout->nhosts], stripe_lookup_cb,
+			&striped->stripes[i]);
+	
+	return ticket;
+}
+
+static void stripe_done(struct write_stripe *stripe, int32_t ret) {
+	struct write_striped_state *striped = stripe->parent;
+	int32_t ok = 0;
+	int i;
+	
+	if (ret != 0)
+		__atomic_compare_exchange_n(&striped->ret, &ok, ret, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	if (__atomic_sub_fetch(&striped->pending, 1, __ATOMIC_ACQ_REL) != 0)
+		return;
+	
+	striped->record->ret = striped->ret;
+	for (i = 0; i < WRITE_MAX_TRANSPORTS; ++i)
+		if (striped->bulk_handles[i] != HG_BULK_NULL)
+			HG_Bulk_free(striped->bulk_handles[i]);
+	cq_push(&striped->record->cq->queue, &striped->record->node);
+	free(striped);
+}
+
+static void stripe_lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg) {
+	struct write_stripe *stripe = arg;
+	
+	if (ret != HG_SUCCESS) {
+		stripe_done(stripe, -1);
+		return;
+	}
+	
+	stripe->addr = svr_addr;
+	ret = handle_pool_get(stripe->t->handles[WRITE_RPC_WRITE], svr_addr,
+		&stripe->handle);
+	assert(ret == HG_SUCCESS);
+	HG_Set_target_id(stripe->handle, write_target_pick(stripe->t));
+	
+	ret = HG_Forward(stripe->handle, stripe_write_cb, stripe, &stripe->in);
+	if (ret != HG_SUCCESS) {
+		write_invalidate(stripe->t, svr_addr);
+		HG_Destroy(stripe->handle);
+		addr_cache_release(stripe->t->addr_cache, svr_addr);
+		stripe_done(stripe, -1);
+	}
+}
+
+static hg_return_t stripe_write_cb(const struct hg_cb_info *info) {
+	write_out_t out;
+	int32_t r;
+	int ret;
+	struct write_stripe *stripe = info->arg;
+	
+	if (info->ret != HG_SUCCESS) {
+		write_invalidate(stripe->t, stripe->addr);
+		HG_Destroy(info->info.forward.handle);
+		addr_cache_release(stripe->t->addr_cache, stripe->addr);
+		stripe_done(stripe, -1);
+		return HG_SUCCESS;
+	}
+	
+	ret = HG_Get_output(info->info.forward.handle, &out);
+	assert(ret == 0);
+	(void)ret;
+	
+	r = out.ret;
+	HG_Free_output(info->info.forward.handle, &out);
+	handle_pool_put(stripe->t->handles[WRITE_RPC_WRITE], stripe->addr,
+		info->info.forward.handle);
+	addr_cache_release(stripe->t->addr_cache, stripe->addr);
+	stripe_done(stripe, r);
+	
+	return HG_SUCCESS;
+}
+
+
+/* Client side batching */
+
+static struct write_batch_state *batch_alloc(uint32_t max_count) {
+	struct write_batch_state *batch;
+	
+	batch = calloc(1, sizeof(*batch));
+	assert(batch);
+	batch->sizes = malloc(max_count * sizeof(*batch->sizes));
+	batch->segments = malloc((max_count + 1) * sizeof(*batch->segments));
+	batch->segment_sizes = malloc((max_count + 1) *
+		sizeof(*batch->segment_sizes));
+	batch->records = malloc(max_count * sizeof(*batch->records));
+	assert(batch->sizes && batch->segments && batch->segment_sizes &&
+		batch->records);
+	return batch;
+}
+
+static void batch_free(struct write_batch_state *batch) {
+	free(batch->host);
+	free(batch->sizes);
+	free(batch->segments);
+	free(batch->segment_sizes);
+	free(batch->records);
+	free(batch);
+}
+
+/* complete the records of the batch below stored with 0 and the others
+ * with ret, then drop it */
+static void batch_complete(struct write_batch_state *batch, uint32_t stored,
+		int32_t ret) {
+	uint32_t i;
+	
+	for (i = 0; i < batch->count; ++i) {
+		batch->records[i]->ret = i < stored ? 0 : ret;
+		cq_push(&batch->records[i]->cq->queue, &batch->records[i]->node);
+	}
+	batch_free(batch);
+}
+
+struct write_batcher *write_batcher_create(struct write_cq *cq,
+		const char *host, hg_size_t max_bytes, uint32_t max_count,
+		long flush_us) {
+	char local[WRITE_LOCAL_ADDR_MAX];
+	struct write_batcher *b;
+	const char *name;
+	
+	if (max_count == 0 || max_count > WRITE_BATCH_LIMIT)
+		return NULL;
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+	b->cq = cq;
+	b->t = write_route(host, &name, local);
+	b->host = strdup(name);
+	b->tcp_host = b->t == write_local ? strdup(host) : NULL;
+	/* one context per batcher, so its batches are stored in order */
+	b->target = write_target_pick(b->t);
+	b->max_bytes = max_bytes;
+	b->max_count = max_count;
+	b->flush_us = flush_us;
+	return b;
+}
+
+void write_batcher_destroy(struct write_batcher *b) {
+	write_batch_flush(b);
+	free(b->host);
+	free(b->tcp_host);
+	free(b);
+}
+
+void write_batch_flush(struct write_batcher *b) {
+	struct write_batch_state *batch = b->batch;
+	
+	if (!batch)
+		return;
+	b->batch = NULL;
+	b->bytes = 0;
+	
+	batch->segments[0] = batch->sizes;
+	batch->segment_sizes[0] = batch->count * sizeof(*batch->sizes);
+	batch->in.count = batch->count;
+	batch->t = b->t;
+	batch->target = b->target;
+	batch->host = b->tcp_host ? strdup(b->tcp_host) : NULL;
+	addr_cache_lookup(b->t->addr_cache, b->host, batch_lookup_cb, batch);
+}
+
+static long elapsed_us(const struct timespec *since) {
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000L +
+		(now.tv_nsec - since->tv_nsec) / 1000L;
+}
+
+int write_batch_tick(struct write_batcher *b) {
+	if (b->batch && elapsed_us(&b->first) >= b->flush_us) {
+		write_batch_flush(b);
+		return 1;
+	}
+	return 0;
+}
+
+write_ticket_t rpc_write_batched(struct write_batcher *b, int32_t size,
+		void *buffer, void *arg) {
+	struct write_batch_state *batch;
+	struct write_state *state;
+	
+	/* only completion fields are used for a batched record */
+	state = malloc(sizeof(*state));
+	assert(state);
+	state->cq = b->cq;
+	state->arg = arg;
+	state->ticket = __atomic_fetch_add(&b->cq->next_ticket, 1,
+		__ATOMIC_RELAXED);
+	if (size < 0) {
+		state->ret = -1;
+		cq_push(&b->cq->queue, &state->node);
+		return state->ticket;
+	}
+	
+	if (!b->batch) {
+		b->batch = batch_alloc(b->max_count);
+		clock_gettime(CLOCK_MONOTONIC, &b->first);
+	}
+	batch = b->batch;
+	
+	batch->records[batch->count] = state;
+	batch->sizes[batch->count] = size;
+	batch->segments[batch->count + 1] = buffer;
+	batch->segment_sizes[batch->count + 1] = size;
+	batch->count++;
+	b->bytes += size;
+	
+	if (batch->count == b->max_count || b->bytes >= b->max_bytes)
+		write_batch_flush(b);
+	else
+		write_batch_tick(b);
+	
+	return state->ticket;
+}
+
+/* Like write_retry(), the batcher keeps going through na+sm for its later
+ * batches */
+static int batch_retry(struct write_batch_state *batch) {
+	char *host = batch->host;
+	
+	if (!host)
+		return 0;
+	batch->host = NULL;
+	write_route_drop(host);
+	batch->t = &write_transports[0];
+	batch->target = write_target_pick(batch->t);
+	addr_cache_lookup(batch->t->addr_cache, host, batch_lookup_cb, batch);
+	free(host);
+	return 1;
+}
+
+static void batch_lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg) {
+	const struct hg_info *hgi;
+	struct write_batch_state *batch = arg;
+	
+	if (ret != HG_SUCCESS) {
+		if (!batch_retry(batch))
+			batch_complete(batch, 0, -1);
+		return;
+	}
+	
+	batch->addr = svr_addr;
+	ret = handle_pool_get(batch->t->handles[WRITE_RPC_BATCH], svr_addr,
+		&batch->handle);
+	assert(ret == HG_SUCCESS);
+	HG_Set_target_id(batch->handle, batch->target);
+	
+	hgi = HG_Get_info(batch->handle);
+	assert(hgi);
+	ret = HG_Bulk_create(hgi->hg_class, batch->count + 1, batch->segments,
+		batch->segment_sizes, HG_BULK_READ_ONLY, &batch->in.bulk_handle);
+	batch->bulk_handle = batch->in.bulk_handle;
+	assert(ret == 0);
+	
+	ret = HG_Forward(batch->handle, write_batch_cb, batch, &batch->in);
+	if (ret != HG_SUCCESS) {
+		write_invalidate(batch->t, svr_addr);
+		HG_Bulk_free(batch->bulk_handle);
+		HG_Destroy(batch->handle);
+		addr_cache_release(batch->t->addr_cache, svr_addr);
+		if (!batch_retry(batch))
+			batch_complete(batch, 0, -1);
+	}
+}
+
+static hg_return_t write_batch_cb(const struct hg_cb_info *info) {
+	write_batch_out_t out;
+	int ret;
+	struct write_batch_state *batch = info->arg;
+	
+	if (info->ret != HG_SUCCESS) {
+		write_invalidate(batch->t, batch->addr);
+		HG_Bulk_free(batch->bulk_handle);
+		HG_Destroy(info->info.forward.handle);
+		addr_cache_release(batch->t->addr_cache, batch->addr);
+		batch_complete(batch, 0, -1);
+		return HG_SUCCESS;
+	}
+	
+	ret = HG_Get_output(info->info.forward.handle, &out);
+	assert(ret == 0);
+	
+	HG_Bulk_free(batch->bulk_handle);
+	HG_Free_output(info->info.forward.handle, &out);
+	handle_pool_put(batch->t->handles[WRITE_RPC_BATCH], batch->addr,
+		info->info.forward.handle);
+	addr_cache_release(batch->t->addr_cache, batch->addr);
+	
+	/* the server stops at the first record it could not store */
+	batch_complete(batch, out.count, out.ret ? out.ret : -1);
+	
+	return HG_SUCCESS;
+}
+
+
+
+/* Streams, server side: records are pulled as they come, held until all
+ * the ones before them are in and applied to the stream's log in order.
+ * Every stream lives under stream_lock. */
+
+struct stream_pending {
+	uint64_t seq;
+	struct bulk_pool *pool; // of the class the record came in on
+	struct bulk_pool_buf *pool_buf; // NULL if the record was rejected
+	hg_size_t size;
+	struct stream_pending *next;
+};
+
+/* An ack-append or sync, answered once acked reaches upto */
+struct stream_waiter {
+	hg_handle_t handle;
+	uint64_t upto;
+	int close;
+	struct stream_waiter *next;
+};
+
+struct stream_log {
+	uint64_t id;
+	uint64_t next_seq; // records applied
+	int32_t ret;
+	int fd; // -1 if records are dropped
+	uint64_t end;
+	struct stream_pending *pending; // by seq
+	struct stream_waiter *waiters;
+	struct stream_log *next;
+};
+
+struct stream_append_state {
+	stream_append_in_t in;
+	hg_handle_t handle;
+	struct bulk_pool *pool;
+	struct bulk_pool_buf *pool_buf;
+	int ack;
+};
+
+static void stream_append_record(struct stream_append_state *state,
+	int ret);
+
+static struct stream_log *stream_logs = NULL;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct stream_log *stream_log_get(uint64_t id) {
+	struct stream_log *log;
+	char path[4096];
+	
+	for (log = stream_logs; log; log = log->next)
+		if (log->id == id)
+			return log;
+	
+	log = calloc(1, sizeof(*log));
+	assert(log);
+	log->id = id;
+	log->fd = -1;
+	if (write_target_path) {
+		snprintf(path, sizeof(path), "%s.stream-%016llx", write_target_path,
+			(unsigned long long)id);
+		log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (log->fd < 0)
+			log->ret = -1;
+	}
+	log->next = stream_logs;
+	stream_logs = log;
+	return log;
+}
+
+static void stream_log_destroy(struct stream_log *log) {
+	struct stream_log **p;
+	struct stream_pending *pending;
+	struct stream_waiter *waiter;
+	stream_ack_t out;
+	
+	for (p = &stream_logs; *p != log; p = &(*p)->next)
+		;
+	*p = log->next;
+	/* records beyond the close never make it */
+	out.ret = -1;
+	out.acked = log->next_seq;
+	while ((waiter = log->waiters)) {
+		log->waiters = waiter->next;
+		HG_Respond(waiter->handle, NULL, NULL, &out);
+		HG_Destroy(waiter->handle);
+		free(waiter);
+	}
+	while ((pending = log->pending)) {
+		log->pending = pending->next;
+		if (pending->pool_buf)
+			bulk_pool_return(pending->pool, pending->pool_buf);
+		free(pending);
+	}
+	if (log->fd >= 0)
+		close(log->fd);
+	free(log);
+}
+
+/* Apply the records that are next in line */
+static void stream_log_apply(struct stream_log *log) {
+	struct stream_pending *pending;
+	ssize_t n;
+	
+	while ((pending = log->pending) && pending->seq == log->next_seq) {
+		log->pending = pending->next;
+		if (!pending->pool_buf)
+			log->ret = -1;
+		else if (log->fd >= 0 && log->ret == 0) {
+			n = pwrite(log->fd, pending->pool_buf->buffer, pending->size,
+				log->end);
+			if (n != (ssize_t)pending->size)
+				log->ret = -1;
+		}
+		log->end += pending->size;
+		log->next_seq++;
+		if (pending->pool_buf)
+			bulk_pool_return(pending->pool, pending->pool_buf);
+		free(pending);
+	}
+}
+
+/* Answer the waiters acked now covers, the ack is also the point where
+ * the sync policy applies. Returns 1 if the stream was closed. */
+static int stream_log_answer(struct stream_log *log) {
+	struct stream_waiter **p, *waiter, *ready = NULL;
+	stream_ack_t out;
+	int closed = 0;
+	
+	for (p = &log->waiters; (waiter = *p); ) {
+		if (waiter->upto <= log->next_seq) {
+			*p = waiter->next;
+			waiter->next = ready;
+			ready = waiter;
+		} else
+			p = &waiter->next;
+	}
+	if (!ready)
+		return 0;
+	
+	if (log->fd >= 0 && log->ret == 0 &&
+			(write_sync == WRITE_SYNC_ASYNC ?
+			sync_file_range(log->fd, 0, 0, SYNC_FILE_RANGE_WRITE) :
+			write_sync == WRITE_SYNC_DATA ? fdatasync(log->fd) : 0) != 0)
+		log->ret = -1;
+	
+	out.ret = log->ret;
+	out.acked = log->next_seq;
+	while ((waiter = ready)) {
+		ready = waiter->next;
+		HG_Respond(waiter->handle, NULL, NULL, &out);
+		HG_Destroy(waiter->handle);
+		closed |= waiter->close;
+		free(waiter);
+	}
+	if (closed)
+		stream_log_destroy(log);
+	return closed;
+}
+
+static void stream_log_wait(struct stream_log *log, hg_handle_t handle,
+		uint64_t upto, int close) {
+	struct stream_waiter *waiter;
+	
+	waiter = malloc(sizeof(*waiter));
+	assert(waiter);
+	waiter->handle = handle;
+	waiter->upto = upto;
+	waiter->close = close;
+	waiter->next = log->waiters;
+	log->waiters = waiter;
+}
+
+static hg_return_t stream_append_handler(hg_handle_t handle) {
+	struct stream_append_state *state;
+	const struct hg_info *hgi;
+	int ret;
+	
+	state = malloc(sizeof(*state));
+	assert(state);
+	ret = HG_Get_input(handle, &state->in);
+	assert(ret == HG_SUCCESS);
+	state->handle = handle;
+	hgi = HG_Get_info(handle);
+	assert(hgi);
+	state->ack = hgi->id == hg_stream_ack_id;
+	state->pool = write_pool_get(hgi->hg_class);
+	state->pool_buf = NULL;
+	
+	/* a size the bulk handle cannot back fails the stream at this record,
+	 * like one that could not be stored */
+	if (state->in.size < 0 ||
+			(hg_size_t)state->in.size > HG_Bulk_get_size(state->in.bulk_handle)) {
+		stream_append_record(state, -1);
+		return 0;
+	}
+	
+	state->pool_buf = bulk_pool_checkout(state->pool, state->in.size);
+	if (!state->pool_buf) {
+		stream_append_record(state, -1);
+		return 0;
+	}
+	
+	ret = HG_Bulk_transfer(hgi->context, stream_append_bulk_cb, state,
+		HG_BULK_PULL, hgi->addr, state->in.bulk_handle, 0,
+		state->pool_buf->bulk_handle, 0, state->in.size, HG_OP_ID_IGNORE);
+	if (ret != HG_SUCCESS)
+		stream_append_record(state, -1);
+	
+	return 0;
+}
+
+static hg_return_t stream_append_bulk_cb(const struct hg_cb_info *info) {
+	stream_append_record(info->arg, info->ret == HG_SUCCESS ? 0 : -1);
+	return 0;
+}
+
+/* Queue a received record for its turn in the log. A record that failed
+ * (ret -1) still takes its seq, and fails the stream once applied. */
+static void stream_append_record(struct stream_append_state *state,
+		int ret) {
+	struct stream_pending *pending, **p;
+	struct stream_log *log;
+	uint64_t id = state->in.stream_id;
+	uint64_t seq = state->in.seq;
+	
+	if (ret != 0 && state->pool_buf) {
+		bulk_pool_return(state->pool, state->pool_buf);
+		state->pool_buf = NULL;
+	}
+	
+	pending = malloc(sizeof(*pending));
+	assert(pending);
+	pending->seq = seq;
+	pending->pool = state->pool;
+	pending->pool_buf = state->pool_buf;
+	pending->size = state->pool_buf ? (hg_size_t)state->in.size : 0;
+	HG_Free_input(state->handle, &state->in);
+	
+	pthread_mutex_lock(&stream_lock);
+	log = stream_log_get(id);
+	for (p = &log->pending; *p && (*p)->seq < seq; p = &(*p)->next)
+		;
+	if (seq < log->next_seq || (*p && (*p)->seq == seq)) {
+		/* resent */
+		if (pending->pool_buf)
+			bulk_pool_return(pending->pool, pending->pool_buf);
+		free(pending);
+	} else {
+		pending->next = *p;
+		*p = pending;
+	}
+	if (state->ack)
+		stream_log_wait(log, state->handle, seq + 1, 0);
+	stream_log_apply(log);
+	stream_log_answer(log);
+	pthread_mutex_unlock(&stream_lock);
+	
+	/* without an ack, nothing is ever sent back on the handle */
+	if (!state->ack)
+		HG_Destroy(state->handle);
 	free(state);
+}
+
+static hg_return_t stream_sync_handler(hg_handle_t handle) {
+	stream_sync_in_t in;
+	struct stream_log *log;
+	int ret;
+	
+	ret = HG_Get_input(handle, &in);
+	assert(ret == HG_SUCCESS);
+	(void)ret;
+	
+	pthread_mutex_lock(&stream_lock);
+	log = stream_log_get(in.stream_id);
+	stream_log_wait(log, handle, in.count, in.close);
+	stream_log_answer(log);
+	pthread_mutex_unlock(&stream_lock);
+	
+	HG_Free_input(handle, &in);
+	return 0;
+}
+
+
+/* Streams, client side */
+
+struct write_stream {
+	struct write_cq *cq;
+	struct write_transport *t;
+	char *host; // as looked up on t
+	uint64_t id;
+	uint32_t window;
+	uint32_t ack_every;
+	pthread_mutex_t lock; // the progress thread completes records
+	uint64_t next_seq;
+	uint64_t acked;
+	int32_t ret; // -1 once a record could not be sent
+	struct stream_record **unacked; // by seq % window
+	unsigned int refs; // owner until close completes, lookups, forwards
+	hg_uint8_t target; // server context every record goes to
+};
+
+struct stream_record {
+	struct write_state state; // first, collected as a write_state
+	struct write_stream *stream;
+	stream_append_in_t in;
+	int ack;
+	int pending; // not looked up yet, under stream lock
+};
+
+struct stream_sync {
+	struct write_state state; // first, collected as a write_state
+	struct write_stream *stream;
+	stream_sync_in_t in;
+};
+
+static void stream_put(struct write_stream *s) {
+	unsigned int refs;
+	
+	pthread_mutex_lock(&s->lock);
+	refs = --s->refs;
+	pthread_mutex_unlock(&s->lock);
+	if (refs)
+		return;
+	pthread_mutex_destroy(&s->lock);
+	free(s->unacked);
+	free(s->host);
+	free(s);
+}
+
+/* Complete the records below acked with ret, called with s->lock held. A
+ * record still waiting for its lookup stops there, its callback completes
+ * it and the ones after it. */
+static void stream_complete(struct write_stream *s, uint64_t acked,
+		int32_t ret) {
+	struct stream_record *record;
+	
+	for (; s->acked < acked; s->acked++) {
+		record = s->unacked[s->acked % s->window];
+		if (record->pending)
+			break;
+		record->state.ret = ret;
+		HG_Bulk_free(record->state.bulk_handle);
+		cq_push(&s->cq->queue, &record->state.node);
+	}
+}
+
+/* A record could not be sent, the stream cannot get past it anymore */
+static void stream_fail(struct write_stream *s) {
+	pthread_mutex_lock(&s->lock);
+	s->ret = -1;
+	stream_complete(s, s->next_seq, -1);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void stream_ack(struct write_stream *s, const stream_ack_t *out) {
+	pthread_mutex_lock(&s->lock);
+	if (out->acked > s->acked && out->acked <= s->next_seq)
+		stream_complete(s, out->acked, out->ret);
+	pthread_mutex_unlock(&s->lock);
+}
+
+struct write_stream *write_stream_open(struct write_cq *cq, const char *host,
+		uint32_t window) {
+	static uint64_t count;
+	char local[WRITE_LOCAL_ADDR_MAX];
+	struct write_stream *s;
+	struct timespec now;
+	const char *name;
+	uint64_t id;
+	
+	if (window == 0)
+		return NULL;
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->unacked = calloc(window, sizeof(*s->unacked));
+	s->t = write_route(host, &name, local);
+	s->host = strdup(name);
+	if (!s->unacked || !s->host) {
+		free(s->unacked);
+		free(s->host);
+		free(s);
+		return NULL;
+	}
+	
+	/* unique across the clients of a server, mixed so that ids of one
+	 * client do not cluster */
+	clock_gettime(CLOCK_REALTIME, &now);
+	id = ((uint64_t)getpid() << 32) ^ (uint64_t)now.tv_sec * 1000000000ULL ^
+		(uint64_t)now.tv_nsec ^
+		__atomic_fetch_add(&count, 1, __ATOMIC_RELAXED) << 48;
+	id ^= id >> 30;
+	id *= 0xbf58476d1ce4e5b9ULL;
+	id ^= id >> 27;
+	
+	s->cq = cq;
+	s->id = id;
+	s->window = window;
+	s->ack_every = window / 2 ? window / 2 : 1;
+	/* a single context, records then rarely wait for one another */
+	s->target = write_target_pick(s->t);
+	pthread_mutex_init(&s->lock, NULL);
+	s->refs = 1;
+	return s;
+}
+
+static hg_return_t stream_append_cb(const struct hg_cb_info *info) {
+	struct write_stream *s = info->arg;
+	hg_handle_t handle = info->info.forward.handle;
+	hg_addr_t addr = HG_Get_info(handle)->addr;
+	
+	/* sent, the cumulative ack of a later record completes it */
+	if (info->ret != HG_SUCCESS) {
+		write_invalidate(s->t, addr);
+		HG_Destroy(handle);
+		stream_fail(s);
+	} else
+		handle_pool_put(s->t->handles[WRITE_RPC_STREAM], addr, handle);
+	addr_cache_release(s->t->addr_cache, addr);
+	stream_put(s);
+	return HG_SUCCESS;
+}
+
+static hg_return_t stream_append_ack_cb(const struct hg_cb_info *info) {
+	struct write_stream *s = info->arg;
+	hg_handle_t handle = info->info.forward.handle;
+	hg_addr_t addr = HG_Get_info(handle)->addr;
+	stream_ack_t out;
+	
+	if (info->ret != HG_SUCCESS ||
+			HG_Get_output(handle, &out) != HG_SUCCESS) {
+		write_invalidate(s->t, addr);
+		HG_Destroy(handle);
+		stream_fail(s);
+	} else {
+		stream_ack(s, &out);
+		HG_Free_output(handle, &out);
+		handle_pool_put(s->t->handles[WRITE_RPC_STREAM_ACK], addr, handle);
+	}
+	addr_cache_release(s->t->addr_cache, addr);
+	stream_put(s);
+	return HG_SUCCESS;
+}
+
+static void stream_lookup_cb(hg_addr_t svr_addr, hg_return_t ret,
+		void *arg) {
+	struct stream_record *record = arg;
+	struct write_stream *s = record->stream;
+	stream_append_in_t in;
+	hg_handle_t handle;
+	int broken;
+	int ack;
+	
+	/* record may be completed, and freed, as soon as it is not pending */
+	pthread_mutex_lock(&s->lock);
+	in = record->in;
+	ack = record->ack;
+	record->pending = 0;
+	broken = s->ret != 0;
+	if (ret == HG_SUCCESS && !broken)
+		s->refs++;
+	pthread_mutex_unlock(&s->lock);
+	
+	if (ret != HG_SUCCESS || broken) {
+		if (ret == HG_SUCCESS)
+			addr_cache_release(s->t->addr_cache, svr_addr);
+		else if (s->t == write_local)
+			write_route_drop(s->host);
+		stream_fail(s);
+		stream_put(s);
+		return;
+	}
+	
+	ret = handle_pool_get(s->t->handles[ack ?
+		WRITE_RPC_STREAM_ACK : WRITE_RPC_STREAM], svr_addr, &handle);
+	assert(ret == HG_SUCCESS);
+	HG_Set_target_id(handle, s->target);
+	
+	ret = HG_Forward(handle, ack ? stream_append_ack_cb : stream_append_cb,
+		s, &in);
+	if (ret != HG_SUCCESS) {
+		write_invalidate(s->t, svr_addr);
+		HG_Destroy(handle);
+		addr_cache_release(s->t->addr_cache, svr_addr);
+		stream_fail(s);
+		stream_put(s);
+	}
+	stream_put(s);
+}
+
+write_ticket_t write_stream_append(struct write_stream *s, int32_t size,
+		void *buffer, void *arg) {
+	struct stream_record *record;
+	write_ticket_t ticket;
+	hg_size_t len = size;
+	int send;
+	int ret;
+	
+	pthread_mutex_lock(&s->lock);
+	if (s->next_seq - s->acked == s->window) {
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+	record = malloc(sizeof(*record));
+	assert(record);
+	record->stream = s;
+	record->state.cq = s->cq;
+	record->state.arg = arg;
+	record->state.ticket = __atomic_fetch_add(&s->cq->next_ticket, 1,
+		__ATOMIC_RELAXED);
+	ticket = record->state.ticket;
+	record->in.stream_id = s->id;
+	record->in.seq = s->next_seq;
+	record->in.size = size;
+	record->ack = (s->next_seq + 1) % s->ack_every == 0;
+	ret = HG_Bulk_create(s->t->hg_class, 1, &buffer, &len, HG_BULK_READ_ONLY,
+		&record->state.bulk_handle);
+	assert(ret == 0);
+	(void)ret;
+	record->in.bulk_handle = record->state.bulk_handle;
+	s->unacked[s->next_seq % s->window] = record;
+	s->next_seq++;
+	/* a broken stream sends nothing anymore */
+	send = s->ret == 0;
+	record->pending = send;
+	if (send)
+		s->refs++;
+	else
+		stream_complete(s, s->next_seq, s->ret);
+	pthread_mutex_unlock(&s->lock);
 	
+	if (send)
+		addr_cache_lookup(s->t->addr_cache, s->host, stream_lookup_cb,
+			record);
+	return ticket;
+}
+
+static hg_return_t stream_sync_cb(const struct hg_cb_info *info) {
+	struct stream_sync *sync = info->arg;
+	struct write_stream *s = sync->stream;
+	hg_handle_t handle = info->info.forward.handle;
+	hg_addr_t addr = HG_Get_info(handle)->addr;
+	int close = sync->in.close;
+	stream_ack_t out;
+	
+	if (info->ret != HG_SUCCESS ||
+			HG_Get_output(handle, &out) != HG_SUCCESS) {
+		write_invalidate(s->t, addr);
+		HG_Destroy(handle);
+		stream_fail(s);
+		sync->state.ret = -1;
+	} else {
+		stream_ack(s, &out);
+		/* short if a record was lost on the way */
+		sync->state.ret = out.acked >= sync->in.count ? out.ret : -1;
+		HG_Free_output(handle, &out);
+		handle_pool_put(s->t->handles[WRITE_RPC_STREAM_SYNC], addr, handle);
+	}
+	addr_cache_release(s->t->addr_cache, addr);
+	cq_push(&sync->state.cq->queue, &sync->state.node);
+	
+	if (close)
+		stream_put(s);
+	stream_put(s);
 	return HG_SUCCESS;
 }
 
+static void stream_sync_lookup_cb(hg_addr_t svr_addr, hg_return_t ret,
+		void *arg) {
+	struct stream_sync *sync = arg;
+	struct write_stream *s = sync->stream;
+	int close = sync->in.close;
+	hg_handle_t handle;
+	
+	if (ret == HG_SUCCESS) {
+		ret = handle_pool_get(s->t->handles[WRITE_RPC_STREAM_SYNC], svr_addr,
+			&handle);
+		assert(ret == HG_SUCCESS);
+		HG_Set_target_id(handle, s->target);
+		pthread_mutex_lock(&s->lock);
+		s->refs++;
+		pthread_mutex_unlock(&s->lock);
+		ret = HG_Forward(handle, stream_sync_cb, sync, &sync->in);
+		if (ret == HG_SUCCESS)
+			return;
+		write_invalidate(s->t, svr_addr);
+		HG_Destroy(handle);
+		addr_cache_release(s->t->addr_cache, svr_addr);
+		stream_put(s);
+	} else if (s->t == write_local)
+		write_route_drop(s->host);
+	
+	sync->state.ret = -1;
+	cq_push(&sync->state.cq->queue, &sync->state.node);
+	if (close)
+		stream_put(s);
+}
+
+static write_ticket_t stream_sync_submit(struct write_stream *s, void *arg,
+		int close) {
+	struct stream_sync *sync;
+	write_ticket_t ticket;
+	
+	sync = malloc(sizeof(*sync));
+	assert(sync);
+	sync->stream = s;
+	sync->state.cq = s->cq;
+	sync->state.arg = arg;
+	sync->state.ticket = __atomic_fetch_add(&s->cq->next_ticket, 1,
+		__ATOMIC_RELAXED);
+	ticket = sync->state.ticket;
+	sync->in.stream_id = s->id;
+	pthread_mutex_lock(&s->lock);
+	sync->in.count = s->next_seq;
+	pthread_mutex_unlock(&s->lock);
+	sync->in.close = close;
+	
+	addr_cache_lookup(s->t->addr_cache, s->host, stream_sync_lookup_cb,
+		sync);
+	return ticket;
+}
 
+write_ticket_t write_stream_flush(struct write_stream *s, void *arg) {
+	return stream_sync_submit(s, arg, 0);
+}
 
+write_ticket_t write_stream_close(struct write_stream *s, void *arg) {
+	return stream_sync_submit(s, arg, 1);
+}
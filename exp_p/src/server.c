@@ -1,3 +1,9 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
 #include <mercury_bulk.h>
 #include <mercury.h>
 #include <mercury_macros.h>
@@ -6,28 +12,52 @@
 #include <unistd.h>
 
 #include "rpc_write.h"
+#include "progress_driver.h"
 
 #define LOCAL_ADDR "tcp://localhost:1234"
+#define SM_ADDR "na+sm"
+#define MAX_CONTEXTS 64
+
+/* poll up to 50 us before blocking 100 ms in HG_Progress, 0 always blocks */
+#define PROGRESS_SPIN_US 50
+#define PROGRESS_BLOCK_MS 100
 
 na_class_t *network_class;
 hg_class_t *hg_class;
-hg_context_t *hg_context;
+hg_context_t *hg_contexts[MAX_CONTEXTS];
+struct progress_driver hg_progress_drivers[MAX_CONTEXTS];
+
+/* clients on this node, NULL if na+sm is not available */
+na_class_t *sm_network_class;
+hg_class_t *sm_hg_class;
+hg_context_t *sm_hg_context;
+struct progress_driver sm_progress_driver;
 
 hg_progress_shutdown_flag = 0;
 
-static void* hg_progress_fn(void * foo) {
-	hg_return_t ret;
-	unsigned int actual_count;
-	(void)foo;
+/* set by SIGINT and SIGTERM */
+static volatile sig_atomic_t hg_stop_flag = 0;
+
+static void hg_stop_fn(int sig) {
+	(void)sig;
+	hg_stop_flag = 1;
+}
+
+/* one progress thread per context, each kept on its own core */
+static void* hg_progress_fn(void * arg) {
+	struct progress_driver *driver = arg;
+	hg_context_t *hg_context = driver->context;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t cpuset;
+	
+	if (ncpus > 0) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(HG_Context_get_id(hg_context) % ncpus, &cpuset);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+	}
 	
 	while(!hg_progress_shutdown_flag) {
-		do {
-			ret = HG_Trigger(hg_context, 0, 1, &actual_count);
-		}while ((ret) == HG_SUCCESS && actual_count && !hg_progress_shutdown_flag);
-		
-		if (!hg_progress_shutdown_flag) {
-			HG_Progress(hg_context, 100);
-		}
+		progress_driver_step(driver);
 	}
 	
 	return NULL;
@@ -35,33 +65,111 @@ static void* hg_progress_fn(void * foo) {
 
 
 
-int main() {
+/* usage: server [contexts [spin_us [file [none|async|data]]]], clients
+ * pick a context with HG_Set_target_id(), writes are dropped unless a
+ * file is given */
+int main(int argc, char *argv[]) {
 	int ret;
-	pthread_t hg_progress_tid;
+	int i;
+	int ncontexts = argc > 1 ? atoi(argv[1]) : 1;
+	int spin_us = argc > 2 ? atoi(argv[2]) : PROGRESS_SPIN_US;
+	const char *sync = argc > 4 ? argv[4] : "none";
+	int sync_policy = -1;
+	pthread_t hg_progress_tid[MAX_CONTEXTS];
+	pthread_t sm_progress_tid;
+	struct na_init_info na_init_info = { 0 };
+	struct na_init_info sm_na_init_info = { 0 };
+	
+	if (strcmp(sync, "none") == 0)
+		sync_policy = WRITE_SYNC_NONE;
+	else if (strcmp(sync, "async") == 0)
+		sync_policy = WRITE_SYNC_ASYNC;
+	else if (strcmp(sync, "data") == 0)
+		sync_policy = WRITE_SYNC_DATA;
+	if (ncontexts < 1 || ncontexts > MAX_CONTEXTS || spin_us < 0 ||
+			sync_policy < 0) {
+		fprintf(stderr, "usage: %s [contexts (1 to %d) [spin_us "
+			"[file [none|async|data]]]]\n", argv[0], MAX_CONTEXTS);
+		return 1;
+	}
+	if (argc > 3 && write_set_target(argv[3], sync_policy) != 0) {
+		perror(argv[3]);
+		return 1;
+	}
 	
-	network_class = NA_Initialize(LOCAL_ADDR, NA_TRUE);
+	na_init_info.max_contexts = ncontexts;
+	network_class = NA_Initialize_opt(LOCAL_ADDR, NA_TRUE, &na_init_info);
 	assert(network_class);
 	
 	hg_class = HG_Init_na(network_class);
 	assert(hg_class);
 	
-	hg_context = HG_Context_create(hg_class);
-	assert(hg_context);
+	/* the RPCs are registered once on the class, handlers answer on the
+	 * context the request came in on */
+	for (i = 0; i < ncontexts; i++) {
+		hg_contexts[i] = HG_Context_create_id(hg_class, i);
+		assert(hg_contexts[i]);
+	}
+	write_register(hg_class, hg_contexts[0]);
 	
-	ret = pthread_create(&hg_progress_tid, NULL, hg_progress_fn, NULL);
-	assert(ret == 0);
-
-	write_register(hg_class, hg_context);
+	for (i = 0; i < ncontexts; i++) {
+		progress_driver_init(&hg_progress_drivers[i], hg_contexts[i],
+			spin_us, PROGRESS_BLOCK_MS);
+		ret = pthread_create(&hg_progress_tid[i], NULL, hg_progress_fn,
+			&hg_progress_drivers[i]);
+		assert(ret == 0);
+	}
+	
+	/* co-located clients skip loopback tcp, see write_register_local().
+	 * The context id follows the tcp ones, so that its thread gets a core
+	 * of its own. */
+	sm_na_init_info.max_contexts = ncontexts + 1;
+	sm_network_class = NA_Initialize_opt(SM_ADDR, NA_TRUE, &sm_na_init_info);
+	if (sm_network_class) {
+		sm_hg_class = HG_Init_na(sm_network_class);
+		assert(sm_hg_class);
+		sm_hg_context = HG_Context_create_id(sm_hg_class, ncontexts);
+		assert(sm_hg_context);
+		write_register_local(sm_hg_class, sm_hg_context);
+		progress_driver_init(&sm_progress_driver, sm_hg_context, spin_us,
+			PROGRESS_BLOCK_MS);
+		ret = pthread_create(&sm_progress_tid, NULL, hg_progress_fn,
+			&sm_progress_driver);
+		assert(ret == 0);
+		if (write_publish_local(LOCAL_ADDR) != 0)
+			fprintf(stderr, "could not publish the %s address\n",
+				SM_ADDR);
+	} else
+		fprintf(stderr, "%s unavailable, local clients use tcp\n",
+			SM_ADDR);
 	
-	printf("Listen to requests\n");
+	printf("Listen to requests on %d contexts%s\n", ncontexts,
+		sm_network_class ? " and shared memory" : "");
 	
-	while (1) {
+	signal(SIGINT, hg_stop_fn);
+	signal(SIGTERM, hg_stop_fn);
+	while (!hg_stop_flag) {
 		sleep(1);		
 	}
 	
+	/* before the sm class goes, clients fall back to tcp */
+	if (sm_network_class)
+		write_unpublish_local(LOCAL_ADDR);
 	hg_progress_shutdown_flag = 1;
-	ret = pthread_join(hg_progress_tid, NULL);
-	assert(ret == 0);
+	for (i = 0; i < ncontexts; i++) {
+		ret = pthread_join(hg_progress_tid[i], NULL);
+		assert(ret == 0);
+		progress_driver_print_stats(&hg_progress_drivers[i], stdout,
+			"progress");
+		HG_Context_destroy(hg_contexts[i]);
+	}
+	if (sm_network_class) {
+		ret = pthread_join(sm_progress_tid, NULL);
+		assert(ret == 0);
+		progress_driver_print_stats(&sm_progress_driver, stdout,
+			"progress (sm)");
+		HG_Context_destroy(sm_hg_context);
+	}
 	
 	return 0;
 }
@@ -0,0 +1,23 @@
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* CRC32C (Castagnoli), zlib conventions: start from 0 and feed the previous
+ * result back in to checksum a buffer piecewise. Uses the SSE4.2 crc32
+ * instruction when the CPU has it, slicing-by-8 tables otherwise. */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* CRC of A followed by B from crc1 = CRC(A), crc2 = CRC(B) and len2 = |B|.
+ *
+ * The result is linear in its inputs, so the CRC of a message received in
+ * pieces of any order is the XOR over the pieces of
+ * crc32c_combine(CRC(piece), 0, bytes following the piece). */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* "sse4.2" or "slicing-by-8" */
+const char *crc32c_impl(void);
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_ADMISSION_H
+#define HG_TEST_ADMISSION_H
+
+#include "mercury_types.h"
+
+/*************************************/
+/* Public Type and Struct Definition */
+/*************************************/
+
+/* Memory budget of the pipeline server. A transfer is admitted once its
+ * bytes fit in what the admitted ones left of the budget, later ones wait
+ * in arrival order and are admitted as the earlier ones release theirs.
+ * A transfer larger than the whole budget is admitted alone. */
+struct hg_test_admission;
+
+/* Embedded by the caller, must stay valid until func has been called */
+struct hg_test_admission_waiter {
+    void (*func)(struct hg_test_admission_waiter *waiter);
+    hg_uint64_t bytes;
+    struct hg_test_admission_waiter *next;
+};
+
+struct hg_test_admission_stats {
+    hg_uint64_t admitted;
+    hg_uint64_t deferred;   /* Of admitted, had to wait */
+    hg_uint64_t high_water; /* Max bytes admitted at once */
+    hg_uint64_t max_queued; /* Max transfers waiting at once */
+};
+
+/*********************/
+/* Public Prototypes */
+/*********************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hg_test_admission *
+hg_test_admission_create(hg_uint64_t budget);
+
+/**
+ * Nothing may be admitted or waiting anymore
+ */
+void
+hg_test_admission_destroy(struct hg_test_admission *admission);
+
+hg_uint64_t
+hg_test_admission_budget(struct hg_test_admission *admission);
+
+/**
+ * Returns HG_TRUE if the waiter->bytes are admitted right away, otherwise
+ * waiter->func is called from a later hg_test_admission_release()
+ */
+hg_bool_t
+hg_test_admission_acquire(struct hg_test_admission *admission,
+    struct hg_test_admission_waiter *waiter);
+
+/**
+ * Give back the bytes of an admitted transfer and run the waiters that fit
+ */
+void
+hg_test_admission_release(struct hg_test_admission *admission,
+    hg_uint64_t bytes);
+
+void
+hg_test_admission_get_stats(struct hg_test_admission *admission,
+    struct hg_test_admission_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_ADMISSION_H */
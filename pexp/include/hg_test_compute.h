@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_COMPUTE_H
+#define HG_TEST_COMPUTE_H
+
+#include "mercury_types.h"
+
+/*************************************/
+/* Public Type and Struct Definition */
+/*************************************/
+
+/* Compute stage run by the pipeline server on every chunk as soon as it is
+ * pulled (-X). Chunks land in any order, possibly on several threads, so
+ * the per-chunk results are merged with combine, which must be commutative
+ * and associative. The merged result is returned with the ack. */
+struct hg_test_compute {
+    const char *name;
+    hg_uint64_t identity;   /* Result of a transfer with no data */
+    /* Result of one chunk, a transform may rewrite buf in place */
+    hg_uint64_t (*chunk)(void *buf, size_t offset, size_t len);
+    hg_uint64_t (*combine)(hg_uint64_t a, hg_uint64_t b);
+};
+
+/*********************/
+/* Public Prototypes */
+/*********************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Make compute available to hg_test_compute_find(), compute must stay valid.
+ * Returns 0 on success, -1 if the name is taken or the table is full.
+ */
+int
+hg_test_compute_register(const struct hg_test_compute *compute);
+
+/**
+ * Registered or built-in compute stage called name, NULL if none. Built-ins:
+ *  - sum       sum of the bytes (reduction)
+ *  - max       largest byte (reduction)
+ *  - verify    bytes differing from the test pattern (filter)
+ *  - invert    complements the bytes in place, counts them (transform)
+ */
+const struct hg_test_compute *
+hg_test_compute_find(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_COMPUTE_H */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_EXECUTOR_H
+#define HG_TEST_EXECUTOR_H
+
+#include "mercury_types.h"
+
+/*************************************/
+/* Public Type and Struct Definition */
+/*************************************/
+
+/* Work-stealing executor: one worker pinned per core, each with its own
+ * deque. Tasks submitted from outside the executor are spread round-robin
+ * over the deques, tasks submitted by a worker go to its own deque. Owners
+ * run their deque newest first, idle workers steal the oldest task of
+ * another deque, and sleep when there is nothing left anywhere. */
+struct hg_test_executor;
+
+/* Embedded by the caller, must stay valid until func has been called */
+struct hg_test_task {
+    void (*func)(struct hg_test_task *task);
+};
+
+struct hg_test_executor_stats {
+    hg_uint64_t executed;
+    hg_uint64_t stolen;     /* Of executed, run by another worker */
+};
+
+/*********************/
+/* Public Prototypes */
+/*********************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Start nworkers workers, one per online core if 0
+ */
+struct hg_test_executor *
+hg_test_executor_create(unsigned int nworkers);
+
+/**
+ * Run what is queued and stop the workers
+ */
+void
+hg_test_executor_destroy(struct hg_test_executor *executor);
+
+unsigned int
+hg_test_executor_size(struct hg_test_executor *executor);
+
+/**
+ * Queue task, task->func runs later on one of the workers
+ */
+int
+hg_test_executor_submit(struct hg_test_executor *executor,
+    struct hg_test_task *task);
+
+void
+hg_test_executor_get_stats(struct hg_test_executor *executor,
+    struct hg_test_executor_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_EXECUTOR_H */
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_HIST_H
+#define HG_TEST_HIST_H
+
+#include "mercury_types.h"
+
+#include <stdio.h>
+
+/*************************************/
+/* Public Type and Struct Definition */
+/*************************************/
+
+/* Log-bucketed latency histogram: values are kept in ns, every power of two
+ * is split in HG_TEST_HIST_SUB_BUCKETS linear buckets, which bounds the
+ * error of a reported percentile to 1/HG_TEST_HIST_SUB_BUCKETS. */
+#define HG_TEST_HIST_SUB_BITS       4
+#define HG_TEST_HIST_SUB_BUCKETS    (1 << HG_TEST_HIST_SUB_BITS)
+#define HG_TEST_HIST_BUCKETS        (64 * HG_TEST_HIST_SUB_BUCKETS)
+
+struct hg_test_hist {
+    hg_uint64_t counts[HG_TEST_HIST_BUCKETS];
+    hg_uint64_t count;
+    hg_uint64_t min;    /* ns */
+    hg_uint64_t max;    /* ns */
+};
+
+/* Output formats of the perf tests (-F) */
+#define HG_TEST_OUTPUT_TEXT 0
+#define HG_TEST_OUTPUT_CSV  1
+#define HG_TEST_OUTPUT_JSON 2
+
+/* One result of measure_bulk_transfer */
+struct hg_test_perf_result {
+    unsigned int nhandles;
+    size_t size;
+    size_t iterations;
+    double bandwidth;   /* MB/s */
+    double latency;     /* Mean, ms */
+    double register_ms; /* HG_Bulk_create of the buffer, 0 if not measured */
+    double first_ms;    /* First transfer on the fresh buffer, ditto */
+};
+
+/*********************/
+/* Public Prototypes */
+/*********************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+hg_test_hist_reset(struct hg_test_hist *hist);
+
+/**
+ * Record one latency, in seconds
+ */
+void
+hg_test_hist_record(struct hg_test_hist *hist, double seconds);
+
+/**
+ * Latency under which p (0 to 100) percent of the recorded values are,
+ * in seconds
+ */
+double
+hg_test_hist_percentile(const struct hg_test_hist *hist, double p);
+
+/**
+ * Print the header expected before the results in the given format
+ */
+void
+hg_test_perf_print_header(FILE *stream, int format);
+
+/**
+ * Print one result with the percentiles of hist in the given format
+ */
+void
+hg_test_perf_print(FILE *stream, int format,
+    const struct hg_test_perf_result *result, const struct hg_test_hist *hist);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_HIST_H */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef HG_TEST_NUMA_H
+#define HG_TEST_NUMA_H
+
+#include "mercury_types.h"
+
+#include <stdio.h>
+
+/*************************************/
+/* Public Type and Struct Definition */
+/*************************************/
+
+/* NUMA placement (-N). Every progress context is given a node, its thread
+ * runs on the CPUs of that node and prefers its memory, and the bulk
+ * buffers it pulls into are allocated there. The topology comes from
+ * sysfs, the NIC is the interface carrying the listen address. */
+struct hg_test_numa;
+
+/*****************/
+/* Public Macros */
+/*****************/
+
+/* Policies, any value >= 0 puts every context on that node */
+#define HG_TEST_NUMA_OFF        (-1)    /* Leave placement to the kernel */
+#define HG_TEST_NUMA_NIC        (-2)    /* Every context on the NIC's node */
+#define HG_TEST_NUMA_SPREAD     (-3)    /* Round robin, from the NIC's node */
+#define HG_TEST_NUMA_INVALID    (-4)
+
+/*********************/
+/* Public Prototypes */
+/*********************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * "off", "nic", "spread" or a node number
+ */
+int
+hg_test_numa_parse(const char *arg);
+
+/**
+ * hostname is the address the NIC is found by, NULL for the first
+ * interface attached to a node. Returns NULL if the topology cannot be
+ * read or policy names a node that is not online.
+ */
+struct hg_test_numa *
+hg_test_numa_create(int policy, const char *hostname,
+    unsigned int context_count);
+
+void
+hg_test_numa_destroy(struct hg_test_numa *numa);
+
+/**
+ * One past the highest online node
+ */
+int
+hg_test_numa_node_count(struct hg_test_numa *numa);
+
+/**
+ * -1 if the NIC is not attached to a particular node
+ */
+int
+hg_test_numa_nic_node(struct hg_test_numa *numa);
+
+int
+hg_test_numa_context_node(struct hg_test_numa *numa, unsigned int context_id);
+
+/**
+ * Bind the calling thread to the node of context_id, best effort
+ */
+int
+hg_test_numa_bind_self(struct hg_test_numa *numa, unsigned int context_id);
+
+/**
+ * Count a transfer of bytes served by context_id, from any thread
+ */
+void
+hg_test_numa_account(struct hg_test_numa *numa, unsigned int context_id,
+    hg_uint64_t bytes);
+
+/**
+ * Contexts and traffic of each node used
+ */
+void
+hg_test_numa_print_stats(struct hg_test_numa *numa, FILE *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HG_TEST_NUMA_H */
@@ -21,6 +21,15 @@
 #include "mercury_atomic.h"
 
 #include "test_bulk.h"
+#include "bulk_pool.h"
+#include "hg_test_hist.h"
+#include "hg_test_verify.h"
+#include "crc32c.h"
+#include "hg_test_compute.h"
+#include "hg_test_executor.h"
+#include "hg_test_admission.h"
+#include "progress_driver.h"
+#include "hg_test_numa.h"
 
 /*************************************/
 /* Public Type and Struct Definition */
@@ -32,6 +41,30 @@ struct hg_test_info {
     hg_request_class_t *request_class;
     hg_addr_t target_addr;
     hg_bool_t auth;
+    hg_bool_t adaptive_pipeline;
+    hg_bool_t checksum;             /* Send a CRC32C of the payload */
+    const struct hg_test_compute *compute;  /* Run on pipelined chunks */
+    int workers;                    /* Executor size, 0 one per core, -1 none */
+    struct hg_test_executor *executor;  /* Processes pipelined chunks */
+    hg_uint64_t budget;             /* Bytes of pipelined transfers held at
+                                       once, 0 for no bound */
+    struct hg_test_admission *admission;    /* Enforces budget */
+    unsigned int context_count;     /* Server: contexts, client: targets */
+    int target_id;                  /* Client, -1 to spread over the targets */
+    hg_context_t **contexts;        /* Server, [0] is context */
+    unsigned int spin_us;           /* Poll this long before blocking */
+    int mem_backing;                /* BULK_MEM_* of bulk buffers */
+    hg_bool_t prefault;             /* Touch bulk buffers before registering */
+    int numa_policy;                /* HG_TEST_NUMA_* or a node */
+    struct hg_test_numa *numa;      /* NULL unless placing on NUMA nodes */
+    struct progress_driver *progress;   /* Client, behind request_class */
+    int output_format;              /* HG_TEST_OUTPUT_* */
+    const char *durable_path;       /* Pipelined writes go to this file */
+    int durable_sync;               /* HG_TEST_SYNC_* before each ack */
+    hg_bool_t direct_io;            /* Write aligned chunks with O_DIRECT */
+    int durable_fd;
+    int durable_direct_fd;          /* -1 if O_DIRECT is not used */
+    hg_uint64_t durable_offset;     /* Next free offset in the file */
     struct na_test_info na_test_info;
     unsigned int thread_count;
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
@@ -39,6 +72,10 @@ struct hg_test_info {
     hg_thread_mutex_t bulk_handle_mutex;
 #endif
     hg_bulk_t bulk_handle;
+    struct bulk_pool *bulk_pool;    /* Registered targets for bulk pulls */
+    struct bulk_pool **node_pools;  /* Server, with numa, per node used */
+    struct bulk_pool **context_pools;   /* Server, bulk_pool or the pool of
+                                           the context's node */
     hg_atomic_int32_t finalizing_count;
 };
 
@@ -47,6 +84,19 @@ struct hg_test_info {
 /*****************/
 
 #define MERCURY_TESTING_NUM_THREADS_DEFAULT 8
+#define MERCURY_TESTING_POOL_MIN_SIZE (1 << 12)
+#define MERCURY_TESTING_POOL_MAX_CACHED 16
+#define MERCURY_TESTING_MAX_CONTEXTS 64
+#define MERCURY_TESTING_DEFAULT_BUDGET \
+    (2 * 1024 * 1024 * (hg_uint64_t) MERCURY_TESTING_BUFFER_SIZE)
+
+/* Sync policy of the durable pipeline (-Y) */
+#define HG_TEST_SYNC_NONE       0   /* Ack once written to the page cache */
+#define HG_TEST_SYNC_FDATASYNC  1
+#define HG_TEST_SYNC_FSYNC      2
+
+/* O_DIRECT alignment of offsets, lengths and buffers */
+#define MERCURY_TESTING_DIRECT_ALIGN 4096
 
 /*********************/
 /* Public Prototypes */
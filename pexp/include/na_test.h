@@ -38,6 +38,7 @@ struct na_test_info {
     na_bool_t busy_wait;        /* Busy wait */
     na_bool_t verbose;          /* Verbose mode */
     int max_number_of_peers;    /* Max number of peers */
+    int max_contexts;           /* Max contexts, 0 for 1 */
 #ifdef MERCURY_HAS_PARALLEL_TESTING
     MPI_Comm mpi_comm;          /* MPI comm */
     na_bool_t mpi_no_finalize;  /* Prevent from finalizing MPI */
@@ -13,6 +13,10 @@
 
 #include "mercury_macros.h"
 
+/* bulk_write_in_t checksum_type, the checksum covers the whole transfer */
+#define HG_TEST_CHECKSUM_NONE   0
+#define HG_TEST_CHECKSUM_CRC32C 1
+
 /* Dummy function that needs to be shipped */
 /* size_t bulk_write(int fildes, const void *buf, size_t nbyte); */
 
@@ -21,12 +25,18 @@
  * MERCURY_GEN_PROC( struct_type_name, fields )
  */
 MERCURY_GEN_PROC(bulk_write_in_t,
-        ((hg_int32_t)(fildes)) ((hg_bulk_t)(bulk_handle)))
-MERCURY_GEN_PROC(bulk_write_out_t, ((hg_uint64_t)(ret)))
+        ((hg_int32_t)(fildes)) ((hg_uint32_t)(checksum_type))
+        ((hg_uint32_t)(checksum)) ((hg_bulk_t)(bulk_handle)))
+MERCURY_GEN_PROC(bulk_write_out_t, ((hg_uint64_t)(ret))
+        ((hg_uint64_t)(chunk_size)) ((hg_uint32_t)(pipeline_size))
+        ((hg_uint64_t)(compute_result)) ((hg_uint64_t)(compute_time))
+        ((hg_uint64_t)(budget)))
 #else
 /* Define bulk_write_in_t */
 typedef struct {
     hg_int32_t fildes;
+    hg_uint32_t checksum_type;  /* HG_TEST_CHECKSUM_* */
+    hg_uint32_t checksum;
     hg_bulk_t bulk_handle;
 } bulk_write_in_t;
 
@@ -43,6 +53,18 @@ hg_proc_bulk_write_in_t(hg_proc_t proc, void *data)
         return ret;
     }
 
+    ret = hg_proc_uint32_t(proc, &struct_data->checksum_type);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
+    ret = hg_proc_uint32_t(proc, &struct_data->checksum);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
     ret = hg_proc_hg_bulk_t(proc, &struct_data->bulk_handle);
     if (ret != HG_SUCCESS) {
         HG_LOG_ERROR("Proc error");
@@ -55,6 +77,11 @@ hg_proc_bulk_write_in_t(hg_proc_t proc, void *data)
 /* Define bulk_write_out_t */
 typedef struct {
     hg_uint64_t ret;
+    hg_uint64_t chunk_size;     /* Pipeline chunk size used at completion */
+    hg_uint32_t pipeline_size;  /* Chunks in flight used at completion */
+    hg_uint64_t compute_result; /* Of the server's compute stage, if any */
+    hg_uint64_t compute_time;   /* ns spent in it, summed over the chunks */
+    hg_uint64_t budget;         /* Server memory budget, 0 if unbounded */
 } bulk_write_out_t;
 
 /* Define hg_proc_bulk_write_out_t */
@@ -70,6 +97,36 @@ hg_proc_bulk_write_out_t(hg_proc_t proc, void *data)
         return ret;
     }
 
+    ret = hg_proc_uint64_t(proc, &struct_data->chunk_size);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
+    ret = hg_proc_uint32_t(proc, &struct_data->pipeline_size);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
+    ret = hg_proc_uint64_t(proc, &struct_data->compute_result);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
+    ret = hg_proc_uint64_t(proc, &struct_data->compute_time);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
+    ret = hg_proc_uint64_t(proc, &struct_data->budget);
+    if (ret != HG_SUCCESS) {
+        HG_LOG_ERROR("Proc error");
+        return ret;
+    }
+
     return ret;
 }
 #endif
@@ -30,6 +30,11 @@ struct hg_test_pipeline_args {
 	hg_request_t *request;
 	unsigned int op_count;
 	hg_atomic_int32_t op_completed_count;
+	hg_uint64_t chunk_size;		/* Operating point reported by server */
+	hg_uint32_t pipeline_size;
+	hg_uint64_t compute_result;	/* Of the server's compute stage */
+	hg_uint64_t compute_time;	/* ns */
+	hg_uint64_t budget;		/* Server memory budget, 0 if unbounded */
 };
 
 	static hg_return_t
@@ -37,6 +42,17 @@ hg_test_pipeline_forward_cb(const struct hg_cb_info *callback_info)
 {
 	struct hg_test_pipeline_args *args =
 		(struct hg_test_pipeline_args *) callback_info->arg;
+	bulk_write_out_t out_struct;
+
+	if (HG_Get_output(callback_info->info.forward.handle, &out_struct)
+			== HG_SUCCESS) {
+		args->chunk_size = out_struct.chunk_size;
+		args->pipeline_size = out_struct.pipeline_size;
+		args->compute_result = out_struct.compute_result;
+		args->compute_time = out_struct.compute_time;
+		args->budget = out_struct.budget;
+		HG_Free_output(callback_info->info.forward.handle, &out_struct);
+	}
 
 	if ((unsigned int) hg_atomic_incr32(&args->op_completed_count)
 			== args->op_count) {
@@ -51,7 +67,8 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 		unsigned int nhandles)
 {
 	bulk_write_in_t in_struct;
-	char *bulk_buf;
+	char *bulk_buf = NULL;
+	int backing = hg_test_info->mem_backing;
 	void **buf_ptrs;
 	size_t *buf_sizes;
 	hg_bulk_t bulk_handle = HG_BULK_NULL;
@@ -66,13 +83,25 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	size_t avg_iter;
 	double time_read = 0, read_bandwidth;
 	double read_latency;
+	double alloc_time, register_time, first_time = 0;
+	hg_time_t start, end;
+	struct hg_test_hist hist;
+	struct hg_test_perf_result result;
+	int text = hg_test_info->output_format == HG_TEST_OUTPUT_TEXT;
 	hg_return_t ret = HG_SUCCESS;
 	size_t i;
 
-	/* Prepare bulk_buf */
-	bulk_buf = malloc(nbytes);
-	for (i = 0; i < nbytes; i++)
-		bulk_buf[i] = (char) i;
+	/* Prepare bulk_buf, the fill is where the pages get faulted in unless
+	 * they were prefaulted */
+	hg_time_get_current(&start);
+	bulk_buf = bulk_mem_alloc(nbytes, &backing, hg_test_info->prefault);
+	if (bulk_buf == NULL) {
+		fprintf(stderr, "Could not allocate bulk buffer\n");
+		return HG_NOMEM_ERROR;
+	}
+	hg_test_pattern_fill(bulk_buf, 0, nbytes);
+	hg_time_get_current(&end);
+	alloc_time = hg_time_to_double(hg_time_subtract(end, start));
 	buf_ptrs = (void **) &bulk_buf;
 	buf_sizes = &nbytes;
 
@@ -85,27 +114,51 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 			fprintf(stderr, "Could not start call\n");
 			goto done;
 		}
+		/* Target a given context of the server or spread over them */
+		if (hg_test_info->target_id >= 0)
+			HG_Set_target_id(handles[i],
+					(hg_uint8_t) hg_test_info->target_id);
+		else if (hg_test_info->context_count > 1)
+			HG_Set_target_id(handles[i],
+					(hg_uint8_t) (i % hg_test_info->context_count));
 	}
 
 	request = hg_request_create(hg_test_info->request_class);
 	hg_atomic_init32(&args.op_completed_count, 0);
 	args.op_count = nhandles;
+	args.chunk_size = 0;
+	args.pipeline_size = 0;
+	args.compute_result = 0;
+	args.compute_time = 0;
+	args.budget = 0;
 	args.request = request;
 
 	/* Register memory */
+	hg_time_get_current(&start);
 	ret = HG_Bulk_create(hg_test_info->hg_class, 1, buf_ptrs,
 			(hg_size_t *) buf_sizes, HG_BULK_READ_ONLY, &bulk_handle);
 	if (ret != HG_SUCCESS) {
 		fprintf(stderr, "Could not create bulk data handle\n");
 		goto done;
 	}
+	hg_time_get_current(&end);
+	register_time = hg_time_to_double(hg_time_subtract(end, start));
 
 	/* Fill input structure */
 	in_struct.fildes = 0;
+	if (hg_test_info->checksum) {
+		in_struct.checksum_type = HG_TEST_CHECKSUM_CRC32C;
+		in_struct.checksum = crc32c(0, bulk_buf, nbytes);
+	} else {
+		in_struct.checksum_type = HG_TEST_CHECKSUM_NONE;
+		in_struct.checksum = 0;
+	}
 	in_struct.bulk_handle = bulk_handle;
 
-	/* Warm up for bulk data */
+	/* Warm up for bulk data, the first transfer also pays for whatever
+	 * the transport sets up lazily on a fresh buffer */
 	skip = 1;
+	hg_time_get_current(&start);
 	for (i = 0; i < skip; i++) {
 		unsigned int j;
 
@@ -121,9 +174,14 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 		hg_request_wait(request, HG_MAX_IDLE_TIME, NULL);
 		hg_request_reset(request);
 		hg_atomic_set32(&args.op_completed_count, 0);
+		if (i == 0) {
+			hg_time_get_current(&end);
+			first_time = hg_time_to_double(hg_time_subtract(end, start));
+		}
 	}
 
 	NA_Test_barrier(&hg_test_info->na_test_info);
+	hg_test_hist_reset(&hist);
 
 	/* Bulk data benchmark */
 	for (avg_iter = 0; avg_iter < loop; avg_iter++) {
@@ -144,6 +202,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 		NA_Test_barrier(&hg_test_info->na_test_info);
 		hg_time_get_current(&t2);
 		time_read += hg_time_to_double(hg_time_subtract(t2, t1));
+		hg_test_hist_record(&hist, hg_time_to_double(hg_time_subtract(t2, t1)));
 
 		hg_request_reset(request);
 		hg_atomic_set32(&args.op_completed_count, 0);
@@ -157,7 +216,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 
 
 		/* At this point we have received everything so work out the bandwidth */
-		if (hg_test_info->na_test_info.mpi_comm_rank == 0)
+		if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text)
 			fprintf(stdout, "%-*d%*.*f%*.*f\r", 10, (int) nbytes, NWIDTH,
 					NDIGITS, read_bandwidth, NWIDTH, NDIGITS, read_latency);
 		//#endif
@@ -170,11 +229,39 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	read_latency = time_read * 1000 / (avg_iter + 1);
 
 	/* At this point we have received everything so work out the bandwidth */
+	result.nhandles = nhandles;
+	result.size = nbytes;
+	result.iterations = avg_iter;
+	result.bandwidth = read_bandwidth;
+	result.latency = read_latency;
+	result.register_ms = register_time * 1000;
+	result.first_ms = first_time * 1000;
 	if (hg_test_info->na_test_info.mpi_comm_rank == 0)
-		fprintf(stdout, "%-*d%*.*f%*.*f", 10, (int) nbytes, NWIDTH, NDIGITS,
-				read_bandwidth, NWIDTH, NDIGITS, read_latency);
+		hg_test_perf_print(stdout, hg_test_info->output_format, &result,
+				&hist);
 	//#endif
-	if (hg_test_info->na_test_info.mpi_comm_rank == 0) fprintf(stdout, "\n");
+	if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text
+			&& hg_test_info->na_test_info.verbose)
+		fprintf(stdout, "# Memory: %s pages%s, alloc+fill %.3f ms, "
+				"registration %.3f ms, first transfer %.3f ms\n",
+				bulk_mem_name(backing),
+				hg_test_info->prefault ? " prefaulted" : "",
+				alloc_time * 1000, register_time * 1000,
+				first_time * 1000);
+	if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text
+			&& hg_test_info->na_test_info.verbose)
+		fprintf(stdout, "# Pipeline: %lu KB chunks, %u in flight\n",
+				(unsigned long) (args.chunk_size / 1024), args.pipeline_size);
+	if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text
+			&& hg_test_info->na_test_info.verbose && args.budget)
+		fprintf(stdout, "# Server budget: %lu MB for %lu MB in flight\n",
+				(unsigned long) (args.budget >> 20),
+				(unsigned long) ((nbytes * nhandles) >> 20));
+	if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text
+			&& hg_test_info->na_test_info.verbose && args.compute_time)
+		fprintf(stdout, "# Compute: result %llu, %.3f ms per transfer\n",
+				(unsigned long long) args.compute_result,
+				(double) args.compute_time / 1e6);
 
 	/* Free memory handle */
 	ret = HG_Bulk_free(bulk_handle);
@@ -194,7 +281,8 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	}
 
 done:
-	free(bulk_buf);
+	if (bulk_buf)
+		bulk_mem_free(bulk_buf, nbytes, backing);
 	free(handles);
 	return ret;
 }
@@ -206,24 +294,28 @@ main(int argc, char *argv[])
 	struct hg_test_info hg_test_info = { 0 };
 	unsigned int nhandles;
 	size_t size;
+	int text;
 
 	HG_Test_init(argc, argv, &hg_test_info);
 
+	text = hg_test_info.output_format == HG_TEST_OUTPUT_TEXT;
+	if (hg_test_info.na_test_info.mpi_comm_rank == 0 && !text)
+		hg_test_perf_print_header(stdout, hg_test_info.output_format);
+
 	for (nhandles = 1; nhandles <= MAX_HANDLES; nhandles *= 2) {
-		if (hg_test_info.na_test_info.mpi_comm_rank == 0) {
+		if (hg_test_info.na_test_info.mpi_comm_rank == 0 && text) {
 			fprintf(stdout, "# RPC Write Performance\n");
 			fprintf(stdout, "# Loop %d times from size %d to %d byte(s) with "
 					"%u handle(s)\n",
 					hg_test_info.na_test_info.loop, 1, MAX_MSG_SIZE, nhandles);
-			fprintf(stdout, "%-*s%*s%*s\n", 10, "# Size", NWIDTH,
-					"Bandwidth (MB/s)", NWIDTH, "Latency (ms)");
-			fflush(stdout);
+			hg_test_perf_print_header(stdout, HG_TEST_OUTPUT_TEXT);
 		}
 
 		for (size = 512 * 1024 * 1024; size <= MAX_MSG_SIZE; size *= 2)
 			measure_bulk_transfer(&hg_test_info, size, nhandles);
 
-		fprintf(stdout, "\n");
+		if (text)
+			fprintf(stdout, "\n");
 	}
 
 	HG_Test_finalize(&hg_test_info);
@@ -0,0 +1,181 @@
+
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78U
+
+/* the hardware path runs lanes of this size in parallel to hide the
+ * latency of the crc32 instruction */
+#define CRC32C_LANE 4096
+
+static uint32_t crc32c_table[8][256];
+static uint32_t crc32c_x2n_table[32];	// x^(2^n) mod p
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static int crc32c_hw;
+
+/* a * b mod p, reflected */
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+	uint32_t m = 1U << 31, p = 0;
+	
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/* x^(n * 2^k) mod p */
+static uint32_t x2nmodp(uint64_t n, unsigned int k) {
+	uint32_t p = 1U << 31;	// x^0
+	
+	while (n) {
+		if (n & 1)
+			p = multmodp(crc32c_x2n_table[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void crc32c_init(void) {
+	uint32_t crc, p;
+	int i, j;
+	
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++) {
+		crc = crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32c_table[j][i] = crc;
+		}
+	}
+	
+	p = 1U << 30;	// x^1
+	crc32c_x2n_table[0] = p;
+	for (i = 1; i < 32; i++)
+		crc32c_x2n_table[i] = p = multmodp(p, p);
+	
+#ifdef CRC32C_X86
+	__builtin_cpu_init();
+	crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+	uint64_t word;
+	
+	while (len && ((uintptr_t)p & 7)) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		__builtin_memcpy(&word, p, 8);
+#else
+		word = (uint64_t)p[0] | (uint64_t)p[1] << 8 |
+			(uint64_t)p[2] << 16 | (uint64_t)p[3] << 24 |
+			(uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+			(uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+#endif
+		word ^= crc;
+		crc = crc32c_table[7][word & 0xff] ^
+			crc32c_table[6][(word >> 8) & 0xff] ^
+			crc32c_table[5][(word >> 16) & 0xff] ^
+			crc32c_table[4][(word >> 24) & 0xff] ^
+			crc32c_table[3][(word >> 32) & 0xff] ^
+			crc32c_table[2][(word >> 40) & 0xff] ^
+			crc32c_table[1][(word >> 48) & 0xff] ^
+			crc32c_table[0][word >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw_run(uint32_t crc, const unsigned char *p,
+		size_t len) {
+	uint64_t c0, c1, c2;
+	uint64_t w;
+	uint32_t shift = 0;
+	size_t i;
+	
+	while (len && ((uintptr_t)p & 7)) {
+		crc = _mm_crc32_u8(crc, *p++);
+		len--;
+	}
+	
+	/* three independent lanes, stitched back with the CRC of x^lane */
+	while (len >= 3 * CRC32C_LANE) {
+		if (!shift)
+			shift = x2nmodp(CRC32C_LANE, 3);
+		c0 = crc;
+		c1 = 0;
+		c2 = 0;
+		for (i = 0; i < CRC32C_LANE; i += 8) {
+			__builtin_memcpy(&w, p + i, 8);
+			c0 = _mm_crc32_u64(c0, w);
+			__builtin_memcpy(&w, p + CRC32C_LANE + i, 8);
+			c1 = _mm_crc32_u64(c1, w);
+			__builtin_memcpy(&w, p + 2 * CRC32C_LANE + i, 8);
+			c2 = _mm_crc32_u64(c2, w);
+		}
+		crc = multmodp(shift, multmodp(shift, (uint32_t)c0) ^
+			(uint32_t)c1) ^ (uint32_t)c2;
+		p += 3 * CRC32C_LANE;
+		len -= 3 * CRC32C_LANE;
+	}
+	
+	c0 = crc;
+	while (len >= 8) {
+		__builtin_memcpy(&w, p, 8);
+		c0 = _mm_crc32_u64(c0, w);
+		p += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)c0;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+	pthread_once(&crc32c_once, crc32c_init);
+	crc = ~crc;
+#ifdef CRC32C_X86
+	if (crc32c_hw)
+		return ~crc32c_hw_run(crc, buf, len);
+#endif
+	return ~crc32c_sw(crc, buf, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+	pthread_once(&crc32c_once, crc32c_init);
+	return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+const char *crc32c_impl(void) {
+	pthread_once(&crc32c_once, crc32c_init);
+	return crc32c_hw ? "sse4.2" : "slicing-by-8";
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#include "hg_test_admission.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/************************************/
+/* Local Type and Struct Definition */
+/************************************/
+
+struct hg_test_admission {
+    pthread_mutex_t mutex;
+    hg_uint64_t budget;
+    hg_uint64_t used;           /* Bytes of the admitted transfers */
+    struct hg_test_admission_waiter *head;  /* FIFO of waiting transfers */
+    struct hg_test_admission_waiter *tail;
+    hg_uint64_t queued;
+    struct hg_test_admission_stats stats;
+};
+
+/*---------------------------------------------------------------------------*/
+/* Called with the mutex held */
+static HG_INLINE hg_bool_t
+hg_test_admission_fits(struct hg_test_admission *admission, hg_uint64_t bytes)
+{
+    return admission->used == 0 || admission->used + bytes <= admission->budget;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Called with the mutex held */
+static HG_INLINE void
+hg_test_admission_take(struct hg_test_admission *admission, hg_uint64_t bytes)
+{
+    admission->used += bytes;
+    admission->stats.admitted++;
+    if (admission->used > admission->stats.high_water)
+        admission->stats.high_water = admission->used;
+}
+
+/*---------------------------------------------------------------------------*/
+struct hg_test_admission *
+hg_test_admission_create(hg_uint64_t budget)
+{
+    struct hg_test_admission *admission;
+
+    admission = (struct hg_test_admission *) calloc(1,
+        sizeof(struct hg_test_admission));
+    if (!admission)
+        return NULL;
+    pthread_mutex_init(&admission->mutex, NULL);
+    admission->budget = budget;
+
+    return admission;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_admission_destroy(struct hg_test_admission *admission)
+{
+    if (!admission)
+        return;
+    pthread_mutex_destroy(&admission->mutex);
+    free(admission);
+}
+
+/*---------------------------------------------------------------------------*/
+hg_uint64_t
+hg_test_admission_budget(struct hg_test_admission *admission)
+{
+    return admission->budget;
+}
+
+/*---------------------------------------------------------------------------*/
+hg_bool_t
+hg_test_admission_acquire(struct hg_test_admission *admission,
+    struct hg_test_admission_waiter *waiter)
+{
+    hg_bool_t admitted;
+
+    pthread_mutex_lock(&admission->mutex);
+    /* Do not overtake the ones already waiting */
+    admitted = !admission->head
+        && hg_test_admission_fits(admission, waiter->bytes);
+    if (admitted)
+        hg_test_admission_take(admission, waiter->bytes);
+    else {
+        waiter->next = NULL;
+        if (admission->tail)
+            admission->tail->next = waiter;
+        else
+            admission->head = waiter;
+        admission->tail = waiter;
+        admission->stats.deferred++;
+        if (++admission->queued > admission->stats.max_queued)
+            admission->stats.max_queued = admission->queued;
+    }
+    pthread_mutex_unlock(&admission->mutex);
+
+    return admitted;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_admission_release(struct hg_test_admission *admission,
+    hg_uint64_t bytes)
+{
+    struct hg_test_admission_waiter *ready = NULL, **last = &ready;
+    struct hg_test_admission_waiter *waiter;
+
+    pthread_mutex_lock(&admission->mutex);
+    admission->used -= bytes;
+    while ((waiter = admission->head)
+        && hg_test_admission_fits(admission, waiter->bytes)) {
+        admission->head = waiter->next;
+        if (!admission->head)
+            admission->tail = NULL;
+        admission->queued--;
+        hg_test_admission_take(admission, waiter->bytes);
+        *last = waiter;
+        last = &waiter->next;
+    }
+    *last = NULL;
+    pthread_mutex_unlock(&admission->mutex);
+
+    /* Outside the lock, a waiter may release right away */
+    while ((waiter = ready)) {
+        ready = waiter->next;
+        waiter->func(waiter);
+    }
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_admission_get_stats(struct hg_test_admission *admission,
+    struct hg_test_admission_stats *stats)
+{
+    pthread_mutex_lock(&admission->mutex);
+    *stats = admission->stats;
+    pthread_mutex_unlock(&admission->mutex);
+}
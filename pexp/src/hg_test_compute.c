@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#include "hg_test_compute.h"
+#include "hg_test_verify.h"
+
+#include <string.h>
+
+/****************/
+/* Local Macros */
+/****************/
+
+#define HG_TEST_COMPUTE_MAX 16
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_add(hg_uint64_t a, hg_uint64_t b)
+{
+    return a + b;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_max(hg_uint64_t a, hg_uint64_t b)
+{
+    return a > b ? a : b;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_sum_chunk(void *buf, size_t offset, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    hg_uint64_t sum = 0;
+    size_t i;
+
+    (void) offset;
+    for (i = 0; i < len; i++)
+        sum += p[i];
+    return sum;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_max_chunk(void *buf, size_t offset, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    unsigned char max = 0;
+    size_t i;
+
+    (void) offset;
+    for (i = 0; i < len; i++)
+        max = p[i] > max ? p[i] : max;
+    return max;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_verify_chunk(void *buf, size_t offset, size_t len)
+{
+    const char *p = (const char *) buf;
+    hg_uint64_t mismatches = 0;
+    size_t i = 0;
+
+    while ((i += hg_test_pattern_check(p + i, offset + i, len - i)) < len) {
+        mismatches++;
+        i++;
+    }
+    return mismatches;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_uint64_t
+hg_test_compute_invert_chunk(void *buf, size_t offset, size_t len)
+{
+    unsigned char *p = (unsigned char *) buf;
+    size_t i;
+
+    (void) offset;
+    for (i = 0; i < len; i++)
+        p[i] = (unsigned char) ~p[i];
+    return len;
+}
+
+/*******************/
+/* Local Variables */
+/*******************/
+
+static const struct hg_test_compute hg_test_compute_builtin_g[] = {
+    { "sum", 0, hg_test_compute_sum_chunk, hg_test_compute_add },
+    { "max", 0, hg_test_compute_max_chunk, hg_test_compute_max },
+    { "verify", 0, hg_test_compute_verify_chunk, hg_test_compute_add },
+    { "invert", 0, hg_test_compute_invert_chunk, hg_test_compute_add }
+};
+
+/* Registered at startup, before the server takes requests */
+static const struct hg_test_compute *hg_test_compute_g[HG_TEST_COMPUTE_MAX];
+static unsigned int hg_test_compute_count_g = 0;
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_compute_register(const struct hg_test_compute *compute)
+{
+    if (hg_test_compute_count_g == HG_TEST_COMPUTE_MAX
+        || hg_test_compute_find(compute->name))
+        return -1;
+    hg_test_compute_g[hg_test_compute_count_g++] = compute;
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+const struct hg_test_compute *
+hg_test_compute_find(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < hg_test_compute_count_g; i++)
+        if (strcmp(hg_test_compute_g[i]->name, name) == 0)
+            return hg_test_compute_g[i];
+    for (i = 0; i < sizeof(hg_test_compute_builtin_g)
+        / sizeof(hg_test_compute_builtin_g[0]); i++)
+        if (strcmp(hg_test_compute_builtin_g[i].name, name) == 0)
+            return &hg_test_compute_builtin_g[i];
+    return NULL;
+}
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "hg_test_executor.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/****************/
+/* Local Macros */
+/****************/
+
+#define HG_TEST_DEQUE_INIT_SIZE 256 /* Power of two */
+
+/************************************/
+/* Local Type and Struct Definition */
+/************************************/
+
+/* Ring of tasks, the owner pushes and pops at the bottom, thieves take from
+ * the top. A lock per deque is uncontended but for steals. */
+struct hg_test_deque {
+    pthread_spinlock_t lock;
+    struct hg_test_task **tasks;
+    unsigned long mask;
+    unsigned long top;
+    unsigned long bottom;
+} __attribute__((aligned(64)));
+
+struct hg_test_worker {
+    struct hg_test_deque deque;
+    struct hg_test_executor *executor;
+    pthread_t thread;
+    int started;
+    unsigned int id;
+    unsigned int seed;
+    hg_uint64_t executed;
+    hg_uint64_t stolen;
+};
+
+struct hg_test_executor {
+    struct hg_test_worker *workers;
+    unsigned int nworkers;
+    unsigned int next;          /* Round-robin for outside submissions */
+    long pending;               /* Queued, not yet taken */
+    unsigned int sleepers;
+    int shutdown;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+/* Worker of the calling thread, NULL outside of the executors */
+static __thread struct hg_test_worker *hg_test_worker_self_g = NULL;
+
+/*---------------------------------------------------------------------------*/
+static int
+hg_test_deque_init(struct hg_test_deque *deque)
+{
+    deque->tasks = malloc(HG_TEST_DEQUE_INIT_SIZE * sizeof(*deque->tasks));
+    if (!deque->tasks)
+        return -1;
+    deque->mask = HG_TEST_DEQUE_INIT_SIZE - 1;
+    deque->top = deque->bottom = 0;
+    pthread_spin_init(&deque->lock, PTHREAD_PROCESS_PRIVATE);
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_deque_fini(struct hg_test_deque *deque)
+{
+    pthread_spin_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+hg_test_deque_push(struct hg_test_deque *deque, struct hg_test_task *task)
+{
+    pthread_spin_lock(&deque->lock);
+    if (deque->bottom - deque->top > deque->mask) {
+        /* Full, double it keeping the indices valid */
+        unsigned long size = (deque->mask + 1) * 2, i;
+        struct hg_test_task **tasks = malloc(size * sizeof(*tasks));
+
+        if (!tasks) {
+            pthread_spin_unlock(&deque->lock);
+            return -1;
+        }
+        for (i = deque->top; i != deque->bottom; i++)
+            tasks[i & (size - 1)] = deque->tasks[i & deque->mask];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->mask = size - 1;
+    }
+    deque->tasks[deque->bottom & deque->mask] = task;
+    __atomic_store_n(&deque->bottom, deque->bottom + 1, __ATOMIC_RELAXED);
+    pthread_spin_unlock(&deque->lock);
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct hg_test_task *
+hg_test_deque_pop(struct hg_test_deque *deque)
+{
+    struct hg_test_task *task = NULL;
+
+    pthread_spin_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        __atomic_store_n(&deque->bottom, deque->bottom - 1, __ATOMIC_RELAXED);
+        task = deque->tasks[deque->bottom & deque->mask];
+    }
+    pthread_spin_unlock(&deque->lock);
+    return task;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct hg_test_task *
+hg_test_deque_steal(struct hg_test_deque *deque)
+{
+    struct hg_test_task *task = NULL;
+
+    /* Cheap check first, do not bother the owner for an empty deque */
+    if (__atomic_load_n(&deque->bottom, __ATOMIC_RELAXED)
+        == __atomic_load_n(&deque->top, __ATOMIC_RELAXED))
+        return NULL;
+    if (pthread_spin_trylock(&deque->lock) != 0)
+        return NULL;
+    if (deque->bottom != deque->top) {
+        task = deque->tasks[deque->top & deque->mask];
+        __atomic_store_n(&deque->top, deque->top + 1, __ATOMIC_RELAXED);
+    }
+    pthread_spin_unlock(&deque->lock);
+    return task;
+}
+
+/*---------------------------------------------------------------------------*/
+static struct hg_test_task *
+hg_test_worker_next(struct hg_test_worker *worker)
+{
+    struct hg_test_executor *executor = worker->executor;
+    struct hg_test_task *task;
+    unsigned int i, victim;
+
+    task = hg_test_deque_pop(&worker->deque);
+    if (task)
+        return task;
+
+    /* Start from a random victim so thieves spread out */
+    victim = (unsigned int) rand_r(&worker->seed);
+    for (i = 0; i < executor->nworkers; i++) {
+        struct hg_test_worker *other =
+            &executor->workers[(victim + i) % executor->nworkers];
+
+        if (other == worker)
+            continue;
+        task = hg_test_deque_steal(&other->deque);
+        if (task) {
+            __atomic_add_fetch(&worker->stolen, 1, __ATOMIC_RELAXED);
+            return task;
+        }
+    }
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *
+hg_test_worker_run(void *arg)
+{
+    struct hg_test_worker *worker = (struct hg_test_worker *) arg;
+    struct hg_test_executor *executor = worker->executor;
+    struct hg_test_task *task;
+    unsigned int spins = 0;
+
+    hg_test_worker_self_g = worker;
+
+    for (;;) {
+        task = hg_test_worker_next(worker);
+        if (task) {
+            __atomic_sub_fetch(&executor->pending, 1, __ATOMIC_SEQ_CST);
+            task->func(task);
+            __atomic_add_fetch(&worker->executed, 1, __ATOMIC_RELAXED);
+            spins = 0;
+            continue;
+        }
+
+        /* A task may still be on its way, or held in a deque being
+         * stolen from, keep looking a little before sleeping */
+        if (__atomic_load_n(&executor->pending, __ATOMIC_SEQ_CST) > 0
+            || ++spins < 64) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&executor->mutex);
+        __atomic_add_fetch(&executor->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&executor->pending, __ATOMIC_SEQ_CST) == 0
+            && !executor->shutdown)
+            pthread_cond_wait(&executor->cond, &executor->mutex);
+        __atomic_sub_fetch(&executor->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (executor->shutdown
+            && __atomic_load_n(&executor->pending, __ATOMIC_SEQ_CST) == 0) {
+            pthread_mutex_unlock(&executor->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&executor->mutex);
+        spins = 0;
+    }
+
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+struct hg_test_executor *
+hg_test_executor_create(unsigned int nworkers)
+{
+    struct hg_test_executor *executor;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int i;
+
+    if (ncpus < 1)
+        ncpus = 1;
+    if (nworkers == 0)
+        nworkers = (unsigned int) ncpus;
+
+    executor = calloc(1, sizeof(*executor));
+    if (!executor)
+        return NULL;
+    executor->workers = calloc(nworkers, sizeof(*executor->workers));
+    if (!executor->workers) {
+        free(executor);
+        return NULL;
+    }
+    pthread_mutex_init(&executor->mutex, NULL);
+    pthread_cond_init(&executor->cond, NULL);
+
+    /* Workers steal from each other, set up every deque before any starts */
+    for (i = 0; i < nworkers; i++) {
+        struct hg_test_worker *worker = &executor->workers[i];
+
+        worker->executor = executor;
+        worker->id = i;
+        worker->seed = i + 1;
+        if (hg_test_deque_init(&worker->deque) != 0)
+            break;
+    }
+    executor->nworkers = i;
+    if (i < nworkers) {
+        hg_test_executor_destroy(executor);
+        return NULL;
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        struct hg_test_worker *worker = &executor->workers[i];
+#ifdef CPU_SET
+        cpu_set_t cpuset;
+#endif
+
+        if (pthread_create(&worker->thread, NULL, hg_test_worker_run,
+            worker) != 0)
+            break;
+        worker->started = 1;
+#ifdef CPU_SET
+        /* One worker per core, best effort */
+        CPU_ZERO(&cpuset);
+        CPU_SET(i % (unsigned int) ncpus, &cpuset);
+        pthread_setaffinity_np(worker->thread, sizeof(cpuset), &cpuset);
+#endif
+    }
+    if (i < nworkers) {
+        hg_test_executor_destroy(executor);
+        return NULL;
+    }
+
+    return executor;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_executor_destroy(struct hg_test_executor *executor)
+{
+    unsigned int i;
+
+    if (!executor)
+        return;
+
+    pthread_mutex_lock(&executor->mutex);
+    executor->shutdown = 1;
+    pthread_cond_broadcast(&executor->cond);
+    pthread_mutex_unlock(&executor->mutex);
+
+    for (i = 0; i < executor->nworkers; i++)
+        if (executor->workers[i].started)
+            pthread_join(executor->workers[i].thread, NULL);
+    for (i = 0; i < executor->nworkers; i++)
+        hg_test_deque_fini(&executor->workers[i].deque);
+
+    pthread_cond_destroy(&executor->cond);
+    pthread_mutex_destroy(&executor->mutex);
+    free(executor->workers);
+    free(executor);
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned int
+hg_test_executor_size(struct hg_test_executor *executor)
+{
+    return executor->nworkers;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_executor_submit(struct hg_test_executor *executor,
+    struct hg_test_task *task)
+{
+    struct hg_test_worker *worker = hg_test_worker_self_g;
+
+    if (!worker || worker->executor != executor)
+        worker = &executor->workers[__atomic_fetch_add(&executor->next, 1,
+            __ATOMIC_RELAXED) % executor->nworkers];
+
+    /* Counted before it is visible so that pending never goes negative.
+     * Pairs with the sleepers/pending checks of hg_test_worker_run(), either
+     * the sleeper sees the task or we see the sleeper. */
+    __atomic_add_fetch(&executor->pending, 1, __ATOMIC_SEQ_CST);
+    if (hg_test_deque_push(&worker->deque, task) != 0) {
+        __atomic_sub_fetch(&executor->pending, 1, __ATOMIC_SEQ_CST);
+        return -1;
+    }
+    if (__atomic_load_n(&executor->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&executor->mutex);
+        pthread_cond_signal(&executor->cond);
+        pthread_mutex_unlock(&executor->mutex);
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_executor_get_stats(struct hg_test_executor *executor,
+    struct hg_test_executor_stats *stats)
+{
+    unsigned int i;
+
+    stats->executed = 0;
+    stats->stolen = 0;
+    for (i = 0; i < executor->nworkers; i++) {
+        stats->executed += __atomic_load_n(&executor->workers[i].executed,
+            __ATOMIC_RELAXED);
+        stats->stolen += __atomic_load_n(&executor->workers[i].stolen,
+            __ATOMIC_RELAXED);
+    }
+}
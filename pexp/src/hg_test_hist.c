@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#include "hg_test_hist.h"
+
+#include <string.h>
+
+/****************/
+/* Local Macros */
+/****************/
+
+#define HG_TEST_PERF_NDIGITS    2
+#define HG_TEST_PERF_NWIDTH     20
+#define HG_TEST_PERF_PWIDTH     12
+
+/*---------------------------------------------------------------------------*/
+static unsigned int
+hg_test_hist_bucket(hg_uint64_t value)
+{
+    unsigned int exp;
+
+    if (value < HG_TEST_HIST_SUB_BUCKETS)
+        return (unsigned int) value;
+
+    /* Position of the leading bit, the next SUB_BITS bits pick the bucket */
+    exp = 63 - (unsigned int) __builtin_clzll(value);
+    return (exp - HG_TEST_HIST_SUB_BITS + 1) * HG_TEST_HIST_SUB_BUCKETS
+        + (unsigned int) ((value >> (exp - HG_TEST_HIST_SUB_BITS))
+            & (HG_TEST_HIST_SUB_BUCKETS - 1));
+}
+
+/*---------------------------------------------------------------------------*/
+/* Largest value that falls in bucket */
+static hg_uint64_t
+hg_test_hist_bucket_max(unsigned int bucket)
+{
+    unsigned int exp, sub;
+
+    if (bucket < HG_TEST_HIST_SUB_BUCKETS)
+        return bucket;
+
+    exp = bucket / HG_TEST_HIST_SUB_BUCKETS + HG_TEST_HIST_SUB_BITS - 1;
+    sub = bucket % HG_TEST_HIST_SUB_BUCKETS;
+    return (((hg_uint64_t) (HG_TEST_HIST_SUB_BUCKETS + sub + 1))
+        << (exp - HG_TEST_HIST_SUB_BITS)) - 1;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_hist_reset(struct hg_test_hist *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->min = (hg_uint64_t) -1;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_hist_record(struct hg_test_hist *hist, double seconds)
+{
+    hg_uint64_t value = seconds > 0 ? (hg_uint64_t) (seconds * 1e9) : 0;
+    unsigned int bucket = hg_test_hist_bucket(value);
+
+    if (bucket >= HG_TEST_HIST_BUCKETS)
+        bucket = HG_TEST_HIST_BUCKETS - 1;
+    hist->counts[bucket]++;
+    hist->count++;
+    if (value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+/*---------------------------------------------------------------------------*/
+double
+hg_test_hist_percentile(const struct hg_test_hist *hist, double p)
+{
+    hg_uint64_t rank, seen = 0;
+    hg_uint64_t value = hist->max;
+    unsigned int i;
+
+    if (!hist->count)
+        return 0;
+
+    /* Smallest value with at least p percent of the values at or below */
+    rank = (hg_uint64_t) (p / 100.0 * (double) hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < HG_TEST_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            value = hg_test_hist_bucket_max(i);
+            break;
+        }
+    }
+    /* Bucket bounds are coarser than the extremes we know exactly */
+    if (value > hist->max)
+        value = hist->max;
+    if (value < hist->min)
+        value = hist->min;
+
+    return (double) value / 1e9;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_perf_print_header(FILE *stream, int format)
+{
+    switch (format) {
+        case HG_TEST_OUTPUT_CSV:
+            fprintf(stream, "handles,size,iterations,bandwidth_mbs,"
+                "latency_ms,p50_ms,p90_ms,p99_ms,p999_ms,max_ms,"
+                "register_ms,first_ms\n");
+            break;
+        case HG_TEST_OUTPUT_JSON:
+            /* One object per line */
+            break;
+        case HG_TEST_OUTPUT_TEXT:
+        default:
+            fprintf(stream, "%-*s%*s%*s%*s%*s%*s%*s%*s\n", 10, "# Size",
+                HG_TEST_PERF_NWIDTH, "Bandwidth (MB/s)",
+                HG_TEST_PERF_NWIDTH, "Latency (ms)",
+                HG_TEST_PERF_PWIDTH, "p50 (ms)", HG_TEST_PERF_PWIDTH, "p90",
+                HG_TEST_PERF_PWIDTH, "p99", HG_TEST_PERF_PWIDTH, "p99.9",
+                HG_TEST_PERF_PWIDTH, "Max");
+            break;
+    }
+    fflush(stream);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_perf_print(FILE *stream, int format,
+    const struct hg_test_perf_result *result, const struct hg_test_hist *hist)
+{
+    double p50 = hg_test_hist_percentile(hist, 50) * 1000;
+    double p90 = hg_test_hist_percentile(hist, 90) * 1000;
+    double p99 = hg_test_hist_percentile(hist, 99) * 1000;
+    double p999 = hg_test_hist_percentile(hist, 99.9) * 1000;
+    double max = (double) hist->max / 1e6;
+
+    switch (format) {
+        case HG_TEST_OUTPUT_CSV:
+            fprintf(stream, "%u,%lu,%lu,%.*f,%.*f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                "%.3f,%.3f\n",
+                result->nhandles, (unsigned long) result->size,
+                (unsigned long) result->iterations,
+                HG_TEST_PERF_NDIGITS, result->bandwidth,
+                HG_TEST_PERF_NDIGITS + 1, result->latency,
+                p50, p90, p99, p999, max, result->register_ms,
+                result->first_ms);
+            break;
+        case HG_TEST_OUTPUT_JSON:
+            fprintf(stream, "{\"handles\": %u, \"size\": %lu, "
+                "\"iterations\": %lu, \"bandwidth_mbs\": %.*f, "
+                "\"latency_ms\": %.*f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, "
+                "\"p99_ms\": %.3f, \"p999_ms\": %.3f, \"max_ms\": %.3f, "
+                "\"register_ms\": %.3f, \"first_ms\": %.3f}\n",
+                result->nhandles, (unsigned long) result->size,
+                (unsigned long) result->iterations,
+                HG_TEST_PERF_NDIGITS, result->bandwidth,
+                HG_TEST_PERF_NDIGITS + 1, result->latency,
+                p50, p90, p99, p999, max, result->register_ms,
+                result->first_ms);
+            break;
+        case HG_TEST_OUTPUT_TEXT:
+        default:
+            fprintf(stream, "%-*d%*.*f%*.*f%*.*f%*.*f%*.*f%*.*f%*.*f\n", 10,
+                (int) result->size,
+                HG_TEST_PERF_NWIDTH, HG_TEST_PERF_NDIGITS, result->bandwidth,
+                HG_TEST_PERF_NWIDTH, HG_TEST_PERF_NDIGITS, result->latency,
+                HG_TEST_PERF_PWIDTH, HG_TEST_PERF_NDIGITS, p50,
+                HG_TEST_PERF_PWIDTH, HG_TEST_PERF_NDIGITS, p90,
+                HG_TEST_PERF_PWIDTH, HG_TEST_PERF_NDIGITS, p99,
+                HG_TEST_PERF_PWIDTH, HG_TEST_PERF_NDIGITS, p999,
+                HG_TEST_PERF_PWIDTH, HG_TEST_PERF_NDIGITS, max);
+            break;
+    }
+    fflush(stream);
+}
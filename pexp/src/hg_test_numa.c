@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "hg_test_numa.h"
+
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/****************/
+/* Local Macros */
+/****************/
+
+#define HG_TEST_NUMA_MAX_NODES  64
+#define HG_TEST_NUMA_SYSFS      "/sys/devices/system/node"
+
+/************************************/
+/* Local Type and Struct Definition */
+/************************************/
+
+struct hg_test_numa_node_stats {
+    hg_uint64_t transfers;
+    hg_uint64_t bytes;
+};
+
+struct hg_test_numa {
+    unsigned char online[HG_TEST_NUMA_MAX_NODES];
+    int node_count;             /* One past the highest online node */
+    int nic_node;
+    unsigned int context_count;
+    int *context_node;
+    struct hg_test_numa_node_stats stats[HG_TEST_NUMA_MAX_NODES];
+};
+
+/*---------------------------------------------------------------------------*/
+/* Read a sysfs list such as "0-3,8-11" into set, returns -1 if path cannot
+ * be read */
+static int
+hg_test_numa_read_list(const char *path, unsigned char *set, unsigned int max)
+{
+    char line[4096], *p, *end;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (!file)
+        return -1;
+    if (!fgets(line, sizeof(line), file)) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    memset(set, 0, max);
+    for (p = line; *p && *p != '\n'; p = end) {
+        unsigned long first, last;
+
+        first = strtoul(p, &end, 10);
+        if (end == p)
+            return -1;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtoul(p, &end, 10);
+            if (end == p)
+                return -1;
+        }
+        for (; first <= last && first < max; first++)
+            set[first] = 1;
+        if (*end == ',')
+            end++;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+/* -1 if the interface is virtual or not attached to a node */
+static int
+hg_test_numa_if_node(const char *ifname)
+{
+    char path[128];
+    FILE *file;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node",
+        ifname);
+    file = fopen(path, "r");
+    if (!file)
+        return -1;
+    if (fscanf(file, "%d", &node) != 1)
+        node = -1;
+    fclose(file);
+
+    return node;
+}
+
+/*---------------------------------------------------------------------------*/
+static hg_bool_t
+hg_test_numa_addr_equal(const struct sockaddr *a, const struct sockaddr *b)
+{
+    if (a->sa_family != b->sa_family)
+        return HG_FALSE;
+    if (a->sa_family == AF_INET)
+        return ((const struct sockaddr_in *) a)->sin_addr.s_addr
+            == ((const struct sockaddr_in *) b)->sin_addr.s_addr;
+    if (a->sa_family == AF_INET6)
+        return memcmp(&((const struct sockaddr_in6 *) a)->sin6_addr,
+            &((const struct sockaddr_in6 *) b)->sin6_addr,
+            sizeof(struct in6_addr)) == 0;
+    return HG_FALSE;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Node of the interface hostname resolves to, or of the first one attached
+ * to a node without hostname */
+static int
+hg_test_numa_find_nic(const char *hostname)
+{
+    struct addrinfo hints, *res = NULL, *ai;
+    struct ifaddrs *ifaddrs, *ifa;
+    char host[NI_MAXHOST];
+    int node = -1;
+
+    if (hostname) {
+        const char *colon = strchr(hostname, ':');
+
+        /* Plugins also take interface names */
+        node = hg_test_numa_if_node(hostname);
+        if (node >= 0)
+            return node;
+
+        /* Drop the port of host:port, IPv6 addresses have more colons */
+        snprintf(host, sizeof(host), "%s", hostname);
+        if (colon && !strchr(colon + 1, ':') && colon - hostname
+            < (long) sizeof(host))
+            host[colon - hostname] = '\0';
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        if (getaddrinfo(host, NULL, &hints, &res) != 0)
+            return -1;
+    }
+
+    if (getifaddrs(&ifaddrs) != 0) {
+        if (res)
+            freeaddrinfo(res);
+        return -1;
+    }
+    for (ifa = ifaddrs; ifa && node < 0; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || !(ifa->ifa_flags & IFF_UP)
+            || (ifa->ifa_flags & IFF_LOOPBACK))
+            continue;
+        if (!res) {
+            node = hg_test_numa_if_node(ifa->ifa_name);
+            continue;
+        }
+        for (ai = res; ai; ai = ai->ai_next)
+            if (hg_test_numa_addr_equal(ifa->ifa_addr, ai->ai_addr)) {
+                node = hg_test_numa_if_node(ifa->ifa_name);
+                break;
+            }
+    }
+    freeifaddrs(ifaddrs);
+    if (res)
+        freeaddrinfo(res);
+
+    return node;
+}
+
+/*---------------------------------------------------------------------------*/
+/* First online node from node on, cyclically */
+static int
+hg_test_numa_next_online(struct hg_test_numa *numa, int node)
+{
+    int i;
+
+    for (i = 0; i < numa->node_count; i++) {
+        int n = (node + i) % numa->node_count;
+
+        if (numa->online[n])
+            return n;
+    }
+
+    return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_numa_parse(const char *arg)
+{
+    char *end;
+    long node;
+
+    if (strcmp(arg, "off") == 0)
+        return HG_TEST_NUMA_OFF;
+    if (strcmp(arg, "nic") == 0)
+        return HG_TEST_NUMA_NIC;
+    if (strcmp(arg, "spread") == 0)
+        return HG_TEST_NUMA_SPREAD;
+    node = strtol(arg, &end, 10);
+    if (end == arg || *end || node < 0 || node >= HG_TEST_NUMA_MAX_NODES)
+        return HG_TEST_NUMA_INVALID;
+
+    return (int) node;
+}
+
+/*---------------------------------------------------------------------------*/
+struct hg_test_numa *
+hg_test_numa_create(int policy, const char *hostname,
+    unsigned int context_count)
+{
+    struct hg_test_numa *numa;
+    unsigned int i;
+    int node;
+
+    numa = (struct hg_test_numa *) calloc(1, sizeof(*numa));
+    if (!numa)
+        return NULL;
+    if (hg_test_numa_read_list(HG_TEST_NUMA_SYSFS "/online", numa->online,
+        HG_TEST_NUMA_MAX_NODES) != 0)
+        goto error;
+    for (node = 0; node < HG_TEST_NUMA_MAX_NODES; node++)
+        if (numa->online[node])
+            numa->node_count = node + 1;
+    if (numa->node_count == 0)
+        goto error;
+
+    numa->nic_node = hg_test_numa_find_nic(hostname);
+    if (numa->nic_node >= numa->node_count || (numa->nic_node >= 0
+        && !numa->online[numa->nic_node]))
+        numa->nic_node = -1;
+
+    numa->context_count = context_count;
+    numa->context_node = (int *) malloc(context_count * sizeof(int));
+    if (!numa->context_node)
+        goto error;
+
+    /* The NIC's node first, context 0 is the one on the main thread */
+    if (policy >= 0) {
+        if (policy >= numa->node_count || !numa->online[policy])
+            goto error;
+        node = policy;
+    } else
+        node = hg_test_numa_next_online(numa,
+            numa->nic_node >= 0 ? numa->nic_node : 0);
+    for (i = 0; i < context_count; i++) {
+        numa->context_node[i] = node;
+        if (policy == HG_TEST_NUMA_SPREAD)
+            node = hg_test_numa_next_online(numa, node + 1);
+    }
+
+    return numa;
+
+error:
+    free(numa->context_node);
+    free(numa);
+    return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_numa_destroy(struct hg_test_numa *numa)
+{
+    if (!numa)
+        return;
+    free(numa->context_node);
+    free(numa);
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_numa_node_count(struct hg_test_numa *numa)
+{
+    return numa->node_count;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_numa_nic_node(struct hg_test_numa *numa)
+{
+    return numa->nic_node;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_numa_context_node(struct hg_test_numa *numa, unsigned int context_id)
+{
+    return numa->context_node[context_id % numa->context_count];
+}
+
+/*---------------------------------------------------------------------------*/
+int
+hg_test_numa_bind_self(struct hg_test_numa *numa, unsigned int context_id)
+{
+    int node = hg_test_numa_context_node(numa, context_id);
+    int ret = 0;
+#ifdef CPU_SET
+    unsigned char cpus[CPU_SETSIZE];
+    char path[128];
+    cpu_set_t cpuset;
+    unsigned int cpu;
+
+    snprintf(path, sizeof(path), HG_TEST_NUMA_SYSFS "/node%d/cpulist", node);
+    if (hg_test_numa_read_list(path, cpus, CPU_SETSIZE) != 0)
+        ret = -1;
+    else {
+        CPU_ZERO(&cpuset);
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (cpus[cpu])
+                CPU_SET(cpu, &cpuset);
+        /* Memory-only nodes have no CPUs, only the policy applies */
+        if (CPU_COUNT(&cpuset) > 0 && pthread_setaffinity_np(pthread_self(),
+            sizeof(cpuset), &cpuset) != 0)
+            ret = -1;
+    }
+#endif
+#ifdef __NR_set_mempolicy
+    {
+        /* Raw system call so that libnuma is not needed, maxnode counts one
+         * past the last bit the kernel looks at */
+        unsigned long mask[HG_TEST_NUMA_MAX_NODES / (8 * sizeof(long))];
+
+        memset(mask, 0, sizeof(mask));
+        mask[node / (8 * sizeof(long))] = 1UL << (node % (8 * sizeof(long)));
+        if (syscall(__NR_set_mempolicy, MPOL_PREFERRED, mask,
+            HG_TEST_NUMA_MAX_NODES + 1) != 0)
+            ret = -1;
+    }
+#endif
+
+    return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_numa_account(struct hg_test_numa *numa, unsigned int context_id,
+    hg_uint64_t bytes)
+{
+    struct hg_test_numa_node_stats *stats =
+        &numa->stats[hg_test_numa_context_node(numa, context_id)];
+
+    __atomic_add_fetch(&stats->transfers, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_numa_print_stats(struct hg_test_numa *numa, FILE *stream)
+{
+    int node;
+
+    for (node = 0; node < numa->node_count; node++) {
+        struct hg_test_numa_node_stats *stats = &numa->stats[node];
+        unsigned int contexts = 0, i;
+
+        for (i = 0; i < numa->context_count; i++)
+            if (numa->context_node[i] == node)
+                contexts++;
+        if (!contexts && !stats->transfers)
+            continue;
+        fprintf(stream, "# NUMA node %d%s: %u contexts, %lu transfers, "
+            "%lu MB\n", node, node == numa->nic_node ? " (NIC)" : "",
+            contexts, (unsigned long) stats->transfers,
+            (unsigned long) (stats->bytes >> 20));
+    }
+}
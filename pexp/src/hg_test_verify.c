@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2013-2017 Argonne National Laboratory, Department of Energy,
+ *                    UChicago Argonne, LLC and The HDF Group.
+ * All rights reserved.
+ *
+ * The full copyright notice, including terms governing use, modification,
+ * and redistribution, is contained in the COPYING file that can be
+ * found at the root of the source code distribution tree.
+ */
+
+#include "hg_test_verify.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HG_TEST_VERIFY_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+# include <arm_neon.h>
+# define HG_TEST_VERIFY_NEON
+#endif
+
+/************************************/
+/* Local Type and Struct Definition */
+/************************************/
+
+struct hg_test_pattern_ops {
+    const char *name;
+    void (*fill)(void *buf, size_t offset, size_t n);
+    size_t (*check)(const void *buf, size_t offset, size_t n);
+};
+
+/*---------------------------------------------------------------------------*/
+/* Scalar kernels, also used for the tails of the vector ones */
+static void
+hg_test_pattern_fill_scalar(void *buf, size_t offset, size_t n)
+{
+    unsigned char *p = (unsigned char *) buf;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        p[i] = (unsigned char) (offset + i);
+}
+
+static size_t
+hg_test_pattern_check_scalar(const void *buf, size_t offset, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (p[i] != (unsigned char) (offset + i))
+            break;
+    return i;
+}
+
+static const struct hg_test_pattern_ops hg_test_pattern_scalar_ops = {
+    "scalar", hg_test_pattern_fill_scalar, hg_test_pattern_check_scalar
+};
+
+#ifdef HG_TEST_VERIFY_X86
+/*---------------------------------------------------------------------------*/
+/* Byte lanes hold consecutive pattern values, adding the vector width to
+ * every lane moves to the next vector, wrapping at 256 like the pattern. */
+__attribute__((target("avx2"))) static void
+hg_test_pattern_fill_avx2(void *buf, size_t offset, size_t n)
+{
+    unsigned char *p = (unsigned char *) buf;
+    const __m256i step = _mm256_set1_epi8(32);
+    __m256i v;
+    size_t i = 0;
+
+    v = _mm256_add_epi8(_mm256_set1_epi8((char) offset),
+        _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30,
+            31));
+    for (; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256((__m256i *) (p + i), v);
+        v = _mm256_add_epi8(v, step);
+    }
+    hg_test_pattern_fill_scalar(p + i, offset + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+hg_test_pattern_check_avx2(const void *buf, size_t offset, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    const __m256i step = _mm256_set1_epi8(32);
+    const __m256i step4 = _mm256_set1_epi8((char) 128);
+    __m256i v0, v1, v2, v3;
+    size_t i = 0;
+    unsigned int mask;
+
+    v0 = _mm256_add_epi8(_mm256_set1_epi8((char) offset),
+        _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+            15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30,
+            31));
+    v1 = _mm256_add_epi8(v0, step);
+    v2 = _mm256_add_epi8(v1, step);
+    v3 = _mm256_add_epi8(v2, step);
+
+    /* 128 bytes per iteration, only look for the culprit on a mismatch */
+    for (; i + 128 <= n; i += 128) {
+        __m256i d = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256(
+                    (const __m256i *) (p + i)), v0),
+                _mm256_xor_si256(_mm256_loadu_si256(
+                    (const __m256i *) (p + i + 32)), v1)),
+            _mm256_or_si256(
+                _mm256_xor_si256(_mm256_loadu_si256(
+                    (const __m256i *) (p + i + 64)), v2),
+                _mm256_xor_si256(_mm256_loadu_si256(
+                    (const __m256i *) (p + i + 96)), v3)));
+        if (!_mm256_testz_si256(d, d))
+            break;
+        v0 = _mm256_add_epi8(v0, step4);
+        v1 = _mm256_add_epi8(v1, step4);
+        v2 = _mm256_add_epi8(v2, step4);
+        v3 = _mm256_add_epi8(v3, step4);
+    }
+    for (; i + 32 <= n; i += 32) {
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (p + i)), v0));
+        if (mask != 0xffffffffU)
+            return i + (size_t) __builtin_ctz(~mask);
+        v0 = _mm256_add_epi8(v0, step);
+    }
+    return i + hg_test_pattern_check_scalar(p + i, offset + i, n - i);
+}
+
+static const struct hg_test_pattern_ops hg_test_pattern_avx2_ops = {
+    "avx2", hg_test_pattern_fill_avx2, hg_test_pattern_check_avx2
+};
+
+/*---------------------------------------------------------------------------*/
+__attribute__((target("sse2"))) static void
+hg_test_pattern_fill_sse2(void *buf, size_t offset, size_t n)
+{
+    unsigned char *p = (unsigned char *) buf;
+    const __m128i step = _mm_set1_epi8(16);
+    __m128i v;
+    size_t i = 0;
+
+    v = _mm_add_epi8(_mm_set1_epi8((char) offset),
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    for (; i + 16 <= n; i += 16) {
+        _mm_storeu_si128((__m128i *) (p + i), v);
+        v = _mm_add_epi8(v, step);
+    }
+    hg_test_pattern_fill_scalar(p + i, offset + i, n - i);
+}
+
+__attribute__((target("sse2"))) static size_t
+hg_test_pattern_check_sse2(const void *buf, size_t offset, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    const __m128i step = _mm_set1_epi8(16);
+    __m128i v;
+    size_t i = 0;
+    unsigned int mask;
+
+    v = _mm_add_epi8(_mm_set1_epi8((char) offset),
+        _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    for (; i + 16 <= n; i += 16) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *) (p + i)), v));
+        if (mask != 0xffffU)
+            return i + (size_t) __builtin_ctz(~mask);
+        v = _mm_add_epi8(v, step);
+    }
+    return i + hg_test_pattern_check_scalar(p + i, offset + i, n - i);
+}
+
+static const struct hg_test_pattern_ops hg_test_pattern_sse2_ops = {
+    "sse2", hg_test_pattern_fill_sse2, hg_test_pattern_check_sse2
+};
+#endif /* HG_TEST_VERIFY_X86 */
+
+#ifdef HG_TEST_VERIFY_NEON
+/*---------------------------------------------------------------------------*/
+static const uint8_t hg_test_pattern_iota_g[16] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static void
+hg_test_pattern_fill_neon(void *buf, size_t offset, size_t n)
+{
+    unsigned char *p = (unsigned char *) buf;
+    const uint8x16_t step = vdupq_n_u8(16);
+    uint8x16_t v;
+    size_t i = 0;
+
+    v = vaddq_u8(vdupq_n_u8((uint8_t) offset),
+        vld1q_u8(hg_test_pattern_iota_g));
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(p + i, v);
+        v = vaddq_u8(v, step);
+    }
+    hg_test_pattern_fill_scalar(p + i, offset + i, n - i);
+}
+
+static size_t
+hg_test_pattern_check_neon(const void *buf, size_t offset, size_t n)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    const uint8x16_t step = vdupq_n_u8(16);
+    uint8x16_t v;
+    size_t i = 0;
+
+    v = vaddq_u8(vdupq_n_u8((uint8_t) offset),
+        vld1q_u8(hg_test_pattern_iota_g));
+    for (; i + 16 <= n; i += 16) {
+        /* all lanes 0xff if they all match */
+        if (vminvq_u8(vceqq_u8(vld1q_u8(p + i), v)) != 0xff)
+            break;
+        v = vaddq_u8(v, step);
+    }
+    return i + hg_test_pattern_check_scalar(p + i, offset + i, n - i);
+}
+
+static const struct hg_test_pattern_ops hg_test_pattern_neon_ops = {
+    "neon", hg_test_pattern_fill_neon, hg_test_pattern_check_neon
+};
+#endif /* HG_TEST_VERIFY_NEON */
+
+/*******************/
+/* Local Variables */
+/*******************/
+
+static const struct hg_test_pattern_ops *hg_test_pattern_ops_g = NULL;
+
+/*---------------------------------------------------------------------------*/
+static const struct hg_test_pattern_ops *
+hg_test_pattern_select(void)
+{
+    const struct hg_test_pattern_ops *ops = &hg_test_pattern_scalar_ops;
+
+#if defined(HG_TEST_VERIFY_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        ops = &hg_test_pattern_avx2_ops;
+    else if (__builtin_cpu_supports("sse2"))
+        ops = &hg_test_pattern_sse2_ops;
+#elif defined(HG_TEST_VERIFY_NEON)
+    ops = &hg_test_pattern_neon_ops;
+#endif
+    /* Racing threads pick the same ops, no need to lock */
+    hg_test_pattern_ops_g = ops;
+    return ops;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+hg_test_pattern_fill(void *buf, size_t offset, size_t n)
+{
+    const struct hg_test_pattern_ops *ops = hg_test_pattern_ops_g;
+
+    if (!ops)
+        ops = hg_test_pattern_select();
+    ops->fill(buf, offset, n);
+}
+
+/*---------------------------------------------------------------------------*/
+size_t
+hg_test_pattern_check(const void *buf, size_t offset, size_t n)
+{
+    const struct hg_test_pattern_ops *ops = hg_test_pattern_ops_g;
+
+    if (!ops)
+        ops = hg_test_pattern_select();
+    return ops->check(buf, offset, n);
+}
+
+/*---------------------------------------------------------------------------*/
+const char *
+hg_test_pattern_impl(void)
+{
+    const struct hg_test_pattern_ops *ops = hg_test_pattern_ops_g;
+
+    if (!ops)
+        ops = hg_test_pattern_select();
+    return ops->name;
+}
@@ -27,6 +27,8 @@ struct hg_test_perf_args {
 	hg_request_t *request;
 	unsigned int op_count;
 	hg_atomic_int32_t op_completed_count;
+	hg_uint64_t chunk_size;		/* Operating point reported by server */
+	hg_uint32_t pipeline_size;
 };
 
 	static hg_return_t
@@ -34,6 +36,14 @@ hg_test_perf_forward_cb(const struct hg_cb_info *callback_info)
 {
 	struct hg_test_perf_args *args =
 		(struct hg_test_perf_args *) callback_info->arg;
+	bulk_write_out_t out_struct;
+
+	if (HG_Get_output(callback_info->info.forward.handle, &out_struct)
+			== HG_SUCCESS) {
+		args->chunk_size = out_struct.chunk_size;
+		args->pipeline_size = out_struct.pipeline_size;
+		HG_Free_output(callback_info->info.forward.handle, &out_struct);
+	}
 
 	if ((unsigned int) hg_atomic_incr32(&args->op_completed_count)
 			== args->op_count) {
@@ -63,13 +73,15 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	size_t avg_iter;
 	double time_read = 0, read_bandwidth;
 	double read_latency;
+	struct hg_test_hist hist;
+	struct hg_test_perf_result result;
+	int text = hg_test_info->output_format == HG_TEST_OUTPUT_TEXT;
 	hg_return_t ret = HG_SUCCESS;
 	size_t i;
 
 	/* Prepare bulk_buf */
 	bulk_buf = malloc(nbytes);
-	for (i = 0; i < nbytes; i++)
-		bulk_buf[i] = (char) i;
+	hg_test_pattern_fill(bulk_buf, 0, nbytes);
 	buf_ptrs = (void **) &bulk_buf;
 	buf_sizes = &nbytes;
 
@@ -83,11 +95,20 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 			fprintf(stderr, "Could not start call\n");
 			goto done;
 		}
+		/* Target a given context of the server or spread over them */
+		if (hg_test_info->target_id >= 0)
+			HG_Set_target_id(handles[i],
+					(hg_uint8_t) hg_test_info->target_id);
+		else if (hg_test_info->context_count > 1)
+			HG_Set_target_id(handles[i],
+					(hg_uint8_t) (i % hg_test_info->context_count));
 	}
 
 	request = hg_request_create(hg_test_info->request_class);
 	hg_atomic_init32(&args.op_completed_count, 0);
 	args.op_count = nhandles;
+	args.chunk_size = 0;
+	args.pipeline_size = 0;
 	args.request = request;
 
 	/* Register memory */
@@ -100,6 +121,8 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 
 	/* Fill input structure */
 	in_struct.fildes = 0;
+	in_struct.checksum_type = HG_TEST_CHECKSUM_NONE;
+	in_struct.checksum = 0;
 	in_struct.bulk_handle = bulk_handle;
 
 	/* Warm up for bulk data */
@@ -121,6 +144,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	}
 
 	NA_Test_barrier(&hg_test_info->na_test_info);
+	hg_test_hist_reset(&hist);
 
 	/* Bulk data benchmark */
 	for (avg_iter = 0; avg_iter < loop; avg_iter++) {
@@ -141,6 +165,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 		NA_Test_barrier(&hg_test_info->na_test_info);
 		hg_time_get_current(&t2);
 		time_read += hg_time_to_double(hg_time_subtract(t2, t1));
+		hg_test_hist_record(&hist, hg_time_to_double(hg_time_subtract(t2, t1)));
 
 		hg_request_reset(request);
 		hg_atomic_set32(&args.op_completed_count, 0);
@@ -154,7 +179,7 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 
 
 		/* At this point we have received everything so work out the bandwidth */
-		if (hg_test_info->na_test_info.mpi_comm_rank == 0)
+		if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text)
 			fprintf(stdout, "%-*d%*.*f%*.*f\r", 10, (int) nbytes, NWIDTH,
 					NDIGITS, read_bandwidth, NWIDTH, NDIGITS, read_latency);
 		//#endif
@@ -167,11 +192,21 @@ measure_bulk_transfer(struct hg_test_info *hg_test_info, size_t total_size,
 	read_latency = time_read * 1000 / (avg_iter + 1);
 
 	/* At this point we have received everything so work out the bandwidth */
+	result.nhandles = nhandles;
+	result.size = nbytes;
+	result.iterations = avg_iter;
+	result.bandwidth = read_bandwidth;
+	result.latency = read_latency;
+	result.register_ms = 0;
+	result.first_ms = 0;
 	if (hg_test_info->na_test_info.mpi_comm_rank == 0)
-		fprintf(stdout, "%-*d%*.*f%*.*f", 10, (int) nbytes, NWIDTH, NDIGITS,
-				read_bandwidth, NWIDTH, NDIGITS, read_latency);
+		hg_test_perf_print(stdout, hg_test_info->output_format, &result,
+				&hist);
 	//#endif
-	if (hg_test_info->na_test_info.mpi_comm_rank == 0) fprintf(stdout, "\n");
+	if (hg_test_info->na_test_info.mpi_comm_rank == 0 && text
+			&& hg_test_info->na_test_info.verbose)
+		fprintf(stdout, "# Pipeline: %lu KB chunks, %u in flight\n",
+				(unsigned long) (args.chunk_size / 1024), args.pipeline_size);
 
 	/* Free memory handle */
 	ret = HG_Bulk_free(bulk_handle);
@@ -207,50 +242,56 @@ main(int argc, char *argv[])
     hg_return_t ret = HG_SUCCESS;
 	unsigned int nhandles;
 	size_t size;
+	int text;
 
     /* Force to listen */
     //hg_test_info.na_test_info.listen = NA_TRUE;
     hg_test_info.na_test_info.mpi_static = NA_TRUE;
     HG_Test_init(argc, argv, &hg_test_info);
     if (hg_test_info.na_test_info.listen) {
-    do {
-        unsigned int actual_count = 0;
-
-        do {
-            ret = HG_Trigger(hg_test_info.context, 0, 1, &actual_count);
-        } while ((ret == HG_SUCCESS) && actual_count);
+    struct progress_driver driver;
 
+    /* Use same value as HG_TEST_TRIGGER_TIMEOUT for convenience */
+    progress_driver_init(&driver, hg_test_info.context, hg_test_info.spin_us,
+        HG_TEST_TRIGGER_TIMEOUT);
+    do {
         if (hg_atomic_cas32(&hg_test_info.finalizing_count, 1, 1))
             break;
 
-        /* Use same value as HG_TEST_TRIGGER_TIMEOUT for convenience */
-        ret = HG_Progress(hg_test_info.context, HG_TEST_TRIGGER_TIMEOUT);
+        ret = progress_driver_step(&driver);
     } while (ret == HG_SUCCESS || ret == HG_TIMEOUT);
 
+    if (hg_test_info.na_test_info.verbose)
+        progress_driver_print_stats(&driver, stdout, "Progress");
+
     }else{
 
+	text = hg_test_info.output_format == HG_TEST_OUTPUT_TEXT;
+	if (hg_test_info.na_test_info.mpi_comm_rank == 0 && !text)
+		hg_test_perf_print_header(stdout, hg_test_info.output_format);
+
 	for (nhandles = 1; nhandles <= MAX_HANDLES; nhandles *= 2) {
-		if (hg_test_info.na_test_info.mpi_comm_rank == 0) {
+		if (hg_test_info.na_test_info.mpi_comm_rank == 0 && text) {
 			fprintf(stdout, "# RPC Write Performance\n");
 			fprintf(stdout, "# Loop %d times from size %d to %d byte(s) with "
 					"%u handle(s)\n",
 					hg_test_info.na_test_info.loop, 1, MAX_MSG_SIZE, nhandles);
-			fprintf(stdout, "%-*s%*s%*s\n", 10, "# Size", NWIDTH,
-					"Bandwidth (MB/s)", NWIDTH, "Latency (ms)");
-			fflush(stdout);
+			hg_test_perf_print_header(stdout, HG_TEST_OUTPUT_TEXT);
 		}
 
 		for (size = 1 * 1024 * 1024; size <= MAX_MSG_SIZE; size *= 2)
 		//for (size = 1; size <= 512 * 1024 * 1024; size *= 2)
 			measure_bulk_transfer(&hg_test_info, size, nhandles);
 
-		fprintf(stdout, "\n");
+		if (text)
+			fprintf(stdout, "\n");
 	}
 
 
 
 	}
-    printf("# Finalizing...\n");
+    if (hg_test_info.output_format == HG_TEST_OUTPUT_TEXT)
+        printf("# Finalizing...\n");
 
     HG_Test_finalize(&hg_test_info);
 
@@ -18,11 +18,22 @@
 #include "mercury_thread_mutex.h"
 #include "mercury_rpc_cb.h"
 
+#include <aio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <unistd.h>
+
 /****************/
 /* Local Macros */
 /****************/
 #define PIPELINE_SIZE 4
 #define MIN_BUFFER_SIZE (1 << 16) //(2 << 15) /* 11 Stop at 4KB buffer size */
+/* Bounds of the adaptive pipeline (hg_test_info->adaptive_pipeline) */
+#define PIPELINE_ADAPT_MIN_CHUNK_SIZE (1 << 12)
+#define PIPELINE_ADAPT_MAX_CHUNK_SIZE (1 << 24)
+#define PIPELINE_ADAPT_MAX_PIPELINE_SIZE 32
+#define PIPELINE_ADAPT_GAIN 0.05 /* Min relative change worth acting on */
 #define MERCURY_TESTING_MAX_LOOP 10
 
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
@@ -73,6 +84,11 @@ hg_core_get_thread_work(
 #define HG_TEST_THREAD_CB(func_name)
 #endif
 
+/* States of the adaptive pipeline */
+#define HG_TEST_ADAPT_CHUNK     0   /* Growing chunk size */
+#define HG_TEST_ADAPT_DEPTH     1   /* Growing number of chunks in flight */
+#define HG_TEST_ADAPT_STEADY    2   /* Holding operating point */
+
 struct hg_test_bulk_args {
     hg_handle_t handle;
     size_t nbytes;
@@ -216,13 +232,10 @@ hg_test_perf_bulk_transfer_cb(const struct hg_cb_info *hg_cb_info)
 
     /* Check bulk buf */
     buf_ptr = (const char*) buf;
-    for (i = 0; i < size; i++) {
-        if (buf_ptr[i] != (char) i) {
-            printf("Error detected in bulk transfer, buf[%d] = %d, "
-                "was expecting %d!\n", (int) i, (char) buf_ptr[i], (char) i);
-            break;
-        }
-    }
+    i = hg_test_pattern_check(buf_ptr, 0, size);
+    if (i < size)
+        printf("Error detected in bulk transfer, buf[%d] = %d, "
+            "was expecting %d!\n", (int) i, (char) buf_ptr[i], (char) i);
 #endif
 
     /* Free origin handle */
@@ -266,14 +279,11 @@ bulk_write(const void *buf, size_t offset, size_t nbyte, int verbose)
         printf("Checking data...\n");
 
     /* Check bulk buf */
-    //for (i = 0; i < (nbyte / sizeof(char)); i++) {
-    for (i = 0; i < nbyte; i++) {
-        if (bulk_buf[i] != (char) (i + offset)) {
-            printf("Error detected in bulk transfer, bulk_buf[%lu] = %d, "
-                    "was expecting %d!\n", i, bulk_buf[i], (int) (i + offset));
-            error = 1;
-            break;
-        }
+    i = hg_test_pattern_check(bulk_buf, offset, nbyte);
+    if (i < nbyte) {
+        printf("Error detected in bulk transfer, bulk_buf[%lu] = %d, "
+                "was expecting %d!\n", i, bulk_buf[i], (int) (i + offset));
+        error = 1;
     }
     if (!error && verbose) printf("Successfully transfered %lu bytes!\n", nbyte);
 /*
@@ -291,95 +301,536 @@ bulk_write(const void *buf, size_t offset, size_t nbyte, int verbose)
 
 /*---------------------------------------------------------------------------*/
 typedef struct {
-    	const struct hg_info *hg_info;
-	int next_pipeline;
-	int num_pipeline;
-    	size_t bulk_write_nbytes;
-        size_t total_bytes_read;
-	size_t write_offset;
-	size_t chunk_size;
-	hg_bulk_t origin_bulk_handle;
-	hg_bulk_t local_bulk_handle;
-	struct hg_test_info *hg_test_info;
-	hg_handle_t handle;
-	char *buf;
+    const struct hg_info *hg_info;
+    int next_pipeline;
+    int num_pipeline;
+    size_t bulk_write_nbytes;
+    size_t total_bytes_read;
+    size_t write_offset;
+    size_t chunk_size;          /* Size of the chunks posted next */
+    unsigned int pipeline_size; /* Number of chunks kept in flight */
+    unsigned int inflight;      /* Number of chunks currently in flight */
+    hg_bool_t adaptive;         /* Tune chunk_size/pipeline_size on the fly */
+    int adapt_state;            /* HG_TEST_ADAPT_* */
+    unsigned int epoch;         /* Bumped each time the operating point moves */
+    unsigned int epoch_chunks;  /* Chunks of the current epoch completed */
+    size_t epoch_bytes;         /* Bytes of the current epoch completed */
+    hg_time_t epoch_start;
+    double best_bandwidth;      /* Best epoch bandwidth seen so far (B/s) */
+    hg_bulk_t origin_bulk_handle;
+    hg_bulk_t local_bulk_handle;
+    struct bulk_pool_buf *pool_buf;
+    struct bulk_pool *pool;     /* That of the context, see -N */
+    unsigned int context_id;
+    struct hg_test_info *hg_test_info;
+    hg_handle_t handle;
+    char *buf;
+    /* End-to-end checksum, chunks are folded in as they land */
+    hg_uint32_t checksum_type;  /* HG_TEST_CHECKSUM_* */
+    hg_uint32_t checksum;       /* Sent by the origin */
+    hg_uint32_t crc;            /* Of the chunks pulled so far */
+    hg_bool_t checksum_error;
+    /* Compute stage, merged under mutex */
+    const struct hg_test_compute *compute;
+    hg_uint64_t compute_result;
+    hg_uint64_t compute_time;   /* ns */
+    unsigned int chunks_inflight;   /* On the executor */
+    struct hg_test_admission_waiter admission;  /* Bytes held of the budget */
+    /* Durable mode, shared with the aio completion threads */
+    hg_bool_t durable;
+    hg_uint64_t durable_base;   /* Offset of this transfer in the file */
+    hg_thread_mutex_t mutex;
+    hg_bool_t pulled;           /* No pull left in flight or to post */
+    hg_bool_t pull_error;       /* A chunk could not be posted */
+    unsigned int writes_inflight;
+    hg_bool_t write_error;
+    hg_bool_t responding;
+    struct aiocb sync_acb;
 } pipe_args_t;
 
 typedef struct {
-	size_t offset;
-	size_t chunk_size;
-	pipe_args_t * info;
-	hg_time_t stime;
+    struct aiocb acb;
+    pipe_args_t *info;
+} pipe_write_args_t;
+
+typedef struct {
+    struct hg_test_task task;   /* First, the executor hands it back */
+    pipe_args_t *info;
+    void *buf;
+    size_t offset;
+    size_t len;
+} pipe_chunk_args_t;
+
+typedef struct {
+    size_t offset;
+    size_t chunk_size;
+    unsigned int epoch;
+    pipe_args_t * info;
+    hg_time_t stime;            /* Posted */
 } pipe_cb_args_t;
 
+/* Operating point settled on by the last adaptive transfer of each context,
+ * used to seed the next one so that steady streams of similar sizes do not
+ * re-learn it. Transfers respond from the progress, executor and aio
+ * threads, so chunk and pipeline size are packed in one word read and
+ * written atomically, 0 until a transfer settled. */
+#define HG_TEST_ADAPT_PACK(chunk_size, pipeline_size) \
+    (((hg_uint64_t) (chunk_size) << 8) | (pipeline_size))
+static hg_uint64_t hg_test_adapt_point_g[MERCURY_TESTING_MAX_CONTEXTS];
+
+/*---------------------------------------------------------------------------*/
+static hg_return_t
+hg_test_pipeline_post(pipe_args_t *pl, pipe_cb_args_t *cag)
+{
+    size_t chunk_size = pl->bulk_write_nbytes - pl->write_offset;
+    hg_return_t ret;
+
+    chunk_size = chunk_size > pl->chunk_size ? pl->chunk_size : chunk_size;
+    cag->info = pl;
+    cag->offset = pl->write_offset;
+    cag->chunk_size = chunk_size;
+    cag->epoch = pl->epoch;
+
+    pl->write_offset += chunk_size;
+    pl->next_pipeline++;
+    pl->inflight++;
+
+    hg_time_get_current(&cag->stime);
+
+    ret = HG_Bulk_transfer(pl->hg_info->context, hg_test_pipeline_transfer_cb,
+        (void*)cag, HG_BULK_PULL, pl->hg_info->addr,
+        pl->origin_bulk_handle, cag->offset,
+        pl->local_bulk_handle, cag->offset, chunk_size, HG_OP_ID_IGNORE);
+    if (ret != HG_SUCCESS) {
+        fprintf(stderr, "Could not read bulk data\n");
+        pl->write_offset -= chunk_size;
+        pl->next_pipeline--;
+        pl->inflight--;
+    }
+
+    return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Post chunks until pipeline_size of them are in flight or nothing is left.
+ * cag, if not NULL, is a completed chunk descriptor that can be reused. */
+static hg_return_t
+hg_test_pipeline_fill(pipe_args_t *pl, pipe_cb_args_t *cag)
+{
+    hg_return_t ret = HG_SUCCESS;
+
+    while (pl->write_offset < pl->bulk_write_nbytes
+        && pl->inflight < pl->pipeline_size) {
+        if (!cag)
+            cag = (pipe_cb_args_t*)malloc(sizeof(pipe_cb_args_t));
+        ret = hg_test_pipeline_post(pl, cag);
+        if (ret != HG_SUCCESS)
+            break;
+        cag = NULL;
+    }
+    free(cag);
+
+    return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Start a new measurement epoch at the current operating point */
+static void
+hg_test_pipeline_new_epoch(pipe_args_t *pl, hg_time_t now)
+{
+    pl->epoch++;
+    pl->epoch_chunks = 0;
+    pl->epoch_bytes = 0;
+    pl->epoch_start = now;
+}
+
+/*---------------------------------------------------------------------------*/
+/* Hill-climb on the measured bandwidth: first grow the chunk size while it
+ * pays off, then the pipeline depth, then hold the operating point and only
+ * back off (halve the chunk size) if bandwidth drops. Only chunks posted at
+ * the current operating point are taken into account, an epoch runs from
+ * the post of its first chunk to the completion of its last one. */
+static void
+hg_test_pipeline_adapt(pipe_args_t *pl, const pipe_cb_args_t *cag,
+    hg_time_t now)
+{
+    double elapsed, bandwidth;
+
+    if (cag->epoch != pl->epoch)
+        return;
+
+    if (pl->epoch_chunks++ == 0)
+        pl->epoch_start = cag->stime;
+    pl->epoch_bytes += cag->chunk_size;
+    if (pl->epoch_chunks < pl->pipeline_size)
+        return;
+
+    elapsed = hg_time_to_double(hg_time_subtract(now, pl->epoch_start));
+    if (elapsed <= 0)
+        return;
+    bandwidth = (double) pl->epoch_bytes / elapsed;
+
+    switch (pl->adapt_state) {
+        case HG_TEST_ADAPT_CHUNK:
+            if (bandwidth > pl->best_bandwidth * (1.0 + PIPELINE_ADAPT_GAIN)) {
+                pl->best_bandwidth = bandwidth;
+                if (pl->chunk_size * 2 <= PIPELINE_ADAPT_MAX_CHUNK_SIZE
+                    && pl->chunk_size * 2 * pl->pipeline_size
+                        <= pl->bulk_write_nbytes - pl->write_offset) {
+                    pl->chunk_size *= 2;
+                    break;
+                }
+            } else if (pl->best_bandwidth > 0
+                && pl->chunk_size / 2 >= PIPELINE_ADAPT_MIN_CHUNK_SIZE) {
+                /* Last step did not pay off, go back */
+                pl->chunk_size /= 2;
+            }
+            pl->adapt_state = HG_TEST_ADAPT_DEPTH;
+            if (pl->pipeline_size < PIPELINE_ADAPT_MAX_PIPELINE_SIZE)
+                pl->pipeline_size++;
+            break;
+        case HG_TEST_ADAPT_DEPTH:
+            if (bandwidth > pl->best_bandwidth * (1.0 + PIPELINE_ADAPT_GAIN)) {
+                pl->best_bandwidth = bandwidth;
+                if (pl->pipeline_size < PIPELINE_ADAPT_MAX_PIPELINE_SIZE) {
+                    pl->pipeline_size++;
+                    break;
+                }
+            } else if (pl->pipeline_size > 1)
+                pl->pipeline_size--;
+            pl->adapt_state = HG_TEST_ADAPT_STEADY;
+            break;
+        case HG_TEST_ADAPT_STEADY:
+        default:
+            if (bandwidth < pl->best_bandwidth * (1.0 - PIPELINE_ADAPT_GAIN)) {
+                /* Link got slower (e.g. more clients), smaller chunks give
+                 * other requests a chance to interleave */
+                if (pl->chunk_size / 2 >= PIPELINE_ADAPT_MIN_CHUNK_SIZE)
+                    pl->chunk_size /= 2;
+                pl->best_bandwidth = 0;
+                pl->adapt_state = HG_TEST_ADAPT_CHUNK;
+            } else if (bandwidth > pl->best_bandwidth)
+                pl->best_bandwidth = bandwidth;
+            break;
+    }
+
+    hg_test_pipeline_new_epoch(pl, now);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_respond(pipe_args_t *pl)
+{
+    struct hg_test_admission *admission = pl->hg_test_info->admission;
+    hg_uint64_t admitted = pl->admission.bytes;
+    bulk_write_out_t bulk_write_out_struct;
+    hg_return_t ret;
+
+    /* fill output structure */
+    /* Bytes now safe, none if a pull, a durable write or the checksum
+     * failed */
+    bulk_write_out_struct.ret = pl->pull_error || pl->write_error
+        || pl->checksum_error ? 0 : pl->total_bytes_read;
+    bulk_write_out_struct.chunk_size = pl->chunk_size;
+    bulk_write_out_struct.pipeline_size = pl->pipeline_size;
+    bulk_write_out_struct.compute_result = pl->compute_result;
+    bulk_write_out_struct.compute_time = pl->compute_time;
+    bulk_write_out_struct.budget = pl->hg_test_info->budget;
+    if (pl->adaptive)
+        __atomic_store_n(&hg_test_adapt_point_g[pl->context_id],
+            HG_TEST_ADAPT_PACK(pl->chunk_size, pl->pipeline_size),
+            __ATOMIC_RELAXED);
+
+    if (pl->hg_test_info->numa)
+        hg_test_numa_account(pl->hg_test_info->numa, pl->context_id,
+            pl->total_bytes_read);
+
+    ret = HG_Respond(pl->handle, NULL, NULL, &bulk_write_out_struct);
+    if (ret != HG_SUCCESS) {
+        fprintf(stderr, "Could not respond\n");
+    }
+    ret = HG_Destroy(pl->handle);
+    if (ret != HG_SUCCESS) {
+        fprintf(stderr, "Could clean handle\n");
+    }
+    HG_Bulk_free(pl->origin_bulk_handle);
+    bulk_pool_return(pl->pool, pl->pool_buf);
+    hg_thread_mutex_destroy(&pl->mutex);
+    free(pl);
+
+    /* May start transfers that were waiting for this memory */
+    if (admission)
+        hg_test_admission_release(admission, admitted);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_sync_cb(union sigval sig)
+{
+    pipe_args_t *pl = sig.sival_ptr;
+
+    if (aio_error(&pl->sync_acb) != 0 || aio_return(&pl->sync_acb) != 0)
+        pl->write_error = HG_TRUE;
+    hg_test_pipeline_respond(pl);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Ack once every chunk is pulled, processed and, in durable mode, written
+ * and synced according to the sync policy. Called from the progress thread,
+ * the executor workers and the aio completion threads, whichever sees the
+ * last piece done. */
+static void
+hg_test_pipeline_try_finish(pipe_args_t *pl)
+{
+    struct hg_test_info *hg_test_info = pl->hg_test_info;
+    hg_bool_t finish;
+
+    hg_thread_mutex_lock(&pl->mutex);
+    finish = pl->pulled && pl->chunks_inflight == 0 && pl->writes_inflight == 0
+        && !pl->responding;
+    if (finish)
+        pl->responding = HG_TRUE;
+    hg_thread_mutex_unlock(&pl->mutex);
+    if (!finish)
+        return;
+
+    if (pl->checksum_type == HG_TEST_CHECKSUM_CRC32C && !pl->pull_error
+        && pl->crc != pl->checksum) {
+        fprintf(stderr, "Checksum mismatch in bulk transfer, got %08x, "
+            "was expecting %08x!\n", pl->crc, pl->checksum);
+        pl->checksum_error = HG_TRUE;
+    }
+
+    if (pl->durable && !pl->write_error && !pl->pull_error
+        && hg_test_info->durable_sync != HG_TEST_SYNC_NONE) {
+        memset(&pl->sync_acb, 0, sizeof(pl->sync_acb));
+        pl->sync_acb.aio_fildes = hg_test_info->durable_fd;
+        pl->sync_acb.aio_sigevent.sigev_notify = SIGEV_THREAD;
+        pl->sync_acb.aio_sigevent.sigev_notify_function =
+            hg_test_pipeline_sync_cb;
+        pl->sync_acb.aio_sigevent.sigev_value.sival_ptr = pl;
+        if (aio_fsync(hg_test_info->durable_sync == HG_TEST_SYNC_FSYNC
+            ? O_SYNC : O_DSYNC, &pl->sync_acb) == 0)
+            return;
+        /* Could not queue it, sync inline */
+        if ((hg_test_info->durable_sync == HG_TEST_SYNC_FSYNC
+            ? fsync(hg_test_info->durable_fd)
+            : fdatasync(hg_test_info->durable_fd)) != 0)
+            pl->write_error = HG_TRUE;
+    }
+    hg_test_pipeline_respond(pl);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_disk_write_done(pipe_args_t *pl, hg_bool_t error)
+{
+    hg_thread_mutex_lock(&pl->mutex);
+    pl->writes_inflight--;
+    if (error)
+        pl->write_error = HG_TRUE;
+    hg_thread_mutex_unlock(&pl->mutex);
+
+    hg_test_pipeline_try_finish(pl);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_disk_write_cb(union sigval sig)
+{
+    pipe_write_args_t *wag = sig.sival_ptr;
+    pipe_args_t *pl = wag->info;
+    hg_bool_t error;
+
+    error = aio_error(&wag->acb) != 0
+        || aio_return(&wag->acb) != (ssize_t) wag->acb.aio_nbytes;
+    free(wag);
+    hg_test_pipeline_disk_write_done(pl, error);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Write a pulled chunk to its offset in the target file while later chunks
+ * are still being pulled. Chunks are aligned as long as the chunk size is,
+ * only the tail of a transfer goes through the buffered descriptor. */
+static void
+hg_test_pipeline_disk_write(pipe_args_t *pl, void *buf, size_t offset,
+    size_t len)
+{
+    struct hg_test_info *hg_test_info = pl->hg_test_info;
+    pipe_write_args_t *wag;
+    off_t file_offset = (off_t) (pl->durable_base + offset);
+    int fd = hg_test_info->durable_fd;
+    ssize_t nwrite;
+
+    if (hg_test_info->durable_direct_fd >= 0
+        && file_offset % MERCURY_TESTING_DIRECT_ALIGN == 0
+        && len % MERCURY_TESTING_DIRECT_ALIGN == 0
+        && (size_t) buf % MERCURY_TESTING_DIRECT_ALIGN == 0)
+        fd = hg_test_info->durable_direct_fd;
+
+    hg_thread_mutex_lock(&pl->mutex);
+    pl->writes_inflight++;
+    hg_thread_mutex_unlock(&pl->mutex);
+
+    wag = (pipe_write_args_t *) calloc(1, sizeof(pipe_write_args_t));
+    if (wag) {
+        wag->info = pl;
+        wag->acb.aio_fildes = fd;
+        wag->acb.aio_offset = file_offset;
+        wag->acb.aio_buf = buf;
+        wag->acb.aio_nbytes = len;
+        wag->acb.aio_sigevent.sigev_notify = SIGEV_THREAD;
+        wag->acb.aio_sigevent.sigev_notify_function =
+            hg_test_pipeline_disk_write_cb;
+        wag->acb.aio_sigevent.sigev_value.sival_ptr = wag;
+        if (aio_write(&wag->acb) == 0)
+            return;
+        free(wag);
+    }
+
+    /* Could not queue it, write inline */
+    nwrite = pwrite(fd, buf, len, file_offset);
+    hg_test_pipeline_disk_write_done(pl, nwrite != (ssize_t) len);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Everything done with a pulled chunk: check it, run the compute stage on
+ * it, then hand it to the disk. Runs on the executor when there is one, on
+ * the progress thread otherwise. */
+static void
+hg_test_pipeline_process(pipe_args_t *pl, void *buf, size_t offset,
+    size_t len)
+{
+    hg_time_t t1, t2;
+    hg_uint32_t crc;
+    hg_uint64_t result;
+
+    if (pl->checksum_type == HG_TEST_CHECKSUM_CRC32C) {
+        /* Chunks complete in any order, place each one by the number of
+         * bytes following it */
+        crc = crc32c_combine(crc32c(0, buf, len), 0,
+            pl->bulk_write_nbytes - offset - len);
+        hg_thread_mutex_lock(&pl->mutex);
+        pl->crc ^= crc;
+        hg_thread_mutex_unlock(&pl->mutex);
+    } else if (!pl->compute)
+        bulk_write(buf, offset, len, 0);
+
+    if (pl->compute) {
+        hg_time_get_current(&t1);
+        result = pl->compute->chunk(buf, offset, len);
+        hg_time_get_current(&t2);
+
+        hg_thread_mutex_lock(&pl->mutex);
+        pl->compute_result = pl->compute->combine(pl->compute_result, result);
+        pl->compute_time += (hg_uint64_t)
+            (hg_time_to_double(hg_time_subtract(t2, t1)) * 1e9);
+        hg_thread_mutex_unlock(&pl->mutex);
+    }
+
+    if (pl->durable)
+        hg_test_pipeline_disk_write(pl, buf, offset, len);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_process_task(struct hg_test_task *task)
+{
+    pipe_chunk_args_t *chk = (pipe_chunk_args_t *) task;
+    pipe_args_t *pl = chk->info;
+
+    hg_test_pipeline_process(pl, chk->buf, chk->offset, chk->len);
+    free(chk);
+
+    hg_thread_mutex_lock(&pl->mutex);
+    pl->chunks_inflight--;
+    hg_thread_mutex_unlock(&pl->mutex);
+    hg_test_pipeline_try_finish(pl);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Hand a pulled chunk to the executor so that the progress thread only
+ * drives the network, or process it inline if there is none */
+static void
+hg_test_pipeline_dispatch(pipe_args_t *pl, void *buf, size_t offset,
+    size_t len)
+{
+    struct hg_test_executor *executor = pl->hg_test_info->executor;
+    pipe_chunk_args_t *chk;
+
+    if (executor) {
+        chk = (pipe_chunk_args_t *) malloc(sizeof(pipe_chunk_args_t));
+        if (chk) {
+            chk->task.func = hg_test_pipeline_process_task;
+            chk->info = pl;
+            chk->buf = buf;
+            chk->offset = offset;
+            chk->len = len;
+            hg_thread_mutex_lock(&pl->mutex);
+            pl->chunks_inflight++;
+            hg_thread_mutex_unlock(&pl->mutex);
+            if (hg_test_executor_submit(executor, &chk->task) == 0)
+                return;
+            hg_thread_mutex_lock(&pl->mutex);
+            pl->chunks_inflight--;
+            hg_thread_mutex_unlock(&pl->mutex);
+            free(chk);
+        }
+    }
+    hg_test_pipeline_process(pl, buf, offset, len);
+}
+
+/*---------------------------------------------------------------------------*/
 static hg_return_t
 hg_test_pipeline_transfer_cb(const struct hg_cb_info *hg_cb_info)
 {
-	double time_read;
-	hg_time_t t1, t2;
-	
-	pipe_cb_args_t *cag = hg_cb_info->arg;
-	pipe_args_t *pl = cag->info;
-	hg_return_t ret;
-	pl->total_bytes_read += pl->chunk_size;
-	pl->next_pipeline++;
-	
-	int offset = cag->offset;
-	t1 = cag->stime;
-	
-	void * buf;
+    pipe_cb_args_t *cag = hg_cb_info->arg;
+    pipe_args_t *pl = cag->info;
+    size_t offset = cag->offset;
+    size_t len = cag->chunk_size;
+    hg_time_t now;
+    void *buf;
+    hg_return_t ret = HG_SUCCESS;
 
-	HG_Bulk_access(pl->local_bulk_handle, 0,
-        	pl->bulk_write_nbytes, HG_BULK_READWRITE, 1, &buf, NULL, NULL);
-	
-	if (pl->total_bytes_read >= pl->bulk_write_nbytes) {
-		/* fill output structure */
-    		bulk_write_out_t  bulk_write_out_struct;
-		bulk_write_out_struct.ret = ret;
-		ret = bulk_write(buf, cag->offset, cag->chunk_size, 0);
-    		ret = HG_Respond(pl->handle, NULL, NULL, &bulk_write_out_struct);
-    		if (ret != HG_SUCCESS) {
-			fprintf(stderr, "Could not respond\n");
-		}
-    		ret = HG_Destroy(pl->handle);
-		if (ret != HG_SUCCESS) {
-			fprintf(stderr, "Could clean handle\n");
-		}
-		HG_Bulk_free(pl->local_bulk_handle);
-		free(pl->buf);
-		free(pl);
-    	}else if (pl->next_pipeline <= pl->num_pipeline) {
-		size_t chunk_size = pl->bulk_write_nbytes - pl->total_bytes_read;
-		chunk_size = chunk_size > pl->chunk_size ? pl->chunk_size : chunk_size;
-		cag->chunk_size = chunk_size;
-		cag->offset = pl->write_offset;
-		
-		hg_time_get_current(&cag->stime);
-		
-		ret = HG_Bulk_transfer(pl->hg_info->context, hg_test_pipeline_transfer_cb,
-        			(void*)cag, HG_BULK_PULL, pl->hg_info->addr,
-				pl->origin_bulk_handle, pl->write_offset,
-            			pl->local_bulk_handle, pl->write_offset,
-				chunk_size, HG_OP_ID_IGNORE);
- 		if (ret != HG_SUCCESS) {
-        	    fprintf(stderr, "Could not read bulk data\n");
-       		    return ret;
-        	}
-		ret = bulk_write(buf, cag->offset, cag->chunk_size, 0);
-		pl->write_offset += pl->chunk_size;
-	}else{
-		ret = bulk_write(buf, cag->offset, cag->chunk_size, 0);
-		free(cag);
-	}
-	
-	hg_time_get_current(&t2);
-	time_read = hg_time_to_double(hg_time_subtract(t2, t1));
-	/*
-	printf("Num %d: Time: %f %f %f\n", offset,
-		hg_time_to_double(t1) - 27223000, hg_time_to_double(t2) - 27223000,
-		time_read);
-	*/
-	return HG_SUCCESS;
+    hg_time_get_current(&now);
+    pl->inflight--;
+
+    /* Nothing of a chunk that did not arrive is written, checksummed or
+     * acked, the request is answered once the others are in */
+    if (hg_cb_info->ret != HG_SUCCESS) {
+        pl->pull_error = HG_TRUE;
+        free(cag);
+    } else {
+        pl->total_bytes_read += len;
+        HG_Bulk_access(pl->local_bulk_handle, offset,
+            len, HG_BULK_READWRITE, 1, &buf, NULL, NULL);
+
+        if (pl->adaptive)
+            hg_test_pipeline_adapt(pl, cag, now);
+
+        /* Keep the pipeline full, reusing this chunk's descriptor, before
+         * working on the chunk so the rest of the transfer stays in
+         * flight. After a failed post only the chunks still in flight are
+         * waited for. */
+        if (pl->pull_error)
+            free(cag);
+        else {
+            ret = hg_test_pipeline_fill(pl, cag);
+            if (ret != HG_SUCCESS)
+                pl->pull_error = HG_TRUE;
+        }
+        hg_test_pipeline_dispatch(pl, buf, offset, len);
+    }
+
+    if (pl->inflight == 0) {
+        /* pl may be gone once this returns */
+        hg_thread_mutex_lock(&pl->mutex);
+        pl->pulled = HG_TRUE;
+        hg_thread_mutex_unlock(&pl->mutex);
+        hg_test_pipeline_try_finish(pl);
+    }
+
+    return ret;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -409,26 +860,143 @@ static void pipeline_bulk_write(double sleep_time, int check_request) {
 
 
 
+/*---------------------------------------------------------------------------*/
+/* Answer a transfer that pulled nothing, with ret 0, and release what it
+ * holds. Nothing but the admission and the origin handle is held yet. */
+static void
+hg_test_pipeline_abort(pipe_args_t *args)
+{
+    struct hg_test_admission *admission = args->hg_test_info->admission;
+    hg_uint64_t admitted = args->admission.bytes;
+    bulk_write_out_t bulk_write_out_struct;
+
+    memset(&bulk_write_out_struct, 0, sizeof(bulk_write_out_struct));
+    bulk_write_out_struct.budget = args->hg_test_info->budget;
+    if (HG_Respond(args->handle, NULL, NULL, &bulk_write_out_struct)
+        != HG_SUCCESS)
+        fprintf(stderr, "Could not respond\n");
+    HG_Destroy(args->handle);
+    HG_Bulk_free(args->origin_bulk_handle);
+    free(args);
+
+    if (admission)
+        hg_test_admission_release(admission, admitted);
+}
+
+/*---------------------------------------------------------------------------*/
+/* Check out the target buffer and start pulling, once admitted. The
+ * request is answered here if that fails. */
+static hg_return_t
+hg_test_pipeline_start(pipe_args_t *args)
+{
+    hg_return_t ret;
+
+    /* Nothing to pull */
+    if (args->bulk_write_nbytes == 0) {
+        hg_test_pipeline_abort(args);
+        return HG_SUCCESS;
+    }
+
+    /* Check out a registered block handle to read the data */
+    //args->local_bulk_handle = args->hg_test_info->bulk_handle;
+    args->pool = args->hg_test_info->context_pools[args->context_id];
+    args->pool_buf = bulk_pool_checkout(args->pool,
+            args->bulk_write_nbytes);
+    if (!args->pool_buf) {
+        fprintf(stderr, "Could not get bulk buffer\n");
+        hg_test_pipeline_abort(args);
+        return HG_NOMEM_ERROR;
+    }
+    args->buf = args->pool_buf->buffer;
+    args->local_bulk_handle = args->pool_buf->bulk_handle;
+    args->total_bytes_read = 0;
+    args->adaptive = args->hg_test_info->adaptive_pipeline;
+    if (args->adaptive) {
+        /* Start from the last operating point, but split small transfers so
+         * that there is still something to pipeline */
+        hg_uint64_t point = __atomic_load_n(
+            &hg_test_adapt_point_g[args->context_id], __ATOMIC_RELAXED);
+
+        args->chunk_size = point ? (size_t) (point >> 8) : MIN_BUFFER_SIZE;
+        args->pipeline_size = point ? (unsigned int) (point & 0xff)
+            : PIPELINE_SIZE;
+        while (args->chunk_size > PIPELINE_ADAPT_MIN_CHUNK_SIZE
+            && args->chunk_size * args->pipeline_size
+                > args->bulk_write_nbytes)
+            args->chunk_size /= 2;
+    } else {
+        args->chunk_size = MIN_BUFFER_SIZE;
+        args->pipeline_size = PIPELINE_SIZE;
+    }
+    args->adapt_state = HG_TEST_ADAPT_CHUNK;
+    args->best_bandwidth = 0;
+
+    /* Reserve an aligned range of the target file for this transfer */
+    args->durable = args->hg_test_info->durable_fd >= 0;
+    if (args->durable)
+        args->durable_base = __atomic_fetch_add(
+            &args->hg_test_info->durable_offset,
+            (args->bulk_write_nbytes + MERCURY_TESTING_DIRECT_ALIGN - 1)
+                & ~((hg_uint64_t) MERCURY_TESTING_DIRECT_ALIGN - 1),
+            __ATOMIC_RELAXED);
+    hg_thread_mutex_init(&args->mutex);
+    args->pulled = HG_FALSE;
+    args->pull_error = HG_FALSE;
+    args->writes_inflight = 0;
+    args->write_error = HG_FALSE;
+    args->responding = HG_FALSE;
+    args->epoch = 0;
+    hg_time_get_current(&args->epoch_start);
+    hg_test_pipeline_new_epoch(args, args->epoch_start);
+
+    args->num_pipeline  = (args->bulk_write_nbytes - 1) / args->chunk_size + 1;
+
+    /* Initialize pipeline */
+    args->write_offset = 0;
+    args->next_pipeline = 0;
+    args->inflight = 0;
+    ret = hg_test_pipeline_fill(args, NULL);
+    if (ret != HG_SUCCESS) {
+        args->pull_error = HG_TRUE;
+        /* Nothing in flight to finish the transfer, answer it now */
+        if (args->inflight == 0) {
+            args->pulled = HG_TRUE;
+            hg_test_pipeline_try_finish(args);
+        }
+    }
+
+    return ret;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hg_test_pipeline_admitted(struct hg_test_admission_waiter *waiter)
+{
+    pipe_args_t *pl = (pipe_args_t *) ((char *) waiter
+        - offsetof(pipe_args_t, admission));
+
+    hg_test_pipeline_start(pl);
+}
+
 /*---------------------------------------------------------------------------*/
 HG_TEST_RPC_CB(hg_test_pipeline_write, handle)
 {
     bulk_write_in_t  bulk_write_in_struct;
-    int pipeline_iter;
     hg_return_t ret = HG_SUCCESS;
-    //hg_return_t ret;
     pipe_args_t * args = malloc(sizeof(pipe_args_t));
-    size_t pipeline_size;
-	
+
     /* Get info from handle */
     args->hg_info = HG_Get_info(handle);
 
     /* Get test info */
     args->hg_test_info = (struct hg_test_info *) HG_Class_get_data(args->hg_info->hg_class);
+    args->context_id = HG_Context_get_id(args->hg_info->context);
 
     /* Get input struct */
     ret = HG_Get_input(handle, &bulk_write_in_struct);
     if (ret != HG_SUCCESS) {
         fprintf(stderr, "Could not get input struct\n");
+        free(args);
         return ret;
     }
 
@@ -438,57 +1006,28 @@ HG_TEST_RPC_CB(hg_test_pipeline_write, handle)
     /* Get parameters */
     /* unused bulk_write_fildes = bulk_write_in_struct.fildes; */
     args->origin_bulk_handle  = bulk_write_in_struct.bulk_handle;
+    args->checksum_type = bulk_write_in_struct.checksum_type;
+    args->checksum = bulk_write_in_struct.checksum;
+    args->crc = 0;
+    args->checksum_error = HG_FALSE;
+    args->compute = args->hg_test_info->compute;
+    args->compute_result = args->compute ? args->compute->identity : 0;
+    args->compute_time = 0;
+    args->chunks_inflight = 0;
 
     HG_Bulk_ref_incr(args->origin_bulk_handle);
     HG_Free_input(handle, &bulk_write_in_struct);
 
-    /* Create a new block handle to read the data */
+    /* Pull nothing before the transfer fits in the memory budget */
     args->bulk_write_nbytes = HG_Bulk_get_size(args->origin_bulk_handle);
-    //args->local_bulk_handle = args->hg_test_info->bulk_handle;   
-    args->buf = malloc(args->bulk_write_nbytes);	
-    HG_Bulk_create(args->hg_info->hg_class, 1, &args->buf, &args->bulk_write_nbytes,
-            HG_BULK_READWRITE, &args->local_bulk_handle);
-    args->total_bytes_read = 0;
-    args->chunk_size = MIN_BUFFER_SIZE;
-    
-    args->num_pipeline  = (args->bulk_write_nbytes - 1) / args->chunk_size + 1;
-    pipeline_size = args->num_pipeline > PIPELINE_SIZE ? PIPELINE_SIZE : args->num_pipeline;
-
-    /* Initialize pipeline */
-    args->write_offset = 0;
-    args->next_pipeline = 0;
-    for (pipeline_iter = 0; pipeline_iter < pipeline_size; pipeline_iter++) {
-	size_t chunk_size;
-	if (pipeline_iter == pipeline_size - 1){
-	    chunk_size = args->bulk_write_nbytes > pipeline_size * args->chunk_size ?
-		args->chunk_size : args->bulk_write_nbytes - pipeline_iter * args->chunk_size;
-	}else{
-	    chunk_size = args->chunk_size;
-	}
-	pipe_cb_args_t * cag = (pipe_cb_args_t*)malloc(sizeof(pipe_cb_args_t));
-	cag->info = args;
-	cag->offset = args->write_offset;
-	cag->chunk_size = chunk_size;
-	
-	hg_time_get_current(&cag->stime);
-	
-	ret = HG_Bulk_transfer(args->hg_info->context, hg_test_pipeline_transfer_cb,
-   		(void*)cag, HG_BULK_PULL, args->hg_info->addr,
-		args->origin_bulk_handle, args->write_offset,
-      		args->local_bulk_handle, args->write_offset, chunk_size,
-       		HG_OP_ID_IGNORE);
-       		//&id);
-	if (ret != HG_SUCCESS) {
-       	    fprintf(stderr, "Could not read bulk data\n");
-	    return ret;
-        }
-	//printf("%d\n", args->write_offset);
-	args->write_offset += args->chunk_size;
-    	args->next_pipeline++;
-    }
-    
-    //return ret;
-    return HG_SUCCESS;
+    args->admission.func = hg_test_pipeline_admitted;
+    args->admission.bytes = args->bulk_write_nbytes;
+    if (args->hg_test_info->admission
+        && !hg_test_admission_acquire(args->hg_test_info->admission,
+            &args->admission))
+        return HG_SUCCESS;
+
+    return hg_test_pipeline_start(args);
 }
 
 /*---------------------------------------------------------------------------*/
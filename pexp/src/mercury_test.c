@@ -17,6 +17,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 /****************/
 /* Local Macros */
@@ -40,6 +43,12 @@ hg_test_parse_options(int argc, char *argv[],
 static void
 hg_test_register(hg_class_t *hg_class);
 
+static int
+hg_test_request_progress(unsigned int timeout, void *arg);
+
+static int
+hg_test_request_trigger(unsigned int timeout, unsigned int *flag, void *arg);
+
 /*******************/
 /* Local Variables */
 /*******************/
@@ -59,6 +68,24 @@ static void
 hg_test_usage(const char *execname)
 {
     na_test_usage(execname);
+    printf("    HG OPTIONS\n");
+    printf("    -t, --threads       Number of threads used in threaded tests\n");
+    printf("    -A, --adaptive      Tune pipeline chunk size and depth per transfer\n");
+    printf("    -D, --durable       Write pipelined transfers to this file before acking\n");
+    printf("    -Y, --sync          Sync policy of durable writes: none, fdatasync (default), fsync\n");
+    printf("    -O, --direct        Use O_DIRECT for aligned durable writes\n");
+    printf("    -F, --format        Output of perf results: text (default), csv, json\n");
+    printf("    -C, --checksum      Check pipelined transfers with CRC32C instead of the test pattern\n");
+    printf("    -X, --compute       Run this stage on each pipelined chunk: sum, max, verify, invert\n");
+    printf("    -W, --workers       Process pipelined chunks on this many workers, 0 for one per core\n");
+    printf("    -P, --contexts      Server: progress contexts, one thread each, client: spread handles over them\n");
+    printf("    -I, --target_id     Client: send every request to this context id\n");
+    printf("    -M, --budget        Server: MB of pipelined transfers held at once, 0 for no bound (default %d)\n",
+        (int) (MERCURY_TESTING_DEFAULT_BUDGET >> 20));
+    printf("    -B, --spin          Poll up to this many us before blocking in progress, 0 (default) always blocks\n");
+    printf("    -G, --hugepages     Back bulk buffers with: none (default), thp, 2m, 1g (falls back to smaller pages)\n");
+    printf("    -R, --prefault      Fault bulk buffers in before registering them\n");
+    printf("    -N, --numa          Place contexts and their bulk buffers: off (default), nic (node of the NIC), spread (over nodes, from the NIC's), or a node\n");
 }
 
 /*---------------------------------------------------------------------------*/
@@ -67,6 +94,15 @@ hg_test_parse_options(int argc, char *argv[], struct hg_test_info *hg_test_info)
 {
     int opt;
 
+    hg_test_info->durable_sync = HG_TEST_SYNC_FDATASYNC;
+    hg_test_info->durable_fd = -1;
+    hg_test_info->durable_direct_fd = -1;
+    hg_test_info->workers = -1;
+    hg_test_info->context_count = 1;
+    hg_test_info->target_id = -1;
+    hg_test_info->budget = MERCURY_TESTING_DEFAULT_BUDGET;
+    hg_test_info->numa_policy = HG_TEST_NUMA_OFF;
+
     /* Parse pre-init info */
     if (argc < 2) {
         hg_test_usage(argv[0]);
@@ -86,6 +122,96 @@ hg_test_parse_options(int argc, char *argv[], struct hg_test_info *hg_test_info)
                 hg_test_info->thread_count =
                     (unsigned int) atoi(na_test_opt_arg_g);
                 break;
+            case 'A': /* adaptive pipeline */
+                hg_test_info->adaptive_pipeline = HG_TRUE;
+                break;
+            case 'D': /* durable pipeline target */
+                hg_test_info->durable_path = na_test_opt_arg_g;
+                break;
+            case 'Y': /* durable sync policy */
+                if (strcmp(na_test_opt_arg_g, "none") == 0)
+                    hg_test_info->durable_sync = HG_TEST_SYNC_NONE;
+                else if (strcmp(na_test_opt_arg_g, "fsync") == 0)
+                    hg_test_info->durable_sync = HG_TEST_SYNC_FSYNC;
+                else if (strcmp(na_test_opt_arg_g, "fdatasync") == 0)
+                    hg_test_info->durable_sync = HG_TEST_SYNC_FDATASYNC;
+                else {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'O': /* O_DIRECT */
+                hg_test_info->direct_io = HG_TRUE;
+                break;
+            case 'F': /* output format */
+                if (strcmp(na_test_opt_arg_g, "text") == 0)
+                    hg_test_info->output_format = HG_TEST_OUTPUT_TEXT;
+                else if (strcmp(na_test_opt_arg_g, "csv") == 0)
+                    hg_test_info->output_format = HG_TEST_OUTPUT_CSV;
+                else if (strcmp(na_test_opt_arg_g, "json") == 0)
+                    hg_test_info->output_format = HG_TEST_OUTPUT_JSON;
+                else {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'C': /* end-to-end checksum */
+                hg_test_info->checksum = HG_TRUE;
+                break;
+            case 'P': /* progress contexts */
+                hg_test_info->context_count =
+                    (unsigned int) atoi(na_test_opt_arg_g);
+                if (hg_test_info->context_count < 1
+                    || hg_test_info->context_count
+                        > MERCURY_TESTING_MAX_CONTEXTS) {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'I': /* target context id */
+                hg_test_info->target_id = atoi(na_test_opt_arg_g);
+                if (hg_test_info->target_id < 0
+                    || hg_test_info->target_id
+                        >= MERCURY_TESTING_MAX_CONTEXTS) {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'M': /* memory budget */
+                hg_test_info->budget =
+                    (hg_uint64_t) strtoull(na_test_opt_arg_g, NULL, 0) << 20;
+                break;
+            case 'B': /* progress spin budget */
+                hg_test_info->spin_us = (unsigned int) atoi(na_test_opt_arg_g);
+                break;
+            case 'G': /* huge page backing */
+                hg_test_info->mem_backing = bulk_mem_parse(na_test_opt_arg_g);
+                if (hg_test_info->mem_backing < 0) {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'R': /* prefault bulk buffers */
+                hg_test_info->prefault = HG_TRUE;
+                break;
+            case 'N': /* NUMA placement */
+                hg_test_info->numa_policy =
+                    hg_test_numa_parse(na_test_opt_arg_g);
+                if (hg_test_info->numa_policy == HG_TEST_NUMA_INVALID) {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'W': /* chunk processing executor */
+                hg_test_info->workers = atoi(na_test_opt_arg_g);
+                break;
+            case 'X': /* per-chunk compute stage */
+                hg_test_info->compute = hg_test_compute_find(na_test_opt_arg_g);
+                if (!hg_test_info->compute) {
+                    hg_test_usage(argv[0]);
+                    exit(1);
+                }
+                break;
             default:
                 break;
         }
@@ -96,6 +222,33 @@ hg_test_parse_options(int argc, char *argv[], struct hg_test_info *hg_test_info)
         hg_test_info->thread_count = MERCURY_TESTING_NUM_THREADS_DEFAULT;
 }
 
+/*---------------------------------------------------------------------------*/
+/* Request class callbacks of a client polling with -B */
+static int
+hg_test_request_progress(unsigned int timeout, void *arg)
+{
+    struct progress_driver *driver = (struct progress_driver *) arg;
+
+    return (progress_driver_progress(driver, timeout) == HG_SUCCESS) ?
+        HG_UTIL_SUCCESS : HG_UTIL_FAIL;
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+hg_test_request_trigger(unsigned int timeout, unsigned int *flag, void *arg)
+{
+    struct progress_driver *driver = (struct progress_driver *) arg;
+    unsigned int actual_count = 0;
+    int ret = HG_UTIL_SUCCESS;
+
+    if (HG_Trigger(driver->context, timeout, 1, &actual_count) != HG_SUCCESS)
+        ret = HG_UTIL_FAIL;
+    driver->stats.triggered += actual_count;
+    *flag = (actual_count) ? HG_UTIL_TRUE : HG_UTIL_FALSE;
+
+    return ret;
+}
+
 /*---------------------------------------------------------------------------*/
 static void
 hg_test_register(hg_class_t *hg_class)
@@ -129,8 +282,27 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
     if (hg_test_info->auth) {
     }
 
+    /* Bind the main thread, which drives context 0, before anything is
+     * allocated so that NA and Mercury memory lands on its node too */
+    if (hg_test_info->numa_policy != HG_TEST_NUMA_OFF) {
+        hg_test_info->numa = hg_test_numa_create(hg_test_info->numa_policy,
+            hg_test_info->na_test_info.hostname, hg_test_info->context_count);
+        if (!hg_test_info->numa)
+            fprintf(stderr, "# No NUMA topology or no such node, "
+                "placement disabled\n");
+        else {
+            printf("# NUMA: %d nodes, NIC on node %d, context 0 on node %d\n",
+                hg_test_numa_node_count(hg_test_info->numa),
+                hg_test_numa_nic_node(hg_test_info->numa),
+                hg_test_numa_context_node(hg_test_info->numa, 0));
+            hg_test_numa_bind_self(hg_test_info->numa, 0);
+        }
+    }
+
     /* Initialize NA test layer */
     hg_test_info->na_test_info.extern_init = NA_TRUE;
+    hg_test_info->na_test_info.max_contexts =
+        (int) hg_test_info->context_count;
 
     if (NA_Test_init(argc, argv, &hg_test_info->na_test_info) != NA_SUCCESS) {
         HG_LOG_ERROR("Could not initialize NA test layer");
@@ -145,6 +317,8 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
     else
         hg_init_info.na_init_info.progress_mode = NA_DEFAULT;
 
+    hg_init_info.na_init_info.max_contexts =
+        hg_test_info->na_test_info.max_contexts;
     hg_init_info.na_class = hg_test_info->na_test_info.na_class;
 
     ret = HG_Hl_init_opt(NULL, 0, &hg_init_info);
@@ -156,6 +330,26 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
     hg_test_info->context = HG_CONTEXT_DEFAULT;
     hg_test_info->request_class = HG_REQUEST_CLASS_DEFAULT;
 
+    /* Waits of a client poll before blocking, see progress_driver.h */
+    if (!hg_test_info->na_test_info.listen && hg_test_info->spin_us) {
+        hg_test_info->progress = (struct progress_driver *) malloc(
+            sizeof(struct progress_driver));
+        if (!hg_test_info->progress) {
+            ret = HG_NOMEM_ERROR;
+            goto done;
+        }
+        progress_driver_init(hg_test_info->progress, hg_test_info->context,
+            hg_test_info->spin_us, 0);
+        hg_test_info->request_class = hg_request_class_create(
+            hg_test_request_progress, hg_test_request_trigger,
+            hg_test_info->progress);
+        if (!hg_test_info->request_class) {
+            HG_LOG_ERROR("Could not create request class");
+            ret = HG_OTHER_ERROR;
+            goto done;
+        }
+    }
+
 /*
 	hg_test_info->hg_class = HG_Init("mpi+dynamic", HG_TRUE);
 	hg_test_info->context = HG_Context_create(hg_test_info->hg_class);
@@ -171,7 +365,25 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
         || hg_test_info->na_test_info.self_send) {
         size_t bulk_size = 1024 * 1024 * MERCURY_TESTING_BUFFER_SIZE;
         char *buf_ptr;
-        size_t i;
+        unsigned int i;
+
+        /* Additional contexts, each driven by its own thread in server.c */
+        hg_test_info->contexts = (hg_context_t **) calloc(
+            hg_test_info->context_count, sizeof(hg_context_t *));
+        if (!hg_test_info->contexts) {
+            ret = HG_NOMEM_ERROR;
+            goto done;
+        }
+        hg_test_info->contexts[0] = hg_test_info->context;
+        for (i = 1; i < hg_test_info->context_count; i++) {
+            hg_test_info->contexts[i] = HG_Context_create_id(
+                hg_test_info->hg_class, (hg_uint8_t) i);
+            if (!hg_test_info->contexts[i]) {
+                HG_LOG_ERROR("Could not create context %u", i);
+                ret = HG_OTHER_ERROR;
+                goto done;
+            }
+        }
 
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
         /* Create thread pool */
@@ -190,8 +402,104 @@ HG_Test_init(int argc, char *argv[], struct hg_test_info *hg_test_info)
             &hg_test_info->bulk_handle);
         HG_Bulk_access(hg_test_info->bulk_handle, 0, bulk_size,
             HG_BULK_READWRITE, 1, (void **) &buf_ptr, NULL, NULL);
-        for (i = 0; i < bulk_size; i++)
-            buf_ptr[i] = (char) i;
+        hg_test_pattern_fill(buf_ptr, 0, bulk_size);
+
+        /* Create pool of registered buffers used as bulk pull targets */
+        hg_test_info->bulk_pool = bulk_pool_create(hg_test_info->hg_class,
+            MERCURY_TESTING_POOL_MIN_SIZE, bulk_size,
+            MERCURY_TESTING_POOL_MAX_CACHED);
+        if (!hg_test_info->bulk_pool) {
+            HG_LOG_ERROR("Could not create bulk pool");
+            ret = HG_NOMEM_ERROR;
+            goto done;
+        }
+        bulk_pool_set_backing(hg_test_info->bulk_pool,
+            hg_test_info->mem_backing, hg_test_info->prefault);
+
+        /* With NUMA placement, each context pulls into a pool of its node,
+         * bulk_pool is then only that of node-less contexts */
+        hg_test_info->context_pools = (struct bulk_pool **) calloc(
+            hg_test_info->context_count, sizeof(struct bulk_pool *));
+        if (!hg_test_info->context_pools) {
+            ret = HG_NOMEM_ERROR;
+            goto done;
+        }
+        for (i = 0; i < hg_test_info->context_count; i++)
+            hg_test_info->context_pools[i] = hg_test_info->bulk_pool;
+        if (hg_test_info->numa) {
+            hg_test_info->node_pools = (struct bulk_pool **) calloc(
+                (size_t) hg_test_numa_node_count(hg_test_info->numa),
+                sizeof(struct bulk_pool *));
+            if (!hg_test_info->node_pools) {
+                ret = HG_NOMEM_ERROR;
+                goto done;
+            }
+        }
+        for (i = 0; hg_test_info->numa && i < hg_test_info->context_count;
+            i++) {
+            int node = hg_test_numa_context_node(hg_test_info->numa, i);
+
+            if (!hg_test_info->node_pools[node]) {
+                hg_test_info->node_pools[node] = bulk_pool_create(
+                    hg_test_info->hg_class, MERCURY_TESTING_POOL_MIN_SIZE,
+                    bulk_size, MERCURY_TESTING_POOL_MAX_CACHED);
+                if (!hg_test_info->node_pools[node]) {
+                    HG_LOG_ERROR("Could not create bulk pool of node %d",
+                        node);
+                    ret = HG_NOMEM_ERROR;
+                    goto done;
+                }
+                bulk_pool_set_backing(hg_test_info->node_pools[node],
+                    hg_test_info->mem_backing, hg_test_info->prefault);
+                bulk_pool_set_node(hg_test_info->node_pools[node], node);
+            }
+            hg_test_info->context_pools[i] = hg_test_info->node_pools[node];
+        }
+
+        /* Open target of the durable pipeline */
+        if (hg_test_info->durable_path) {
+            hg_test_info->durable_fd = open(hg_test_info->durable_path,
+                O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+            if (hg_test_info->durable_fd < 0) {
+                HG_LOG_ERROR("Could not open %s", hg_test_info->durable_path);
+                ret = HG_OTHER_ERROR;
+                goto done;
+            }
+#ifdef O_DIRECT
+            if (hg_test_info->direct_io) {
+                hg_test_info->durable_direct_fd = open(
+                    hg_test_info->durable_path, O_WRONLY | O_DIRECT);
+                if (hg_test_info->durable_direct_fd < 0)
+                    fprintf(stderr, "# O_DIRECT not supported on %s, "
+                        "using buffered writes\n", hg_test_info->durable_path);
+            }
+#endif
+            hg_test_info->durable_offset = 0;
+        }
+
+        /* Start the workers processing pipelined chunks */
+        if (hg_test_info->workers >= 0) {
+            hg_test_info->executor = hg_test_executor_create(
+                (unsigned int) hg_test_info->workers);
+            if (!hg_test_info->executor) {
+                HG_LOG_ERROR("Could not create executor");
+                ret = HG_NOMEM_ERROR;
+                goto done;
+            }
+            printf("# Processing chunks on %u workers\n",
+                hg_test_executor_size(hg_test_info->executor));
+        }
+
+        /* Bound the memory held by pipelined transfers */
+        if (hg_test_info->budget) {
+            hg_test_info->admission =
+                hg_test_admission_create(hg_test_info->budget);
+            if (!hg_test_info->admission) {
+                HG_LOG_ERROR("Could not create admission control");
+                ret = HG_NOMEM_ERROR;
+                goto done;
+            }
+        }
     }
 
     if (hg_test_info->na_test_info.listen) {
@@ -253,12 +561,108 @@ HG_Test_finalize(struct hg_test_info *hg_test_info)
         /* Destroy bulk handle */
         HG_Bulk_free(hg_test_info->bulk_handle);
 
+        if (hg_test_info->contexts) {
+            unsigned int i;
+
+            for (i = 1; i < hg_test_info->context_count; i++)
+                if (hg_test_info->contexts[i])
+                    HG_Context_destroy(hg_test_info->contexts[i]);
+            free(hg_test_info->contexts);
+        }
+
+        if (hg_test_info->executor) {
+            if (hg_test_info->na_test_info.verbose) {
+                struct hg_test_executor_stats stats;
+
+                hg_test_executor_get_stats(hg_test_info->executor, &stats);
+                printf("# Executor: %lu chunks, %lu stolen\n",
+                    (unsigned long) stats.executed,
+                    (unsigned long) stats.stolen);
+            }
+            hg_test_executor_destroy(hg_test_info->executor);
+        }
+
+        if (hg_test_info->admission) {
+            if (hg_test_info->na_test_info.verbose) {
+                struct hg_test_admission_stats stats;
+
+                hg_test_admission_get_stats(hg_test_info->admission, &stats);
+                printf("# Admission: %lu transfers, %lu deferred (at most "
+                    "%lu waiting), high water %lu MB of %lu MB\n",
+                    (unsigned long) stats.admitted,
+                    (unsigned long) stats.deferred,
+                    (unsigned long) stats.max_queued,
+                    (unsigned long) (stats.high_water >> 20),
+                    (unsigned long) (hg_test_info->budget >> 20));
+            }
+            hg_test_admission_destroy(hg_test_info->admission);
+        }
+
+        if (hg_test_info->na_test_info.verbose) {
+            struct bulk_pool_stats stats;
+
+            bulk_pool_get_stats(hg_test_info->bulk_pool, &stats);
+            printf("# Bulk pool: %lu hits, %lu misses, high water %lu, "
+                "%lu bytes registered\n", (unsigned long) stats.hits,
+                (unsigned long) stats.misses, (unsigned long) stats.high_water,
+                (unsigned long) stats.registered_bytes);
+            printf("# Bulk pool: %s pages%s, %.3f ms allocating and "
+                "registering\n", bulk_mem_name(hg_test_info->mem_backing),
+                hg_test_info->prefault ? " prefaulted" : "",
+                (double) stats.register_ns / 1e6);
+        }
+        bulk_pool_destroy(hg_test_info->bulk_pool);
+
+        if (hg_test_info->node_pools) {
+            int node;
+
+            for (node = 0; node < hg_test_numa_node_count(hg_test_info->numa);
+                node++) {
+                struct bulk_pool_stats stats;
+
+                if (!hg_test_info->node_pools[node])
+                    continue;
+                if (hg_test_info->na_test_info.verbose) {
+                    bulk_pool_get_stats(hg_test_info->node_pools[node],
+                        &stats);
+                    printf("# Bulk pool of node %d: %lu hits, %lu misses, "
+                        "high water %lu, %lu bytes registered\n", node,
+                        (unsigned long) stats.hits,
+                        (unsigned long) stats.misses,
+                        (unsigned long) stats.high_water,
+                        (unsigned long) stats.registered_bytes);
+                }
+                bulk_pool_destroy(hg_test_info->node_pools[node]);
+            }
+            free(hg_test_info->node_pools);
+        }
+        free(hg_test_info->context_pools);
+
+        if (hg_test_info->durable_direct_fd >= 0)
+            close(hg_test_info->durable_direct_fd);
+        if (hg_test_info->durable_fd >= 0)
+            close(hg_test_info->durable_fd);
+
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
         hg_thread_pool_destroy(hg_test_info->thread_pool);
         hg_thread_mutex_destroy(&hg_test_info->bulk_handle_mutex);
 #endif
     }
 
+    if (hg_test_info->numa) {
+        if (hg_test_info->na_test_info.listen)
+            hg_test_numa_print_stats(hg_test_info->numa, stdout);
+        hg_test_numa_destroy(hg_test_info->numa);
+    }
+
+    if (hg_test_info->progress) {
+        if (hg_test_info->na_test_info.verbose)
+            progress_driver_print_stats(hg_test_info->progress, stdout,
+                "Progress");
+        hg_request_class_destroy(hg_test_info->request_class);
+        free(hg_test_info->progress);
+    }
+
     /* Finalize interface */
     ret = HG_Hl_finalize();
     if (ret != HG_SUCCESS) {
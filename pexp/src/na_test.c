@@ -369,6 +369,8 @@ NA_Test_init(int argc, char *argv[], struct na_test_info *na_test_info)
     } else
         na_init_info.progress_mode = NA_DEFAULT;
     na_init_info.auth_key = na_test_info->key;
+    na_init_info.max_contexts = na_test_info->max_contexts ?
+        na_test_info->max_contexts : 1;
 
     printf("# Using info string: %s\n", info_string);
     na_test_info->na_class = NA_Initialize_opt(info_string,
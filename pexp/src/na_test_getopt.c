@@ -17,7 +17,7 @@
 
 int na_test_opt_ind_g = 1; /* token pointer */
 const char *na_test_opt_arg_g = NULL; /* flag argument (or value) */
-const char *na_test_short_opt_g = "hc:p:H:LsSak:l:t:bV";
+const char *na_test_short_opt_g = "hc:p:H:LsSak:l:t:bVAD:Y:OF:CX:W:P:I:B:M:G:RN:";
 const struct na_test_opt na_test_opt_g[] = {
     { "help", no_arg, 'h'},
     { "comm", require_arg, 'c' },
@@ -32,6 +32,21 @@ const struct na_test_opt na_test_opt_g[] = {
     { "threads", require_arg, 't'},
     { "busy", no_arg, 'b'},
     { "verbose", no_arg, 'V' },
+    { "adaptive", no_arg, 'A' },
+    { "durable", require_arg, 'D' },
+    { "sync", require_arg, 'Y' },
+    { "direct", no_arg, 'O' },
+    { "format", require_arg, 'F' },
+    { "checksum", no_arg, 'C' },
+    { "compute", require_arg, 'X' },
+    { "workers", require_arg, 'W' },
+    { "contexts", require_arg, 'P' },
+    { "target_id", require_arg, 'I' },
+    { "spin", require_arg, 'B' },
+    { "budget", require_arg, 'M' },
+    { "hugepages", require_arg, 'G' },
+    { "prefault", no_arg, 'R' },
+    { "numa", require_arg, 'N' },
     { NULL, 0, '\0' } /* Must add this at the end */
 };
 
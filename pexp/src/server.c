@@ -8,12 +8,19 @@
  * found at the root of the source code distribution tree.
  */
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include "mercury_test.h"
 
 #include "mercury_time.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #define HG_TEST_PROGRESS_TIMEOUT    100
 #define HG_TEST_TRIGGER_TIMEOUT     HG_MAX_IDLE_TIME
@@ -27,21 +34,88 @@ hg_progress_thread(void *arg)
     struct hg_test_info *hg_test_info =
         (struct hg_test_info *) HG_Class_get_data(hg_class);
     HG_THREAD_RETURN_TYPE tret = (HG_THREAD_RETURN_TYPE) 0;
+    struct progress_driver driver;
     hg_return_t ret = HG_SUCCESS;
 
+    if (hg_test_info->numa)
+        hg_test_numa_bind_self(hg_test_info->numa, 0);
+
+    progress_driver_init(&driver, context, hg_test_info->spin_us,
+        HG_TEST_PROGRESS_TIMEOUT);
     do {
         if (hg_atomic_cas32(&hg_test_info->finalizing_count, 1, 1))
             break;
 
-        ret = HG_Progress(context, HG_TEST_PROGRESS_TIMEOUT);
+        ret = progress_driver_progress(&driver, HG_TEST_PROGRESS_TIMEOUT);
     } while (ret == HG_SUCCESS || ret == HG_TIMEOUT);
 
+    if (hg_test_info->na_test_info.verbose)
+        progress_driver_print_stats(&driver, stdout, "Progress");
+
     printf("Exiting\n");
     hg_thread_exit(tret);
     return tret;
 }
 #endif
 
+/*---------------------------------------------------------------------------*/
+/* Keep the calling thread on one core, best effort */
+static void
+hg_test_pin_self(unsigned int index)
+{
+#ifdef CPU_SET
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpuset;
+
+    if (ncpus < 1)
+        return;
+    CPU_ZERO(&cpuset);
+    CPU_SET(index % (unsigned int) ncpus, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#else
+    (void) index;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+/* Trigger/progress loop of one of the additional contexts (-P) */
+static void *
+hg_test_context_thread(void *arg)
+{
+    hg_context_t *context = (hg_context_t *) arg;
+    struct hg_test_info *hg_test_info =
+        (struct hg_test_info *) HG_Class_get_data(
+            HG_Context_get_class(context));
+    struct progress_driver driver;
+    hg_return_t ret;
+
+    /* On the CPUs of the context's node with -N, one core otherwise */
+    if (hg_test_info->numa)
+        hg_test_numa_bind_self(hg_test_info->numa,
+            HG_Context_get_id(context));
+    else
+        hg_test_pin_self(HG_Context_get_id(context));
+
+    progress_driver_init(&driver, context, hg_test_info->spin_us,
+        HG_TEST_PROGRESS_TIMEOUT);
+    do {
+        if (hg_atomic_get32(&hg_test_info->finalizing_count))
+            break;
+
+        ret = progress_driver_step(&driver);
+    } while (ret == HG_SUCCESS || ret == HG_TIMEOUT);
+
+    if (hg_test_info->na_test_info.verbose) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "Progress, context %u",
+            (unsigned int) HG_Context_get_id(context));
+        progress_driver_print_stats(&driver, stdout, name);
+    }
+
+    return NULL;
+}
+
 /**
  *
  */
@@ -52,12 +126,31 @@ main(int argc, char *argv[])
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
     hg_thread_t progress_thread;
 #endif
+    pthread_t context_threads[MERCURY_TESTING_MAX_CONTEXTS];
+#ifndef MERCURY_TESTING_HAS_THREAD_POOL
+    struct progress_driver driver;
+#endif
+    unsigned int i;
     hg_return_t ret = HG_SUCCESS;
 
     /* Force to listen */
     hg_test_info.na_test_info.listen = NA_TRUE;
     HG_Test_init(argc, argv, &hg_test_info);
 
+    /* Context 0 stays on this thread, every other one gets its own */
+    if (hg_test_info.context_count > 1) {
+        printf("# Serving on %u contexts\n", hg_test_info.context_count);
+        /* With -N, HG_Test_init() already bound this thread */
+        if (!hg_test_info.numa)
+            hg_test_pin_self(0);
+    }
+    for (i = 1; i < hg_test_info.context_count; i++)
+        if (pthread_create(&context_threads[i], NULL, hg_test_context_thread,
+            hg_test_info.contexts[i]) != 0) {
+            fprintf(stderr, "Could not start context %u\n", i);
+            return EXIT_FAILURE;
+        }
+
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
     hg_thread_create(&progress_thread, hg_progress_thread, hg_test_info.context);
 
@@ -68,31 +161,27 @@ main(int argc, char *argv[])
         ret = HG_Trigger(hg_test_info.context, HG_TEST_TRIGGER_TIMEOUT, 1, NULL);
     } while (ret == HG_SUCCESS || ret == HG_TIMEOUT);
 #else
+    /* Spin for -B us before blocking in HG_Progress */
+    progress_driver_init(&driver, hg_test_info.context, hg_test_info.spin_us,
+        HG_TEST_PROGRESS_TIMEOUT);
     do {
-        unsigned int actual_count = 0;
-	
-	hg_time_t t1, t2;
-	
-        do {
-	    //hg_time_get_current(&t1);
-	    //printf("Trigger\n");
-            ret = HG_Trigger(hg_test_info.context, 0, 1, &actual_count);
-	    //hg_time_get_current(&t2);
-	    //printf("Trigger %f\n", hg_time_to_double(hg_time_subtract(t2, t1)));
-        } while ((ret == HG_SUCCESS) && actual_count);
 	/*
         if (hg_atomic_cas32(&hg_test_info.finalizing_count, 1, 1))
             break;
 	*/
-	//printf("Progress\n");
-        /* Use same value as HG_TEST_TRIGGER_TIMEOUT for convenience */
-        //ret = HG_Progress(hg_test_info.context, HG_TEST_TRIGGER_TIMEOUT);
-        ret = HG_Progress(hg_test_info.context, HG_TEST_PROGRESS_TIMEOUT);
+        ret = progress_driver_step(&driver);
     } while (ret == HG_SUCCESS || ret == HG_TIMEOUT);
+
+    if (hg_test_info.na_test_info.verbose)
+        progress_driver_print_stats(&driver, stdout, "Progress");
 #endif
 
     printf("# Finalizing...\n");
 
+    hg_atomic_set32(&hg_test_info.finalizing_count, 1);
+    for (i = 1; i < hg_test_info.context_count; i++)
+        pthread_join(context_threads[i], NULL);
+
 #ifdef MERCURY_TESTING_HAS_THREAD_POOL
     hg_thread_join(progress_thread);
 #endif
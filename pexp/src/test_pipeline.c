@@ -58,6 +58,8 @@ int main(int argc, char *argv[])
 
     /* Fill input structure */
     bulk_write_in_struct.fildes = fildes;
+    bulk_write_in_struct.checksum_type = HG_TEST_CHECKSUM_NONE;
+    bulk_write_in_struct.checksum = 0;
     bulk_write_in_struct.bulk_handle = bulk_handle;
 
     /* Forward call to remote addr and get a new request */
@@ -0,0 +1,44 @@
+
+#ifndef ADDR_CACHE_H
+#define ADDR_CACHE_H
+
+#include <mercury_config.h>
+#include <mercury.h>
+
+/* Per-context cache of looked up addresses keyed by host string. The first
+ * request for a host starts an HG_Addr_lookup, requests arriving while it
+ * is pending are queued on it, later ones reuse the address directly. */
+struct addr_cache;
+
+/* Called once the address is known (ret == HG_SUCCESS) or the lookup
+ * failed, in the order the lookups were made. Runs in the caller's thread
+ * on a hit, in the progress thread otherwise. A known address is lent to
+ * cb, give it back with addr_cache_release() once done with it. */
+typedef void (*addr_cache_cb_t)(hg_addr_t addr, hg_return_t ret, void *arg);
+
+struct addr_cache *addr_cache_create(hg_class_t *hg_class,
+	hg_context_t *context);
+
+void addr_cache_destroy(struct addr_cache *cache);
+
+/* Failures, including of HG_Addr_lookup itself, are reported through cb */
+void addr_cache_lookup(struct addr_cache *cache, const char *host,
+	addr_cache_cb_t cb, void *arg);
+
+/* Done with an address lent by addr_cache_lookup() */
+void addr_cache_release(struct addr_cache *cache, hg_addr_t addr);
+
+/* Drop addr after a transport error so that the next request looks the
+ * host up again. It is only freed once every borrower gave it back, so it
+ * cannot be reused for another host while still in use. */
+void addr_cache_invalidate(struct addr_cache *cache, hg_addr_t addr);
+
+/* Called right before an address is freed, for users that keep other
+ * state (e.g. idle handles) keyed by it */
+typedef void (*addr_cache_release_cb_t)(hg_addr_t addr, void *arg);
+
+void addr_cache_set_release_cb(struct addr_cache *cache,
+	addr_cache_release_cb_t cb, void *arg);
+
+#endif
+
@@ -7,17 +7,42 @@
 #include <mercury.h>
 #include <mercury_macros.h>
 
+#include "bulk_pool.h"
+#include "addr_cache.h"
+#include "readfile_io.h"
+
 MERCURY_GEN_PROC(readfile_out_t, ((int32_t)(ret)))
 MERCURY_GEN_PROC(readfile_in_t,
 	((int32_t)(name_length))\
 	((int32_t)(size))\
+	((int32_t)(chunk_size))\
 	((hg_bulk_t)(bulk_handle)))
 
 hg_id_t readfile_register(hg_class_t *hg_c, hg_context_t *context);
 
+/* Server side: "aio" or "uring", NULL picks the best available. Must be
+ * set before the first request comes in. */
+void readfile_set_io_backend(const char *name);
+
+/* Server side, to be called from the progress loop: completes finished
+ * file reads, returns how many are still outstanding */
+int readfile_progress(void);
+
 uint32_t readfile(char* name, int32_t size, void *buffer, char *host);
 
+/* Same, but the server reads and pushes the file in chunk_size pieces with
+ * a few of them in flight, instead of staging all of it. The response ret
+ * is then the number of bytes read, or -1. chunk_size 0 is readfile(). */
+uint32_t readfile_stream(char* name, int32_t size, void *buffer, char *host,
+	int32_t chunk_size);
+
+/* Non-zero once the request is done, READFILE_FAILED if the server could
+ * not be reached */
+#define READFILE_FAILED 2
 uint32_t check_readfile(const uint32_t id);
 
+/* Counters of the server-side registered buffer pool */
+void readfile_pool_stats(struct bulk_pool_stats *stats);
+
 #endif
 
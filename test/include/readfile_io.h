@@ -0,0 +1,43 @@
+
+#ifndef READFILE_IO_H
+#define READFILE_IO_H
+
+#include <sys/types.h>
+
+/* Asynchronous file reads for the readfile server, behind a small backend
+ * interface:
+ *  - "aio"   POSIX aio_read() with SIGEV_THREAD, completions run on glibc
+ *            notification threads, readfile_io_poll() has nothing to do
+ *  - "uring" io_uring, completions are reaped by readfile_io_poll() from
+ *            the Mercury progress loop and run there */
+struct readfile_io;
+
+/* ret is the number of bytes read or -errno */
+typedef void (*readfile_io_cb_t)(void *arg, ssize_t ret);
+
+/* NULL or unknown name picks the best backend available, depth bounds
+ * the reads handed to the kernel at once */
+struct readfile_io *readfile_io_create(const char *name, unsigned int depth);
+
+void readfile_io_destroy(struct readfile_io *io);
+
+const char *readfile_io_name(struct readfile_io *io);
+
+/* Returns 0 once the read is queued, cb is then called exactly once */
+int readfile_io_read(struct readfile_io *io, int fd, void *buf, size_t len,
+	off_t offset, readfile_io_cb_t cb, void *arg);
+
+/* Run the callbacks of completed reads, returns how many reads are still
+ * outstanding */
+int readfile_io_poll(struct readfile_io *io);
+
+/* Register [buf, buf + len) with the kernel so reads into it skip the
+ * per-request page pinning. Best effort, returns -1 if the backend does
+ * not support it or its table is full. */
+int readfile_io_register(struct readfile_io *io, void *buf, size_t len);
+
+/* Must be called before a registered buffer is freed */
+void readfile_io_unregister(struct readfile_io *io, void *buf);
+
+#endif
+
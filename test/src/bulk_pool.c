@@ -0,0 +1,399 @@
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "bulk_pool.h"
+
+#define BULK_POOL_MAX_CLASSES 48
+#define BULK_POOL_ALIGN 4096
+
+/* page size selection of MAP_HUGETLB, older headers lack it */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define BULK_MEM_HUGE_FLAG(shift) ((shift) << MAP_HUGE_SHIFT)
+
+static const char *const bulk_mem_names[] = { "none", "thp", "2m", "1g" };
+
+struct bulk_pool {
+	hg_class_t *hg_class;
+	int backing;			// BULK_MEM_* to try first
+	int prefault;
+	int node;			// NUMA node of the regions, -1 any
+	hg_size_t min_size;
+	hg_size_t max_size;
+	unsigned int max_cached;	// free regions kept per size class
+	int num_classes;
+	struct bulk_pool_buf *free_list[BULK_POOL_MAX_CLASSES];
+	unsigned int num_free[BULK_POOL_MAX_CLASSES];
+	struct bulk_pool_stats stats;
+	bulk_pool_release_cb_t release_cb;
+	void *release_arg;
+	pthread_mutex_t lock;
+};
+
+static hg_size_t mem_page_size(int backing) {
+	switch (backing) {
+	case BULK_MEM_HUGE_1G:
+		return (hg_size_t)1 << 30;
+	case BULK_MEM_HUGE_2M:
+	case BULK_MEM_THP:
+		return (hg_size_t)1 << 21;
+	}
+	return BULK_POOL_ALIGN;
+}
+
+static hg_size_t mem_round(hg_size_t size, int backing) {
+	hg_size_t page = mem_page_size(backing);
+
+	return (size + page - 1) & ~(page - 1);
+}
+
+/* write fault every page, the kernel then backs it */
+static void mem_touch(void *buf, hg_size_t size) {
+	volatile char *p = buf;
+	hg_size_t off;
+
+	for (off = 0; off < size; off += BULK_POOL_ALIGN)
+		p[off] = 0;
+}
+
+static void *mem_map_hugetlb(hg_size_t size, int backing, int prefault) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+		BULK_MEM_HUGE_FLAG(backing == BULK_MEM_HUGE_1G ? 30 : 21);
+	void *buf;
+
+	/* pages are reserved at mmap time, a short pool fails here and not
+	 * with SIGBUS on first touch */
+	if (prefault)
+		flags |= MAP_POPULATE;
+	buf = mmap(NULL, mem_round(size, backing), PROT_READ | PROT_WRITE,
+		flags, -1, 0);
+	return buf == MAP_FAILED ? NULL : buf;
+}
+
+/* THP only backs 2 MB aligned ranges, map more and trim to alignment */
+static void *mem_map_thp(hg_size_t size, int prefault) {
+	hg_size_t page = mem_page_size(BULK_MEM_THP);
+	hg_size_t len = mem_round(size, BULK_MEM_THP);
+	char *map, *buf;
+
+	map = mmap(NULL, len + page, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+	buf = (char *)(((uintptr_t)map + page - 1) & ~(uintptr_t)(page - 1));
+	if (buf > map)
+		munmap(map, buf - map);
+	if (map + len + page > buf + len)
+		munmap(buf + len, map + len + page - (buf + len));
+	/* best effort, THP may be disabled */
+	madvise(buf, len, MADV_HUGEPAGE);
+	if (prefault)
+		mem_touch(buf, len);
+	return buf;
+}
+
+/* Prefer node for the pages of [buf, buf + len), those already faulted
+ * in elsewhere are moved. Raw system call so that libnuma is not needed. */
+static int mem_bind(void *buf, hg_size_t len, int node) {
+#ifdef __NR_mbind
+	unsigned long mask[BULK_MEM_MAX_NODES / (8 * sizeof(unsigned long))];
+
+	if (node < 0 || node >= BULK_MEM_MAX_NODES)
+		return -1;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] =
+		1UL << (node % (8 * sizeof(unsigned long)));
+	/* maxnode counts one past the last bit the kernel looks at */
+	return (int)syscall(__NR_mbind, buf, len, MPOL_PREFERRED, mask,
+		BULK_MEM_MAX_NODES + 1, MPOL_MF_MOVE);
+#else
+	(void)buf;
+	(void)len;
+	(void)node;
+	return -1;
+#endif
+}
+
+void *bulk_mem_alloc(hg_size_t size, int *backing, int prefault) {
+	void *buf;
+	int b;
+
+	for (b = *backing; b >= BULK_MEM_HUGE_2M; --b) {
+		buf = mem_map_hugetlb(size, b, prefault);
+		if (buf) {
+			*backing = b;
+			return buf;
+		}
+	}
+	if (b == BULK_MEM_THP) {
+		buf = mem_map_thp(size, prefault);
+		if (buf) {
+			*backing = b;
+			return buf;
+		}
+	}
+	*backing = BULK_MEM_DEFAULT;
+	/* page aligned, so regions can also be used for O_DIRECT I/O */
+	if (posix_memalign(&buf, BULK_POOL_ALIGN, size) != 0)
+		return NULL;
+	if (prefault)
+		mem_touch(buf, size);
+	return buf;
+}
+
+void bulk_mem_free(void *buf, hg_size_t size, int backing) {
+	if (!buf)
+		return;
+	if (backing == BULK_MEM_DEFAULT)
+		free(buf);
+	else
+		munmap(buf, mem_round(size, backing));
+}
+
+void *bulk_mem_alloc_node(hg_size_t size, int *backing, int prefault,
+		int node) {
+	void *buf;
+
+	if (node < 0)
+		return bulk_mem_alloc(size, backing, prefault);
+	/* fault the pages in only once the policy is set */
+	buf = bulk_mem_alloc(size, backing, 0);
+	if (!buf)
+		return NULL;
+	mem_bind(buf, mem_round(size, *backing), node);
+	if (prefault)
+		mem_touch(buf, size);
+	return buf;
+}
+
+const char *bulk_mem_name(int backing) {
+	if (backing < 0 || backing > BULK_MEM_HUGE_1G)
+		return "unknown";
+	return bulk_mem_names[backing];
+}
+
+int bulk_mem_parse(const char *name) {
+	int b;
+
+	for (b = BULK_MEM_DEFAULT; b <= BULK_MEM_HUGE_1G; ++b)
+		if (strcmp(name, bulk_mem_names[b]) == 0)
+			return b;
+	return -1;
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int size_class_of(const struct bulk_pool *pool, hg_size_t size) {
+	hg_size_t class_size = pool->min_size;
+	int c = 0;
+
+	if (size > pool->max_size)
+		return -1;
+	while (class_size < size) {
+		class_size <<= 1;
+		c++;
+	}
+	return c;
+}
+
+/* Each region is mapped on its own, a class smaller than the huge page
+ * would leave most of it unused: such classes take the next smaller
+ * backing, down to regular pages as THP also rounds to 2 MB */
+static int buf_backing(int backing, hg_size_t size) {
+	while (backing > BULK_MEM_DEFAULT && size < mem_page_size(backing))
+		--backing;
+	return backing;
+}
+
+static struct bulk_pool_buf *buf_register(struct bulk_pool *pool,
+		hg_size_t size, int size_class) {
+	struct bulk_pool_buf *buf;
+	uint64_t start = now_ns();
+	hg_return_t ret;
+
+	buf = malloc(sizeof(*buf));
+	if (!buf)
+		return NULL;
+	buf->size = size;
+	buf->size_class = size_class;
+	buf->backing = buf_backing(pool->backing, size);
+	buf->next = NULL;
+	buf->buffer = bulk_mem_alloc_node(size, &buf->backing, pool->prefault,
+		pool->node);
+	if (!buf->buffer) {
+		free(buf);
+		return NULL;
+	}
+	ret = HG_Bulk_create(pool->hg_class, 1, &buf->buffer, &buf->size,
+		HG_BULK_READWRITE, &buf->bulk_handle);
+	if (ret != HG_SUCCESS) {
+		bulk_mem_free(buf->buffer, buf->size, buf->backing);
+		free(buf);
+		return NULL;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.register_ns += now_ns() - start;
+	pthread_mutex_unlock(&pool->lock);
+	return buf;
+}
+
+static void buf_deregister(struct bulk_pool *pool,
+		struct bulk_pool_buf *buf) {
+	if (pool->release_cb)
+		pool->release_cb(buf, pool->release_arg);
+	HG_Bulk_free(buf->bulk_handle);
+	bulk_mem_free(buf->buffer, buf->size, buf->backing);
+	free(buf);
+}
+
+struct bulk_pool *bulk_pool_create(hg_class_t *hg_class, hg_size_t min_size,
+		hg_size_t max_size, unsigned int max_cached) {
+	struct bulk_pool *pool;
+
+	assert(min_size > 0 && min_size <= max_size);
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->hg_class = hg_class;
+	pool->min_size = min_size;
+	pool->max_cached = max_cached;
+	pool->max_size = max_size;
+	/* round max_size up to the last class boundary */
+	pool->num_classes = size_class_of(pool, max_size) + 1;
+	assert(pool->num_classes <= BULK_POOL_MAX_CLASSES);
+	pool->max_size = min_size << (pool->num_classes - 1);
+	pool->node = -1;
+	pthread_mutex_init(&pool->lock, NULL);
+	return pool;
+}
+
+void bulk_pool_set_backing(struct bulk_pool *pool, int backing,
+		int prefault) {
+	pool->backing = backing;
+	pool->prefault = prefault;
+}
+
+void bulk_pool_set_node(struct bulk_pool *pool, int node) {
+	pool->node = node;
+}
+
+void bulk_pool_destroy(struct bulk_pool *pool) {
+	int c;
+
+	if (!pool)
+		return;
+	for (c = 0; c < pool->num_classes; ++c) {
+		while (pool->free_list[c]) {
+			struct bulk_pool_buf *buf = pool->free_list[c];
+			pool->free_list[c] = buf->next;
+			buf_deregister(pool, buf);
+		}
+	}
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int bulk_pool_reserve(struct bulk_pool *pool, hg_size_t size,
+		unsigned int count) {
+	int c = size_class_of(pool, size);
+	unsigned int i;
+
+	if (c < 0)
+		return -1;
+	for (i = 0; i < count; ++i) {
+		struct bulk_pool_buf *buf = buf_register(pool, pool->min_size << c, c);
+		if (!buf)
+			return -1;
+		pthread_mutex_lock(&pool->lock);
+		buf->next = pool->free_list[c];
+		pool->free_list[c] = buf;
+		pool->num_free[c]++;
+		pool->stats.registered_bytes += buf->size;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return 0;
+}
+
+struct bulk_pool_buf *bulk_pool_checkout(struct bulk_pool *pool,
+		hg_size_t size) {
+	struct bulk_pool_buf *buf = NULL;
+	int c = size_class_of(pool, size);
+
+	pthread_mutex_lock(&pool->lock);
+	if (c >= 0 && pool->free_list[c]) {
+		buf = pool->free_list[c];
+		pool->free_list[c] = buf->next;
+		pool->num_free[c]--;
+		pool->stats.hits++;
+	} else {
+		pool->stats.misses++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!buf) {
+		/* register outside of the lock, it is the slow part */
+		buf = buf_register(pool, c >= 0 ? pool->min_size << c : size, c);
+		if (!buf)
+			return NULL;
+		pthread_mutex_lock(&pool->lock);
+		pool->stats.registered_bytes += buf->size;
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.in_use++;
+	if (pool->stats.in_use > pool->stats.high_water)
+		pool->stats.high_water = pool->stats.in_use;
+	pthread_mutex_unlock(&pool->lock);
+
+	buf->next = NULL;
+	return buf;
+}
+
+void bulk_pool_return(struct bulk_pool *pool, struct bulk_pool_buf *buf) {
+	int c = buf->size_class;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.in_use--;
+	if (c >= 0 && pool->num_free[c] < pool->max_cached) {
+		buf->next = pool->free_list[c];
+		pool->free_list[c] = buf;
+		pool->num_free[c]++;
+		buf = NULL;
+	} else {
+		pool->stats.registered_bytes -= buf->size;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (buf)
+		buf_deregister(pool, buf);
+}
+
+void bulk_pool_set_release_cb(struct bulk_pool *pool,
+		bulk_pool_release_cb_t cb, void *arg) {
+	pool->release_cb = cb;
+	pool->release_arg = arg;
+}
+
+void bulk_pool_get_stats(struct bulk_pool *pool,
+		struct bulk_pool_stats *stats) {
+	pthread_mutex_lock(&pool->lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+}
+
@@ -10,6 +10,11 @@
 #include <mercury_macros.h>
 
 #include "readfile.h"
+#include "progress_driver.h"
+
+/* poll up to 50 us before blocking 100 ms in HG_Progress, 0 always blocks */
+#define PROGRESS_SPIN_US 50
+#define PROGRESS_BLOCK_MS 100
 
 na_class_t *network_class;
 hg_class_t *hg_class;
@@ -17,19 +22,13 @@ hg_context_t *hg_context;
 	
 hg_progress_shutdown_flag = 0;
 
+static struct progress_driver hg_progress_driver;
+
 static void* hg_progress_fn(void * foo) {
-	hg_return_t ret;
-	unsigned int actual_count;
 	(void)foo;
 	
 	while(!hg_progress_shutdown_flag) {
-		do {
-			ret = HG_Trigger(hg_context, 0, 1, &actual_count);
-		}while ((ret) == HG_SUCCESS && actual_count && !hg_progress_shutdown_flag);
-		
-		if (!hg_progress_shutdown_flag) {
-			HG_Progress(hg_context, 100);
-		}
+		progress_driver_step(&hg_progress_driver);
 	}
 	
 	return NULL;
@@ -48,6 +47,8 @@ int main(void) {
 	hg_context = HG_Context_create(hg_class);
 	assert(hg_context);
 	
+	progress_driver_init(&hg_progress_driver, hg_context, PROGRESS_SPIN_US,
+		PROGRESS_BLOCK_MS);
 	ret = pthread_create(&hg_progress_tid, NULL, hg_progress_fn, NULL);
 	assert(ret == 0);
 	
@@ -74,6 +75,7 @@ int main(void) {
 	hg_progress_shutdown_flag = 1;
 	ret = pthread_join(hg_progress_tid, NULL);
 	assert(ret == 0);
+	progress_driver_print_stats(&hg_progress_driver, stdout, "progress");
 	
 	return 0;
 }
@@ -1,28 +1,50 @@
 
 #include <assert.h>
 #include <unistd.h>
-#include <aio.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "readfile.h"
 
+/* Server-side bulk targets come from a pool of pre-registered regions */
+#define READFILE_POOL_MIN_SIZE (1 << 12)
+#define READFILE_POOL_MAX_SIZE (1 << 26)
+#define READFILE_POOL_MAX_CACHED 64
+
+/* Reads handed to the kernel at once by the I/O backend */
+#define READFILE_IO_DEPTH 128
+
+/* Streaming: chunks being read or pushed per request, and the bounds the
+ * requested chunk size is clamped to */
+#define READFILE_STREAM_DEPTH 4
+#define READFILE_STREAM_MIN_CHUNK READFILE_POOL_MIN_SIZE
+#define READFILE_STREAM_MAX_CHUNK (1 << 22)
+
+struct readfile_stream;
+
 struct readfile_state {
 	hg_size_t size;
 	void* buffer; // size of buffer
 	hg_bulk_t bulk_handle;
+	struct bulk_pool_buf *pool_buf; // server side only
 	hg_handle_t handle;
-	struct aiocb acb;
+	hg_addr_t addr; // client side, owned by the address cache
+	int fd; // server side, file being read
+	struct readfile_stream *stream; // server side, streaming mode only
 	readfile_in_t in;
 	int value;
 };
 
 static hg_return_t readfile_handler(hg_handle_t handle);
 static hg_return_t readfile_handler_bulk_cb(const struct hg_cb_info *info);
-static void readfile_handler_read_cb(union sigval sig);
+static void readfile_handler_read_cb(void *arg, ssize_t ret);
 static hg_return_t readfile_handler_send_cb(const struct hg_cb_info *info);
-static hg_return_t lookup_cb(const struct hg_cb_info *callback_info);
+static void readfile_stream_start(struct readfile_state *state,
+	const struct hg_info *hgi);
+static void lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg);
 static hg_return_t readline_cb(const struct hg_cb_info *info);
 
 static hg_class_t *hg_class = NULL;
@@ -33,16 +55,52 @@ static hg_context_t *hg_context;
 static uint32_t readline_value = 0;
 static uint32_t readline_comp [READLINE_LIMIT];
 
+static struct bulk_pool *readfile_pool = NULL;
+static struct addr_cache *readfile_addr_cache = NULL;
+static struct readfile_io *readfile_io = NULL;
+static const char *readfile_io_backend = NULL;
+
 /* Register the RPC */
 hg_id_t readfile_register(hg_class_t *hg_c, hg_context_t *context) {
 	hg_class = hg_c;
 	hg_context = context;
 	hg_id = MERCURY_REGISTER(hg_class, "readfile", readfile_in_t,
 		readfile_out_t, readfile_handler);
+	readfile_addr_cache = addr_cache_create(hg_class, hg_context);
+	assert(readfile_addr_cache);
 	return hg_id;
 }
 
 
+void readfile_set_io_backend(const char *name) {
+	readfile_io_backend = name;
+}
+
+/* pooled regions may be registered with the I/O backend as well */
+static void readfile_pool_release_cb(struct bulk_pool_buf *buf, void *arg) {
+	readfile_io_unregister(arg, buf->buffer);
+}
+
+/* Server side, lazily as only the server needs them */
+static void readfile_server_init(hg_class_t *hg_c) {
+	if (readfile_pool)
+		return;
+	readfile_io = readfile_io_create(readfile_io_backend,
+		READFILE_IO_DEPTH);
+	assert(readfile_io);
+	printf("Reading files with the %s backend\n",
+		readfile_io_name(readfile_io));
+	readfile_pool = bulk_pool_create(hg_c, READFILE_POOL_MIN_SIZE,
+		READFILE_POOL_MAX_SIZE, READFILE_POOL_MAX_CACHED);
+	assert(readfile_pool);
+	bulk_pool_set_release_cb(readfile_pool, readfile_pool_release_cb,
+		readfile_io);
+}
+
+int readfile_progress(void) {
+	return readfile_io ? readfile_io_poll(readfile_io) : 0;
+}
+
 /* callback/handler triggered upon receipt of RPC request */
 static hg_return_t readfile_handler(hg_handle_t handle) {
 	int ret;
@@ -60,19 +118,28 @@ static hg_return_t readfile_handler(hg_handle_t handle) {
 	state->size = state->in.name_length > state->in.size ?
 		state->in.name_length : state->in.size;
 	state->handle = handle;
-	/* allocating a target buffer for bulk transfer */
-	state->buffer = malloc(state->size);
-	assert(state->buffer);
+	state->stream = NULL;
+	hgi = HG_Get_info(handle);
+	assert(hgi);
 	
 	printf("Request for a file with name length = %d, size = %d\n",
 		state->in.name_length, state->in.size);
 	
-	/* register local target buffer for bulk access */
-	hgi = HG_Get_info(handle);
-	assert(hgi);
-	ret = HG_Bulk_create(hgi->hg_class, 1, &state->buffer,
-		&state->size, HG_BULK_READWRITE, &state->bulk_handle);
-	assert(ret == 0);
+	readfile_server_init(hgi->hg_class);
+	if (state->in.chunk_size > 0) {
+		readfile_stream_start(state, hgi);
+		return 0;
+	}
+	
+	/* check out an already registered target buffer for bulk access,
+	 * it is used both for the file name and the file data */
+	state->pool_buf = bulk_pool_checkout(readfile_pool, state->size);
+	assert(state->pool_buf);
+	state->buffer = state->pool_buf->buffer;
+	state->bulk_handle = state->pool_buf->bulk_handle;
+	/* let the disk read land directly in the region exposed for bulk,
+	 * a no-op once registered */
+	readfile_io_register(readfile_io, state->buffer, state->pool_buf->size);
 	
 	/* initial bulk transfer from client to server */
 	ret = HG_Bulk_transfer(hgi->context, readfile_handler_bulk_cb,
@@ -92,46 +159,33 @@ static hg_return_t readfile_handler_bulk_cb(const struct hg_cb_info *info) {
 	
 	assert(info->ret == 0);
 	
-	sprintf(filename, "%s", state->buffer);
+	/* pooled buffers are reused, only trust name_length bytes */
+	snprintf(filename, sizeof(filename), "%.*s", state->in.name_length,
+		(char*)state->buffer);
 	printf("File name: %s\n", filename);
-	memset(&state->acb, 0, sizeof(state->acb));
-	state->acb.aio_fildes = open(filename, O_RDONLY, S_IWUSR | S_IRUSR);
-	assert(state->acb.aio_fildes > -1); 
-	
-	/* Set up async I/O operation (read bulk data and the push to client */
-	state->acb.aio_offset = 0;
-	state->acb.aio_buf = state->buffer;
-	state->acb.aio_nbytes = state->size;
-	state->acb.aio_sigevent.sigev_notify = SIGEV_THREAD;
-	state->acb.aio_sigevent.sigev_notify_attributes = NULL;
-	state->acb.aio_sigevent.sigev_notify_function = readfile_handler_read_cb;
-	state->acb.aio_sigevent.sigev_value.sival_ptr = state;
-	
-	/* post async read */
-	ret = aio_read(&state->acb);
+	state->fd = open(filename, O_RDONLY, S_IWUSR | S_IRUSR);
+	assert(state->fd > -1); 
+	
+	/* post async read (read bulk data and then push to client) */
+	ret = readfile_io_read(readfile_io, state->fd, state->buffer,
+		state->size, 0, readfile_handler_read_cb, state);
 	assert(ret == 0);
 	
 	return 0;
 }
 
 /* Send data from server to client */
-static void readfile_handler_read_cb(union sigval sig) {
-	struct readfile_state * state = sig.sival_ptr;
+static void readfile_handler_read_cb(void *arg, ssize_t nread) {
+	struct readfile_state * state = arg;
 	int ret;
 	
-	ret = aio_error(&state->acb);
-	assert(ret == 0);
-	close(state->acb.aio_fildes);
+	assert(nread >= 0);
+	close(state->fd);
 	
-	printf("data: %s\n", (char*)state->buffer);
+	printf("data: %.*s\n", (int)nread, (char*)state->buffer);
 	struct hg_info * hgi = HG_Get_info(state->handle);
 	assert(hgi);
 	
-	HG_Bulk_free(state->bulk_handle);
-	ret = HG_Bulk_create(hgi->hg_class, 1, &state->buffer, &state->size,
-		HG_BULK_READWRITE, &state->bulk_handle);
-	assert(ret == 0);
-	
 	/* initial bulk transfer from server to client */
 	ret = HG_Bulk_transfer(hgi->context, readfile_handler_send_cb,
 		state, HG_BULK_PUSH, hgi->addr, state->in.bulk_handle, 0,
@@ -153,48 +207,281 @@ static hg_return_t readfile_handler_send_cb(const struct hg_cb_info *info) {
 	(void)ret;
 	printf("Sent response to client\n");
 	
-	HG_Bulk_free(state->bulk_handle);
+	HG_Free_input(state->handle, &state->in);
 	HG_Destroy(state->handle);
-	free(state->buffer);
+	bulk_pool_return(readfile_pool, state->pool_buf);
 	free(state);
 	
 	return 0;
 }
 
+/* Streaming mode: the file is read in chunks of chunk_size and every chunk
+ * is pushed to its offset in the client buffer as soon as it is read, the
+ * next read of the chunk buffer being posted once the push is done. Up to
+ * READFILE_STREAM_DEPTH chunks are in flight, which overlaps disk and
+ * network and bounds the server memory used by one request. */
+
+struct readfile_chunk {
+	struct readfile_stream *stream;
+	struct bulk_pool_buf *buf;
+	hg_size_t offset;		// in the file and the client buffer
+	hg_size_t len;
+};
+
+struct readfile_stream {
+	struct readfile_state *state;
+	hg_context_t *context;
+	hg_addr_t addr;
+	hg_size_t chunk_size;
+	hg_size_t next_offset;		// next offset to read
+	hg_size_t pushed;		// bytes pushed to the client
+	int inflight;			// chunks being read or pushed
+	int eof;
+	int error;
+	struct readfile_chunk chunks[READFILE_STREAM_DEPTH];
+	pthread_mutex_t lock;		// reads complete on other threads
+};
+
+static hg_return_t readfile_stream_name_cb(const struct hg_cb_info *info);
+static void readfile_stream_read_cb(void *arg, ssize_t nread);
+static hg_return_t readfile_stream_push_cb(const struct hg_cb_info *info);
+
+static void readfile_stream_start(struct readfile_state *state,
+		const struct hg_info *hgi) {
+	struct readfile_stream *stream;
+	hg_size_t chunk_size = state->in.chunk_size;
+	int ret;
+	
+	if (chunk_size < READFILE_STREAM_MIN_CHUNK)
+		chunk_size = READFILE_STREAM_MIN_CHUNK;
+	if (chunk_size > READFILE_STREAM_MAX_CHUNK)
+		chunk_size = READFILE_STREAM_MAX_CHUNK;
+	if (chunk_size < (hg_size_t)state->in.name_length)
+		chunk_size = state->in.name_length;
+	
+	stream = calloc(1, sizeof(*stream));
+	assert(stream);
+	stream->state = state;
+	stream->context = hgi->context;
+	stream->addr = hgi->addr;
+	stream->chunk_size = chunk_size;
+	pthread_mutex_init(&stream->lock, NULL);
+	state->stream = stream;
+	state->size = state->in.size;
+	
+	/* the first chunk buffer receives the file name */
+	stream->chunks[0].stream = stream;
+	stream->chunks[0].buf = bulk_pool_checkout(readfile_pool, chunk_size);
+	assert(stream->chunks[0].buf);
+	
+	ret = HG_Bulk_transfer(hgi->context, readfile_stream_name_cb,
+		stream, HG_BULK_PULL, hgi->addr, state->in.bulk_handle, 0,
+		stream->chunks[0].buf->bulk_handle, 0, state->in.name_length,
+		HG_OP_ID_IGNORE);
+	assert(ret == 0);
+}
+
+static void readfile_stream_finish(struct readfile_stream *stream) {
+	struct readfile_state *state = stream->state;
+	readfile_out_t out;
+	int ret;
+	
+	close(state->fd);
+	
+	/* number of bytes now in the client buffer */
+	out.ret = stream->error ? -1 : (int32_t)stream->pushed;
+	ret = HG_Respond(state->handle, NULL, NULL, &out);
+	assert(ret == HG_SUCCESS);
+	(void)ret;
+	
+	HG_Free_input(state->handle, &state->in);
+	HG_Destroy(state->handle);
+	pthread_mutex_destroy(&stream->lock);
+	free(stream);
+	free(state);
+}
+
+/* Assign the next range to chunk, stream->lock held. Returns 0 if there
+ * is nothing left to read. */
+static int readfile_stream_next(struct readfile_stream *stream,
+		struct readfile_chunk *chunk) {
+	hg_size_t size = stream->state->size;
+	
+	if (stream->eof || stream->error || stream->next_offset >= size)
+		return 0;
+	chunk->offset = stream->next_offset;
+	chunk->len = size - chunk->offset < stream->chunk_size ?
+		size - chunk->offset : stream->chunk_size;
+	stream->next_offset += chunk->len;
+	return 1;
+}
+
+static void readfile_stream_read(struct readfile_chunk *chunk) {
+	struct readfile_state *state = chunk->stream->state;
+	int ret;
+	
+	ret = readfile_io_read(readfile_io, state->fd, chunk->buf->buffer,
+		chunk->len, chunk->offset, readfile_stream_read_cb, chunk);
+	if (ret != 0)
+		readfile_stream_read_cb(chunk, -EIO);
+}
+
+/* chunk is idle, give it the next range or retire it */
+static void readfile_stream_chunk_done(struct readfile_chunk *chunk) {
+	struct readfile_stream *stream = chunk->stream;
+	struct bulk_pool_buf *buf = chunk->buf;
+	int more, last = 0;
+	
+	pthread_mutex_lock(&stream->lock);
+	more = readfile_stream_next(stream, chunk);
+	if (!more)
+		last = --stream->inflight == 0;
+	pthread_mutex_unlock(&stream->lock);
+	
+	if (more) {
+		readfile_stream_read(chunk);
+		return;
+	}
+	/* stream may be gone past this point unless this was the last chunk */
+	bulk_pool_return(readfile_pool, buf);
+	if (last)
+		readfile_stream_finish(stream);
+}
+
+static hg_return_t readfile_stream_name_cb(const struct hg_cb_info *info) {
+	struct readfile_stream *stream = info->arg;
+	struct readfile_state *state = stream->state;
+	char filename[256];
+	int i, n;
+	
+	assert(info->ret == 0);
+	
+	snprintf(filename, sizeof(filename), "%.*s", state->in.name_length,
+		(char*)stream->chunks[0].buf->buffer);
+	printf("Streaming file: %s\n", filename);
+	state->fd = open(filename, O_RDONLY);
+	assert(state->fd > -1);
+	
+	/* set every chunk up before posting any read, completions may run
+	 * concurrently */
+	for (n = 0; n < READFILE_STREAM_DEPTH; ++n) {
+		struct readfile_chunk *chunk = &stream->chunks[n];
+		
+		chunk->stream = stream;
+		if (!readfile_stream_next(stream, chunk))
+			break;
+		if (n > 0) {
+			chunk->buf = bulk_pool_checkout(readfile_pool,
+				stream->chunk_size);
+			assert(chunk->buf);
+		}
+		readfile_io_register(readfile_io, chunk->buf->buffer,
+			chunk->buf->size);
+	}
+	stream->inflight = n;
+	
+	if (n == 0) {
+		/* empty request */
+		bulk_pool_return(readfile_pool, stream->chunks[0].buf);
+		readfile_stream_finish(stream);
+		return 0;
+	}
+	for (i = 0; i < n; ++i)
+		readfile_stream_read(&stream->chunks[i]);
+	
+	return 0;
+}
+
+static void readfile_stream_read_cb(void *arg, ssize_t nread) {
+	struct readfile_chunk *chunk = arg;
+	struct readfile_stream *stream = chunk->stream;
+	struct readfile_state *state = stream->state;
+	int ret;
+	
+	pthread_mutex_lock(&stream->lock);
+	if (nread < 0)
+		stream->error = 1;
+	else if ((hg_size_t)nread < chunk->len)
+		stream->eof = 1; // short read, the file ends in this chunk
+	pthread_mutex_unlock(&stream->lock);
+	
+	if (nread <= 0) {
+		readfile_stream_chunk_done(chunk);
+		return;
+	}
+	
+	chunk->len = nread;
+	ret = HG_Bulk_transfer(stream->context, readfile_stream_push_cb,
+		chunk, HG_BULK_PUSH, stream->addr, state->in.bulk_handle,
+		chunk->offset, chunk->buf->bulk_handle, 0, chunk->len,
+		HG_OP_ID_IGNORE);
+	assert(ret == 0);
+	(void)ret;
+}
+
+static hg_return_t readfile_stream_push_cb(const struct hg_cb_info *info) {
+	struct readfile_chunk *chunk = info->arg;
+	struct readfile_stream *stream = chunk->stream;
+	
+	pthread_mutex_lock(&stream->lock);
+	if (info->ret == HG_SUCCESS)
+		stream->pushed += chunk->len;
+	else
+		stream->error = 1;
+	pthread_mutex_unlock(&stream->lock);
+	
+	readfile_stream_chunk_done(chunk);
+	return 0;
+}
+
+void readfile_pool_stats(struct bulk_pool_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (readfile_pool)
+		bulk_pool_get_stats(readfile_pool, stats);
+}
+
 uint32_t readfile(char* name, int32_t size, void *buffer, char *host) {
+	return readfile_stream(name, size, buffer, host, 0);
+}
+
+uint32_t readfile_stream(char* name, int32_t size, void *buffer, char *host,
+		int32_t chunk_size) {
 	struct readfile_state *state;
-	na_return_t ret;
+	uint32_t id;
 	int len;
 	
 	state = malloc(sizeof(*state));
-	state->in.name_length = strlen(name);
+	len = strlen(name);
+	state->in.name_length = len;
 	state->in.size = size;
-	state->size = len > size ? len : size;
+	state->in.chunk_size = chunk_size;
+	state->size = len + 1 > size ? len + 1 : size;
 	state->buffer = buffer;
 	state->value = readline_value;
 	readline_comp[readline_value] = 0;
+	id = readline_value;
 	readline_value = (readline_value + 1) % READLINE_LIMIT;
 	sprintf(buffer, "%s", name);
-	ret  = HG_Addr_lookup(hg_context, lookup_cb, state, host, HG_OP_ID_IGNORE);
-	assert(ret == NA_SUCCESS);
-	(void)ret;
+	addr_cache_lookup(readfile_addr_cache, host, lookup_cb, state);
 	
-	return readline_value-1;
+	return id;
 }
 
 uint32_t check_readfile(const uint32_t id) {
 	return readline_comp[id];
 }
 
-static hg_return_t lookup_cb(const struct hg_cb_info *callback_info) {
-	na_addr_t svr_addr = callback_info->info.lookup.addr;
-	struct hg_info *hgi;
-	hg_return_t ret;
-	struct readfile_state *state;
+static void lookup_cb(hg_addr_t svr_addr, hg_return_t ret, void *arg) {
+	const struct hg_info *hgi;
+	struct readfile_state *state = arg;
 	
-	assert(callback_info->ret == 0);
+	if (ret != HG_SUCCESS) {
+		readline_comp[state->value] = READFILE_FAILED;
+		free(state);
+		return;
+	}
 	
-	state = callback_info->arg;
+	state->addr = svr_addr;
 	ret = HG_Create(hg_context, svr_addr, hg_id, &state->handle);
 	assert(ret == HG_SUCCESS);
 	(void)ret;
@@ -207,11 +494,14 @@ static hg_return_t lookup_cb(const struct hg_cb_info *callback_info) {
 	assert(ret == 0);
 	
 	ret = HG_Forward(state->handle, readline_cb, state, &state->in);
-	assert(ret == 0);
-	(void)ret;
-	
-	return NA_SUCCESS;
-	
+	if (ret != HG_SUCCESS) {
+		addr_cache_invalidate(readfile_addr_cache, svr_addr);
+		readline_comp[state->value] = READFILE_FAILED;
+		HG_Bulk_free(state->bulk_handle);
+		HG_Destroy(state->handle);
+		addr_cache_release(readfile_addr_cache, svr_addr);
+		free(state);
+	}
 }
 
 static hg_return_t readline_cb(const struct hg_cb_info *info) {
@@ -219,7 +509,16 @@ static hg_return_t readline_cb(const struct hg_cb_info *info) {
 	int ret;
 	struct readfile_state *state = info->arg;
 	
-	assert(info->ret == HG_SUCCESS);
+	if (info->ret != HG_SUCCESS) {
+		/* transport error, look the server up again next time */
+		addr_cache_invalidate(readfile_addr_cache, state->addr);
+		readline_comp[state->value] = READFILE_FAILED;
+		HG_Bulk_free(state->bulk_handle);
+		HG_Destroy(info->info.forward.handle);
+		addr_cache_release(readfile_addr_cache, state->addr);
+		free(state);
+		return HG_SUCCESS;
+	}
 	
 	/* decode response */
 	ret = HG_Get_output(info->info.forward.handle, &out);
@@ -233,6 +532,7 @@ static hg_return_t readline_cb(const struct hg_cb_info *info) {
 	HG_Bulk_free(state->bulk_handle);
 	HG_Free_output(info->info.forward.handle, &out);
 	HG_Destroy(info->info.forward.handle);
+	addr_cache_release(readfile_addr_cache, state->addr);
 	free(state);
 	
 	return HG_SUCCESS;
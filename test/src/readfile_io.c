@@ -0,0 +1,524 @@
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <aio.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define READFILE_IO_URING
+#endif
+#endif
+
+#include "readfile_io.h"
+
+/* Slots of the io_uring fixed buffer table */
+#define READFILE_IO_MAX_BUFFERS 64
+
+struct readfile_io_req {
+	struct readfile_io *io;
+	int fd;
+	void *buf;
+	size_t len;
+	off_t offset;
+	readfile_io_cb_t cb;
+	void *arg;
+	ssize_t res;
+	struct aiocb acb;		// aio only
+	struct readfile_io_req *next;	// uring backlog
+};
+
+struct readfile_io_ops {
+	const char *name;
+	int (*init)(struct readfile_io *io, unsigned int depth);
+	void (*fini)(struct readfile_io *io);
+	int (*read)(struct readfile_io *io, struct readfile_io_req *req);
+	int (*poll)(struct readfile_io *io);
+	int (*reg)(struct readfile_io *io, void *buf, size_t len);
+	void (*unreg)(struct readfile_io *io, void *buf);
+};
+
+struct readfile_io_uring;
+
+struct readfile_io {
+	const struct readfile_io_ops *ops;
+	int outstanding;
+	struct readfile_io_uring *uring;
+	pthread_mutex_t lock;
+};
+
+/* POSIX aio backend */
+
+static void aio_read_cb(union sigval sig) {
+	struct readfile_io_req *req = sig.sival_ptr;
+	struct readfile_io *io = req->io;
+	ssize_t ret;
+
+	ret = aio_error(&req->acb);
+	if (ret == 0)
+		ret = aio_return(&req->acb);
+	else
+		ret = -ret;
+	req->cb(req->arg, ret);
+	__atomic_fetch_sub(&io->outstanding, 1, __ATOMIC_RELAXED);
+	free(req);
+}
+
+static int aio_backend_init(struct readfile_io *io, unsigned int depth) {
+	(void)io;
+	(void)depth;
+	return 0;
+}
+
+static void aio_backend_fini(struct readfile_io *io) {
+	(void)io;
+}
+
+static int aio_backend_read(struct readfile_io *io,
+		struct readfile_io_req *req) {
+	memset(&req->acb, 0, sizeof(req->acb));
+	req->acb.aio_fildes = req->fd;
+	req->acb.aio_offset = req->offset;
+	req->acb.aio_buf = req->buf;
+	req->acb.aio_nbytes = req->len;
+	req->acb.aio_sigevent.sigev_notify = SIGEV_THREAD;
+	req->acb.aio_sigevent.sigev_notify_attributes = NULL;
+	req->acb.aio_sigevent.sigev_notify_function = aio_read_cb;
+	req->acb.aio_sigevent.sigev_value.sival_ptr = req;
+	__atomic_fetch_add(&io->outstanding, 1, __ATOMIC_RELAXED);
+	if (aio_read(&req->acb) != 0) {
+		__atomic_fetch_sub(&io->outstanding, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return 0;
+}
+
+static int aio_backend_poll(struct readfile_io *io) {
+	return __atomic_load_n(&io->outstanding, __ATOMIC_RELAXED);
+}
+
+static int aio_backend_reg(struct readfile_io *io, void *buf, size_t len) {
+	(void)io;
+	(void)buf;
+	(void)len;
+	return -1;
+}
+
+static void aio_backend_unreg(struct readfile_io *io, void *buf) {
+	(void)io;
+	(void)buf;
+}
+
+static const struct readfile_io_ops aio_ops = {
+	"aio",
+	aio_backend_init,
+	aio_backend_fini,
+	aio_backend_read,
+	aio_backend_poll,
+	aio_backend_reg,
+	aio_backend_unreg
+};
+
+#ifdef READFILE_IO_URING
+
+/* io_uring backend, driven by raw system calls so that liburing is not
+ * required. Submission and completion both happen under io->lock. */
+
+struct readfile_io_uring {
+	int fd;
+	unsigned int entries;
+	unsigned int inflight;		// in the sq or the kernel, not reaped
+	/* submission ring */
+	void *sq_ptr;
+	size_t sq_len;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	/* completion ring, may share the sq mapping */
+	void *cq_ptr;
+	size_t cq_len;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* reads waiting for a free submission slot */
+	struct readfile_io_req *backlog, *backlog_tail;
+	/* fixed buffers, only used if the kernel has sparse tables */
+	int fixed;
+	struct iovec buffers[READFILE_IO_MAX_BUFFERS];
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned int to_submit,
+		unsigned int min_complete, unsigned int flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void *arg,
+		unsigned int nr_args) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_unmap(struct readfile_io_uring *u) {
+	if (u->sqes && u->sqes != MAP_FAILED)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr)
+		munmap(u->cq_ptr, u->cq_len);
+	if (u->sq_ptr && u->sq_ptr != MAP_FAILED)
+		munmap(u->sq_ptr, u->sq_len);
+}
+
+static int uring_backend_init(struct readfile_io *io, unsigned int depth) {
+	struct readfile_io_uring *u;
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	u = calloc(1, sizeof(*u));
+	if (!u)
+		return -1;
+	memset(&p, 0, sizeof(p));
+	u->fd = uring_setup(depth, &p);
+	if (u->fd < 0) {
+		free(u);
+		return -1;
+	}
+	u->entries = p.sq_entries;
+
+	u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_len > u->sq_len)
+			u->sq_len = u->cq_len;
+		u->cq_len = u->sq_len;
+	}
+	u->sq_ptr = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_ptr = u->sq_ptr;
+	else
+		u->cq_ptr = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sq_ptr == MAP_FAILED || u->cq_ptr == MAP_FAILED ||
+			u->sqes == MAP_FAILED) {
+		uring_unmap(u);
+		close(u->fd);
+		free(u);
+		return -1;
+	}
+
+	sq = u->sq_ptr;
+	u->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	cq = u->cq_ptr;
+	u->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+	{
+		struct io_uring_rsrc_register rr;
+
+		/* an empty table, slots are filled as buffers show up */
+		memset(&rr, 0, sizeof(rr));
+		rr.nr = READFILE_IO_MAX_BUFFERS;
+		rr.flags = IORING_RSRC_REGISTER_SPARSE;
+		u->fixed = uring_register(u->fd, IORING_REGISTER_BUFFERS2, &rr,
+			sizeof(rr)) == 0;
+	}
+#endif
+
+	io->uring = u;
+	return 0;
+}
+
+static void uring_backend_fini(struct readfile_io *io) {
+	struct readfile_io_uring *u = io->uring;
+
+	/* reads still in flight would complete into freed rings */
+	assert(u->inflight == 0 && !u->backlog);
+	uring_unmap(u);
+	close(u->fd);
+	free(u);
+	io->uring = NULL;
+}
+
+static int fixed_index(struct readfile_io_uring *u, const void *buf,
+		size_t len) {
+	const char *p = buf;
+	int i;
+
+	if (!u->fixed)
+		return -1;
+	for (i = 0; i < READFILE_IO_MAX_BUFFERS; ++i) {
+		const char *base = u->buffers[i].iov_base;
+
+		if (base && p >= base && p + len <= base + u->buffers[i].iov_len)
+			return i;
+	}
+	return -1;
+}
+
+/* Move backlogged reads to the sq while there is room and hand whatever
+ * the kernel has not consumed yet to it, io->lock held */
+static int uring_submit_backlog(struct readfile_io_uring *u) {
+	struct readfile_io_req *req;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, index, pending;
+	int i, ret;
+
+	tail = *u->sq_tail;
+	while ((req = u->backlog) && u->inflight < u->entries) {
+		u->backlog = req->next;
+		if (!u->backlog)
+			u->backlog_tail = NULL;
+
+		index = tail & *u->sq_mask;
+		sqe = &u->sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		i = fixed_index(u, req->buf, req->len);
+		if (i >= 0) {
+			/* lands straight in the registered (bulk) region */
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->buf_index = i;
+		} else {
+			sqe->opcode = IORING_OP_READ;
+		}
+		sqe->fd = req->fd;
+		sqe->addr = (unsigned long)req->buf;
+		sqe->len = req->len;
+		sqe->off = req->offset;
+		sqe->user_data = (unsigned long)req;
+		u->sq_array[index] = index;
+		tail++;
+		u->inflight++;
+	}
+	__atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+	/* entries left over by a failed enter are retried here as well */
+	pending = tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (!pending)
+		return 0;
+	do {
+		ret = uring_enter(u->fd, pending, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+	return ret < 0 ? -1 : 0;
+}
+
+static int uring_backend_read(struct readfile_io *io,
+		struct readfile_io_req *req) {
+	struct readfile_io_uring *u = io->uring;
+	int ret;
+
+	req->next = NULL;
+	pthread_mutex_lock(&io->lock);
+	if (u->backlog_tail)
+		u->backlog_tail->next = req;
+	else
+		u->backlog = req;
+	u->backlog_tail = req;
+	io->outstanding++;
+	/* a failed submission stays queued, poll retries it */
+	ret = uring_submit_backlog(u);
+	pthread_mutex_unlock(&io->lock);
+	(void)ret;
+	return 0;
+}
+
+static int uring_backend_poll(struct readfile_io *io) {
+	struct readfile_io_uring *u = io->uring;
+	struct readfile_io_req *done = NULL, *req;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	int outstanding;
+
+	pthread_mutex_lock(&io->lock);
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		req = (struct readfile_io_req *)(unsigned long)cqe->user_data;
+		req->res = cqe->res;
+		req->next = done;
+		done = req;
+		u->inflight--;
+		io->outstanding--;
+	}
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	uring_submit_backlog(u);
+	outstanding = io->outstanding;
+	pthread_mutex_unlock(&io->lock);
+
+	/* callbacks may post more reads */
+	while ((req = done)) {
+		done = req->next;
+		req->cb(req->arg, req->res);
+		free(req);
+	}
+	return outstanding;
+}
+
+static int uring_update_slot(struct readfile_io_uring *u, int i) {
+#ifdef IORING_RSRC_REGISTER_SPARSE
+	struct io_uring_rsrc_update2 up;
+
+	memset(&up, 0, sizeof(up));
+	up.offset = i;
+	up.data = (unsigned long)&u->buffers[i];
+	up.nr = 1;
+	return uring_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up,
+		sizeof(up)) == 1 ? 0 : -1;
+#else
+	(void)u;
+	(void)i;
+	return -1;
+#endif
+}
+
+static int uring_backend_reg(struct readfile_io *io, void *buf,
+		size_t len) {
+	struct readfile_io_uring *u = io->uring;
+	int i, ret = -1;
+
+	pthread_mutex_lock(&io->lock);
+	if (fixed_index(u, buf, len) >= 0) {
+		ret = 0;
+	} else if (u->fixed) {
+		for (i = 0; i < READFILE_IO_MAX_BUFFERS; ++i)
+			if (!u->buffers[i].iov_base)
+				break;
+		if (i < READFILE_IO_MAX_BUFFERS) {
+			u->buffers[i].iov_base = buf;
+			u->buffers[i].iov_len = len;
+			ret = uring_update_slot(u, i);
+			if (ret != 0)
+				u->buffers[i].iov_base = NULL;
+		}
+	}
+	pthread_mutex_unlock(&io->lock);
+	return ret;
+}
+
+static void uring_backend_unreg(struct readfile_io *io, void *buf) {
+	struct readfile_io_uring *u = io->uring;
+	int i;
+
+	pthread_mutex_lock(&io->lock);
+	for (i = 0; i < READFILE_IO_MAX_BUFFERS; ++i) {
+		if (u->buffers[i].iov_base == buf) {
+			/* an empty iovec clears the slot */
+			u->buffers[i].iov_base = NULL;
+			u->buffers[i].iov_len = 0;
+			uring_update_slot(u, i);
+		}
+	}
+	pthread_mutex_unlock(&io->lock);
+}
+
+static const struct readfile_io_ops uring_ops = {
+	"uring",
+	uring_backend_init,
+	uring_backend_fini,
+	uring_backend_read,
+	uring_backend_poll,
+	uring_backend_reg,
+	uring_backend_unreg
+};
+
+#endif /* READFILE_IO_URING */
+
+static const struct readfile_io_ops *backends[] = {
+#ifdef READFILE_IO_URING
+	&uring_ops,
+#endif
+	&aio_ops,
+	NULL
+};
+
+struct readfile_io *readfile_io_create(const char *name, unsigned int depth) {
+	struct readfile_io *io;
+	int i, named = 0;
+
+	io = calloc(1, sizeof(*io));
+	if (!io)
+		return NULL;
+	pthread_mutex_init(&io->lock, NULL);
+	for (i = 0; backends[i]; ++i)
+		if (name && strcmp(name, backends[i]->name) == 0)
+			named = 1;
+	/* try the requested backend, else the first one that initializes */
+	for (i = 0; backends[i]; ++i) {
+		if (named && strcmp(name, backends[i]->name) != 0)
+			continue;
+		if (backends[i]->init(io, depth) == 0) {
+			io->ops = backends[i];
+			return io;
+		}
+		if (named)
+			break;
+	}
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+	return NULL;
+}
+
+void readfile_io_destroy(struct readfile_io *io) {
+	if (!io)
+		return;
+	io->ops->fini(io);
+	pthread_mutex_destroy(&io->lock);
+	free(io);
+}
+
+const char *readfile_io_name(struct readfile_io *io) {
+	return io->ops->name;
+}
+
+int readfile_io_read(struct readfile_io *io, int fd, void *buf, size_t len,
+		off_t offset, readfile_io_cb_t cb, void *arg) {
+	struct readfile_io_req *req;
+
+	req = malloc(sizeof(*req));
+	if (!req)
+		return -1;
+	req->io = io;
+	req->fd = fd;
+	req->buf = buf;
+	req->len = len;
+	req->offset = offset;
+	req->cb = cb;
+	req->arg = arg;
+	if (io->ops->read(io, req) != 0) {
+		free(req);
+		return -1;
+	}
+	return 0;
+}
+
+int readfile_io_poll(struct readfile_io *io) {
+	return io->ops->poll(io);
+}
+
+int readfile_io_register(struct readfile_io *io, void *buf, size_t len) {
+	return io->ops->reg(io, buf, len);
+}
+
+void readfile_io_unregister(struct readfile_io *io, void *buf) {
+	io->ops->unreg(io, buf);
+}
+
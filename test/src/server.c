@@ -6,28 +6,27 @@
 #include <unistd.h>
 
 #include "readfile.h"
+#include "progress_driver.h"
 
 #define LOCAL_ADDR "tcp://localhost:1234"
 
+/* poll up to 50 us before blocking 100 ms in HG_Progress, 0 always blocks */
+#define PROGRESS_SPIN_US 50
+#define PROGRESS_BLOCK_MS 100
+
 na_class_t *network_class;
 hg_class_t *hg_class;
 hg_context_t *hg_context;
 
 hg_progress_shutdown_flag = 0;
 
+static struct progress_driver hg_progress_driver;
+
 static void* hg_progress_fn(void * foo) {
-	hg_return_t ret;
-	unsigned int actual_count;
 	(void)foo;
 	
 	while(!hg_progress_shutdown_flag) {
-		do {
-			ret = HG_Trigger(hg_context, 0, 1, &actual_count);
-		}while ((ret) == HG_SUCCESS && actual_count && !hg_progress_shutdown_flag);
-		
-		if (!hg_progress_shutdown_flag) {
-			HG_Progress(hg_context, 100);
-		}
+		progress_driver_step(&hg_progress_driver);
 	}
 	
 	return NULL;
@@ -35,10 +34,13 @@ static void* hg_progress_fn(void * foo) {
 
 
 
-int main() {
+int main(int argc, char *argv[]) {
 	int ret;
 	pthread_t hg_progress_tid;
 	
+	/* optional I/O backend, "aio" or "uring" */
+	readfile_set_io_backend(argc > 1 ? argv[1] : NULL);
+	
 	network_class = NA_Initialize(LOCAL_ADDR, NA_TRUE);
 	assert(network_class);
 	
@@ -48,6 +50,10 @@ int main() {
 	hg_context = HG_Context_create(hg_class);
 	assert(hg_context);
 	
+	/* do not sleep in HG_Progress while file reads are pending */
+	progress_driver_init(&hg_progress_driver, hg_context, PROGRESS_SPIN_US,
+		PROGRESS_BLOCK_MS);
+	progress_driver_set_busy(&hg_progress_driver, readfile_progress);
 	ret = pthread_create(&hg_progress_tid, NULL, hg_progress_fn, NULL);
 	assert(ret == 0);
 
@@ -62,6 +68,7 @@ int main() {
 	hg_progress_shutdown_flag = 1;
 	ret = pthread_join(hg_progress_tid, NULL);
 	assert(ret == 0);
+	progress_driver_print_stats(&hg_progress_driver, stdout, "progress");
 	
 	return 0;
 }